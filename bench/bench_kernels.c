@@ -0,0 +1,659 @@
+// Microbenchmarks for the traversal kernels in isolation.
+//
+// Times axis_slab, ray_aabb, the Amanatides-Woo walk (trace_ray_dda, with
+// the reciprocal/sign setup done per ray as a standalone caller would) and
+// the column-RLE walk (trace_ray_rle) over pre-generated ray sets, for the
+// demo scene, a heightmap terrain, the seeded procedural world and random
+// fills of the grid at several densities. Each scene also reports the RLE
+// store's size against the dense grid and how its 16^3 chunks
+// palette-compress. The sparse chunk walk
+// (trace_ray_sparse) is timed on the roaming camera's rays with raw and
+// palette chunks. Each measurement repeats the whole set until
+// --min-time has elapsed, takes the best of a few repetitions, and reports
+// ns/ray (and ns/step for the walk).
+//
+// Afterwards whole frames are rendered in several feature configurations to
+// check that, once the frame arena has warmed up, rendering makes no system
+// allocation calls; the exit status is 1 if any configuration does. With the
+// edit demo running, the greedy mesh may still grow its per-slice storage as
+// edits fragment the scene; that growth is reported but not counted. An
+// arena whose only spill each frame is inside a released scope must stop
+// spilling too. Where the linker supports --wrap, malloc, calloc and realloc
+// are interposed and every call made during a measured frame is counted as
+// well.
+//
+// World snapshots are packed and unpacked on one thread and on every CPU
+// for a --snapshot-mb buffer of generated sparse world and of a 10% random
+// fill; a round trip that is not bit-identical also exits with status 1.
+//
+// Frames and snapshots run on a worker pool of --threads threads (default
+// one per CPU). --only runs a subset of the sections, in this order: walks,
+// rle, palette, sparse, snapshots, frames.
+//
+//   voxel_bench [--only walks,...] [--min-time SECONDS] [--rays N] [--densities scene,terrain,procedural,0,0.02] [--frames N] [--snapshot-mb N] [--threads N]
+#define VOXEL_NO_MAIN 1
+#include "../main.c"
+
+enum {
+    BENCH_DEFAULT_RAYS = 16384,
+    BENCH_DEFAULT_FRAMES = 120,
+    BENCH_WARMUP_FRAMES = 4,
+    BENCH_SCOPED_BYTES = 1 << 20, // one scoped allocation per frame
+    BENCH_MAX_DENSITIES = 8,
+    BENCH_REPETITIONS = 3,
+    BENCH_DEFAULT_SNAPSHOT_MB = 64,
+    BENCH_SNAPSHOT_W = 1024,    // x and y extent of the snapshot world
+    BENCH_SNAPSHOT_H = 64,
+};
+
+typedef enum {
+    RAYS_COHERENT = 0,  // primary rays of one camera pose, in scanline order
+    RAYS_RANDOM,        // random origins around the grid, random directions
+    RAYS_GRAZING,       // nearly parallel to the floor, just above it
+    RAYS_AXIS,          // exactly along +-x, +-y, +-z
+    RAY_SET_COUNT,
+} RaySetKind;
+
+static const char* RAY_SET_NAMES[RAY_SET_COUNT] = { "coherent", "random", "grazing", "axis" };
+
+typedef struct {
+    int count;
+    Vector3* origin;
+    Vector3* dir;
+} RaySet;
+
+// Keeps results observable so the kernels are not optimized away.
+static volatile float g_bench_sink;
+
+// With VOXEL_BENCH_WRAP_ALLOC the build links with --wrap for the allocator
+// entry points, so every call into them from the renderer or raylib goes
+// through these counters, not just the ones main.c reports itself.
+static unsigned g_bench_heap_calls;
+static bool g_bench_heap_counting;
+
+#if defined(VOXEL_BENCH_WRAP_ALLOC)
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* p, size_t size);
+
+static inline void bench_heap_call(void) {
+    if (__atomic_load_n(&g_bench_heap_counting, __ATOMIC_RELAXED)) {
+        __atomic_fetch_add(&g_bench_heap_calls, 1u, __ATOMIC_RELAXED);
+    }
+}
+
+void* __wrap_malloc(size_t size) {
+    bench_heap_call();
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    bench_heap_call();
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* p, size_t size) {
+    bench_heap_call();
+    return __real_realloc(p, size);
+}
+#endif
+
+static float bench_unit(void) {
+    return (float) (rng_next() >> 8) * (1.0f / 16777216.0f);
+}
+
+static Vector3 bench_random_dir(void) {
+    for (;;) {
+        const Vector3 d = { bench_unit() * 2.0f - 1.0f, bench_unit() * 2.0f - 1.0f, bench_unit() * 2.0f - 1.0f };
+        const float len2 = Vector3DotProduct(d, d);
+        if (len2 > 1e-4f && len2 <= 1.0f) return Vector3Scale(d, 1.0f / sqrtf(len2));
+    }
+}
+
+static void make_ray_set(RaySetKind kind, int count, RaySet* set) {
+    set->count = count;
+    set->origin = (Vector3*) malloc(sizeof(Vector3) * (size_t) count);
+    set->dir = (Vector3*) malloc(sizeof(Vector3) * (size_t) count);
+    const Vector3 size = { (float) GRID_X, (float) GRID_Y, (float) GRID_Z };
+    const CameraRig rig = camera_rig_for_time(3.0f, false);
+
+    for (int i = 0; i < count; i++) {
+        Vector3 o = { 0.0f, 0.0f, 0.0f };
+        Vector3 d = { 0.0f, 0.0f, 1.0f };
+        switch (kind) {
+            case RAYS_COHERENT: {
+                // Spread over the whole image, still in scanline order.
+                const int pixel = (int) (((long) i * (IMG_W * IMG_H)) / count);
+                o = rig.pos;
+                d = Vector3Normalize(pixel_ray_dir(&rig, (float) (pixel % IMG_W), (float) (pixel / IMG_W)));
+            } break;
+            case RAYS_RANDOM:
+                o = (Vector3){ (bench_unit() * 2.0f - 0.5f) * size.x, (bench_unit() * 2.0f - 0.5f) * size.y, (bench_unit() * 2.0f - 0.5f) * size.z };
+                d = bench_random_dir();
+                break;
+            case RAYS_GRAZING: {
+                const float a = bench_unit() * 6.2831853f;
+                o = (Vector3){ bench_unit() * size.x, 1.0f + 0.05f + bench_unit() * 0.5f, bench_unit() * size.z };
+                d = Vector3Normalize((Vector3){ cosf(a), -0.01f - 0.03f * bench_unit(), sinf(a) });
+            } break;
+            case RAYS_AXIS: {
+                const int axis = (int) (rng_next() % 6u);
+                o = (Vector3){ bench_unit() * size.x, bench_unit() * size.y, bench_unit() * size.z };
+                const float sgn = (axis & 1) ? -1.0f : 1.0f;
+                d = (Vector3){ (axis >> 1) == 0 ? sgn : 0.0f, (axis >> 1) == 1 ? sgn : 0.0f, (axis >> 1) == 2 ? sgn : 0.0f };
+            } break;
+            default:
+                break;
+        }
+        set->origin[i] = o;
+        set->dir[i] = d;
+    }
+}
+
+enum { FILL_SCENE = -1, FILL_TERRAIN = -2, FILL_PROCEDURAL = -3 };
+
+// Rolling heightmap: stone, then dirt, then a grass cap.
+static void fill_terrain(void) {
+    for (int z = 0; z < GRID_Z; z++) {
+        for (int x = 0; x < GRID_X; x++) {
+            const float fx = (float) x / (float) GRID_X;
+            const float fz = (float) z / (float) GRID_Z;
+            const float h01 = 0.45f + 0.2f * sinf(fx * 9.0f + 1.3f) * cosf(fz * 7.0f) + 0.1f * sinf((fx + fz) * 23.0f);
+            const int h = clamp_i32((int) (h01 * (float) GRID_Y), 1, GRID_Y);
+            for (int y = 0; y < GRID_Y; y++) {
+                const uint8_t m = (y >= h) ? 0 : (y == h - 1) ? 3 : (y >= h - 3) ? 2 : 1;
+                g_state.voxels[voxel_index(x, y, z)] = m;
+            }
+        }
+    }
+}
+
+// Label of a --densities entry; random fills are formatted into `buf`.
+static const char* scene_name(float density, char* buf, size_t n) {
+    if (density == FILL_SCENE) return "scene";
+    if (density == FILL_TERRAIN) return "terrain";
+    if (density == FILL_PROCEDURAL) return "procedural";
+    snprintf(buf, n, "fill %.0f%%", density * 100.0f);
+    return buf;
+}
+
+// density >= 0 is a random fill; FILL_SCENE / FILL_TERRAIN /
+// FILL_PROCEDURAL pick the demo scene, the heightmap or the seeded
+// procedural world. Rebuilds the RLE store to match.
+static void fill_grid(float density) {
+    if (density == FILL_SCENE) {
+        build_scene();
+        g_state.dirty_count = 0;
+    } else if (density == FILL_PROCEDURAL) {
+        world_generate(WORLD_DEFAULT_SEED);
+        g_state.dirty_count = 0;
+    } else if (density == FILL_TERRAIN) {
+        fill_terrain();
+    } else {
+        for (int i = 0; i < GRID_SIZE; i++) {
+            g_state.voxels[i] = (bench_unit() < density) ? (uint8_t) (1u + rng_next() % 4u) : 0;
+        }
+    }
+    if (!rle_build()) {
+        fprintf(stderr, "out of memory building the RLE store\n");
+        exit(1);
+    }
+}
+
+typedef enum {
+    KERNEL_AXIS_SLAB = 0,
+    KERNEL_RAY_AABB,
+    KERNEL_DDA,
+    KERNEL_RLE,
+    KERNEL_SPARSE,
+    KERNEL_COUNT,
+} KernelKind;
+
+static const char* KERNEL_NAMES[KERNEL_COUNT] = { "axis_slab", "ray_aabb", "dda", "rle", "sparse" };
+
+// One pass over the set; returns traversal steps taken (0 for the box tests).
+static long run_kernel(KernelKind kernel, const RaySet* set) {
+    long steps = 0;
+    float acc = 0.0f;
+    ChunkLookups lookups = { 0, 0, 0 };
+    for (int i = 0; i < set->count; i++) {
+        const Vector3 o = set->origin[i];
+        const Vector3 d = set->dir[i];
+        if (kernel == KERNEL_AXIS_SLAB) {
+            float t0 = -1e30f, t1 = 1e30f;
+            const bool ok = axis_slab(o.x, d.x, 0.0f, (float) GRID_X, &t0, &t1)
+                         && axis_slab(o.y, d.y, 0.0f, (float) GRID_Y, &t0, &t1)
+                         && axis_slab(o.z, d.z, 0.0f, (float) GRID_Z, &t0, &t1);
+            acc += ok ? t0 : 0.0f;
+        } else if (kernel == KERNEL_RAY_AABB) {
+            float t0 = 0.0f, t1 = 0.0f;
+            acc += ray_aabb(o, d, &t0, &t1) ? t1 : 0.0f;
+        } else {
+            const Vector3 inv = { 1.0f / d.x, 1.0f / d.y, 1.0f / d.z };
+            const int sign = (d.x < 0.0f ? 1 : 0) | (d.y < 0.0f ? 2 : 0) | (d.z < 0.0f ? 4 : 0);
+            const TraceResult tr = (kernel == KERNEL_RLE) ? trace_ray_rle(o, d, inv, sign, 0.0f)
+                                 : (kernel == KERNEL_SPARSE) ? trace_ray_sparse(o, d, inv, sign, (float) SPARSE_MAX_DISTANCE, &lookups)
+                                 : trace_ray_dda(o, d, inv, sign, 0.0f);
+            acc += tr.t;
+            steps += tr.steps;
+        }
+    }
+    g_bench_sink = acc;
+    return steps;
+}
+
+static void bench_kernel(KernelKind kernel, const RaySet* set, double min_time, const char* scene) {
+    double best_ns_per_ray = 1e30;
+    double ns_per_step = 0.0;
+    long steps_per_pass = 0;
+    for (int rep = 0; rep < BENCH_REPETITIONS; rep++) {
+        long passes = 0;
+        long steps = 0;
+        const double start = now_seconds();
+        double elapsed = 0.0;
+        do {
+            steps += run_kernel(kernel, set);
+            passes += 1;
+            elapsed = now_seconds() - start;
+        } while (elapsed < min_time);
+
+        const double ns_per_ray = elapsed * 1e9 / ((double) passes * (double) set->count);
+        if (ns_per_ray < best_ns_per_ray) {
+            best_ns_per_ray = ns_per_ray;
+            steps_per_pass = steps / passes;
+            ns_per_step = (steps > 0) ? elapsed * 1e9 / (double) steps : 0.0;
+        }
+    }
+
+    if (kernel >= KERNEL_DDA) {
+        printf("  %-10s %-10s %9.2f ns/ray %8.2f ns/step %7.2f steps/ray\n", KERNEL_NAMES[kernel], scene, best_ns_per_ray, ns_per_step, (double) steps_per_pass / (double) set->count);
+    } else {
+        printf("  %-10s %-10s %9.2f ns/ray\n", KERNEL_NAMES[kernel], scene, best_ns_per_ray);
+    }
+}
+
+// Primary rays of the roaming camera at `time_s`, in scanline order.
+static void make_sparse_ray_set(float time_s, RaySet* set) {
+    const CameraRig rig = camera_rig_roaming(time_s, false);
+    set->count = IMG_W * IMG_H;
+    set->origin = (Vector3*) malloc(sizeof(Vector3) * (size_t) set->count);
+    set->dir = (Vector3*) malloc(sizeof(Vector3) * (size_t) set->count);
+    for (int i = 0; i < set->count; i++) {
+        set->origin[i] = rig.pos;
+        set->dir[i] = Vector3Normalize(pixel_ray_dir(&rig, (float) (i % IMG_W), (float) (i / IMG_W)));
+    }
+}
+
+// Palette-chunk the dense grid (air beyond its edges) and print how the
+// non-empty chunks pack against one byte per voxel.
+static void print_chunk_packing(const char* name) {
+    static uint8_t voxels[CHUNK_VOXELS];
+    int classes[CHUNK_CLASS_COUNT] = { 0 };
+    size_t packed = 0;
+    int chunks = 0;
+    g_chunks.palette = true;
+    for (int cz = 0; cz * CHUNK_SIZE < GRID_Z; cz++) {
+        for (int cy = 0; cy * CHUNK_SIZE < GRID_Y; cy++) {
+            for (int cx = 0; cx * CHUNK_SIZE < GRID_X; cx++) {
+                uint8_t solid = 0;
+                for (int z = 0; z < CHUNK_SIZE; z++) {
+                    for (int y = 0; y < CHUNK_SIZE; y++) {
+                        for (int x = 0; x < CHUNK_SIZE; x++) {
+                            const int gx = cx * CHUNK_SIZE + x, gy = cy * CHUNK_SIZE + y, gz = cz * CHUNK_SIZE + z;
+                            const uint8_t v = inside_grid(gx, gy, gz) ? g_state.voxels[voxel_index(gx, gy, gz)] : 0;
+                            voxels[chunk_voxel_index(x, y, z)] = v;
+                            solid |= v;
+                        }
+                    }
+                }
+                if (!solid) continue;
+                uint8_t palette[256];
+                int palette_count = 0;
+                const ChunkClass cls = chunk_classify(voxels, palette, &palette_count);
+                classes[cls] += 1;
+                packed += (size_t) chunk_block_bytes(cls);
+                chunks += 1;
+            }
+        }
+    }
+    if (chunks == 0) {
+        printf("  %-12s no solid chunks\n", name);
+        return;
+    }
+    const size_t raw = (size_t) chunks * CHUNK_VOXELS;
+    printf("  %-12s %6d chunks  1/2/4/8-bit %5d %5d %5d %5d  %10zu -> %10zu bytes  %6.2fx smaller\n", name, chunks, classes[CHUNK_PAL1], classes[CHUNK_PAL2], classes[CHUNK_PAL4], classes[CHUNK_PAL8], raw, packed, (packed > 0) ? (double) raw / (double) packed : 0.0);
+}
+
+// `mb` MB of generated world, 1024 x 64 voxels per z slice starting at
+// x = -512, in voxel_index order; or, with `random`, a 10% random fill.
+static uint8_t* make_snapshot_world(int mb, bool random) {
+    const int depth = mb * (1 << 20) / (BENCH_SNAPSHOT_W * BENCH_SNAPSHOT_H);
+    const size_t bytes = (size_t) depth * BENCH_SNAPSHOT_W * BENCH_SNAPSHOT_H;
+    uint8_t* world = (uint8_t*) malloc(bytes);
+    if (!world) return NULL;
+    size_t i = 0;
+    for (int z = 0; z < depth; z++) {
+        for (int y = 0; y < BENCH_SNAPSHOT_H; y++) {
+            for (int x = 0; x < BENCH_SNAPSHOT_W; x++, i++) {
+                world[i] = random ? ((bench_unit() < 0.1f) ? (uint8_t) (1u + rng_next() % 4u) : 0)
+                                  : sparse_world_voxel(x - BENCH_SNAPSHOT_W / 2, y, z - depth / 2);
+            }
+        }
+    }
+    return world;
+}
+
+// Pack and unpack `world` with `threads` threads (best of a few runs);
+// false unless the round trip is bit-identical.
+static bool bench_snapshot(const char* name, const uint8_t* world, size_t bytes, int threads) {
+    uint8_t* restored = (uint8_t*) malloc(bytes);
+    if (!restored) return false;
+    double pack_s = 0.0, unpack_s = 0.0;
+    size_t packed = 0;
+    bool identical = true;
+    for (int rep = 0; rep < BENCH_REPETITIONS; rep++) {
+        SnapshotStats st;
+        uint8_t* image = snapshot_pack(world, bytes, threads, &st);
+        if (!image) {
+            identical = false;
+            break;
+        }
+        if (rep == 0 || st.codec_s < pack_s) pack_s = st.codec_s;
+        packed = st.packed_bytes;
+        memset(restored, 0xff, bytes);
+        identical = identical && snapshot_unpack(image, packed, restored, bytes, threads, &st) && memcmp(restored, world, bytes) == 0;
+        if (rep == 0 || st.codec_s < unpack_s) unpack_s = st.codec_s;
+        free(image);
+    }
+    free(restored);
+    printf("  %-10s %2d threads  %10zu -> %9zu bytes  %6.2fx  compress %6.2f GB/s  decompress+verify %6.2f GB/s  %s\n",
+        name, threads, bytes, packed, (packed > 0) ? (double) bytes / (double) packed : 0.0,
+        (pack_s > 0.0) ? (double) bytes / pack_s * 1e-9 : 0.0, (unpack_s > 0.0) ? (double) bytes / unpack_s * 1e-9 : 0.0,
+        identical ? "bit-identical" : "MISMATCH");
+    return identical;
+}
+
+typedef struct {
+    const char* name;
+    PrimaryMode primary;
+    SampleMode sampling;
+    AoMode ao;
+    bool shadows;
+    bool edits;
+    bool sparse;
+} FrameConfig;
+
+static const FrameConfig FRAME_CONFIGS[] = {
+    { "full, baked AO", PRIMARY_DDA, SAMPLE_FULL, AO_BAKED, false, false, false },
+    { "traced AO, shadows", PRIMARY_DDA, SAMPLE_FULL, AO_RAYS, true, false, false },
+    { "checkerboard", PRIMARY_DDA, SAMPLE_CHECKERBOARD, AO_BAKED, false, false, false },
+    { "adaptive", PRIMARY_DDA, SAMPLE_ADAPTIVE, AO_RAYS, false, false, false },
+    { "foveated", PRIMARY_DDA, SAMPLE_FOVEATED, AO_BAKED, true, false, false },
+    { "raster + edits", PRIMARY_RASTER, SAMPLE_FULL, AO_RAYS, false, true, false },
+    { "sparse world", PRIMARY_DDA, SAMPLE_FULL, AO_BAKED, false, false, true },
+};
+
+// Render `frames` frames after a warm-up; returns system allocation calls
+// made in the measured frames, not counting mesh or chunk storage growth.
+// With the allocator interposed, the wrapped heap calls are counted instead.
+static int bench_frames(const FrameConfig* fc, int frames) {
+    g_state.primary_mode = fc->primary;
+    g_state.sample_mode = fc->sampling;
+    g_state.ao_mode = fc->ao;
+    g_state.shadows = fc->shadows;
+    g_state.edit_demo = fc->edits;
+    g_state.sparse_world = fc->sparse;
+    g_state.have_last_frame = false;
+    int allocs = 0;
+    int growth = 0;
+    double render_ms = 0.0;
+    double utilization = 0.0;
+    g_bench_heap_calls = 0;
+    for (int i = 0; i < BENCH_WARMUP_FRAMES + frames; i++) {
+        const float dt = 1.0f / 60.0f;
+        __atomic_store_n(&g_bench_heap_counting, i >= BENCH_WARMUP_FRAMES, __ATOMIC_RELAXED);
+        g_state.time_s += dt;
+        if (g_state.edit_demo) {
+            g_state.edit_demo_time += dt;
+            run_edit_demo(g_state.edit_demo_time);
+        }
+        const FrameStats st = render_voxel_image(dt);
+        __atomic_store_n(&g_bench_heap_counting, false, __ATOMIC_RELAXED);
+        if (i >= BENCH_WARMUP_FRAMES) {
+            allocs += st.system_allocs - st.growth_allocs;
+            growth += st.growth_allocs;
+            render_ms += st.render_ms;
+            utilization += st.pool_utilization;
+        }
+    }
+#if defined(VOXEL_BENCH_WRAP_ALLOC)
+    // The wrapped calls include the ones the renderer reports itself, so
+    // they replace its count. Each storage growth is one heap call.
+    const int heap_calls = (int) __atomic_load_n(&g_bench_heap_calls, __ATOMIC_RELAXED);
+    allocs = (heap_calls > growth) ? heap_calls - growth : 0;
+#endif
+    const FrameArena* arena = &g_frame_arenas[FRAME_ARENA_RENDER];
+    printf("  %-20s %8.3f ms/frame  pool %3.0f%% busy  arena high water %8.1f KB  %d system allocs in %d frames", fc->name, render_ms / (double) frames, 100.0 * utilization / (double) frames, (double) arena->high_water / 1024.0, allocs, frames);
+    printf(growth > 0 ? " (+%d storage growth)" : "", growth);
+    printf("\n");
+    return allocs;
+}
+
+typedef struct {
+    double min_time;
+    int rays;
+    float densities[BENCH_MAX_DENSITIES];
+    int density_count;
+    int frames;
+    int snapshot_mb;
+    int threads;
+} BenchOptions;
+
+// Each kernel on every ray set, the walks once per scene.
+static bool bench_walks(const BenchOptions* o) {
+    RaySet sets[RAY_SET_COUNT];
+    for (int k = 0; k < RAY_SET_COUNT; k++) {
+        make_ray_set((RaySetKind) k, o->rays, &sets[k]);
+    }
+    printf("grid %dx%dx%d, %d rays per set, min %.2f s x %d repetitions (best shown)\n", GRID_X, GRID_Y, GRID_Z, o->rays, o->min_time, BENCH_REPETITIONS);
+    for (int k = 0; k < RAY_SET_COUNT; k++) {
+        printf("\n[%s rays]\n", RAY_SET_NAMES[k]);
+        // The box tests do not read the grid.
+        bench_kernel(KERNEL_AXIS_SLAB, &sets[k], o->min_time, "-");
+        bench_kernel(KERNEL_RAY_AABB, &sets[k], o->min_time, "-");
+        for (int di = 0; di < o->density_count; di++) {
+            fill_grid(o->densities[di]);
+            char buf[32];
+            const char* scene = scene_name(o->densities[di], buf, sizeof(buf));
+            bench_kernel(KERNEL_DDA, &sets[k], o->min_time, scene);
+            bench_kernel(KERNEL_RLE, &sets[k], o->min_time, scene);
+        }
+    }
+    for (int k = 0; k < RAY_SET_COUNT; k++) {
+        free(sets[k].origin);
+        free(sets[k].dir);
+    }
+    return true;
+}
+
+// Dense bytes vs RLE bytes per scene.
+static bool bench_rle_storage(const BenchOptions* o) {
+    printf("\n[column RLE storage, dense grid %d bytes]\n", GRID_SIZE);
+    for (int di = 0; di < o->density_count; di++) {
+        fill_grid(o->densities[di]);
+        const char* name = (o->densities[di] >= 0.0f) ? "fill" : scene_name(o->densities[di], NULL, 0);
+        printf("  %-10s %5.1f%%  %8d runs  %10zu bytes  %6.2fx smaller\n", name, (o->densities[di] >= 0.0f) ? o->densities[di] * 100.0f : 0.0f, rle_run_count(), rle_bytes(), (double) GRID_SIZE / (double) rle_bytes());
+    }
+    return true;
+}
+
+// Palette chunks against one byte per voxel, per scene.
+static bool bench_palette_storage(const BenchOptions* o) {
+    printf("\n[palette chunk storage, %d^3 chunks, empty chunks not stored]\n", CHUNK_SIZE);
+    for (int di = 0; di < o->density_count; di++) {
+        fill_grid(o->densities[di]);
+        char buf[32];
+        print_chunk_packing(scene_name(o->densities[di], buf, sizeof(buf)));
+    }
+    return true;
+}
+
+// The sparse world's streamed window, traced with the roaming camera's
+// primary rays, once per chunk format.
+static bool bench_sparse(const BenchOptions* o) {
+    printf("\n[sparse world, roaming camera at t=3 s]\n");
+    fill_grid(FILL_SCENE);
+    RaySet sparse_rays;
+    make_sparse_ray_set(3.0f, &sparse_rays);
+    for (int format = 0; format < 2; format++) {
+        FrameStats stream_stats;
+        memset(&stream_stats, 0, sizeof(stream_stats));
+        g_chunks.palette = (format == 1);
+        chunk_store_clear();
+        arena_reset(&g_frame_arenas[FRAME_ARENA_RENDER]);
+        chunk_stream(sparse_rays.origin[0], &stream_stats);
+        int classes[CHUNK_CLASS_COUNT];
+        const size_t bytes = chunk_store_bytes(classes);
+        bench_kernel(KERNEL_SPARSE, &sparse_rays, o->min_time, g_chunks.palette ? "palette" : "raw");
+        printf("  %-10s %d chunks, 1/2/4/8-bit/raw %d/%d/%d/%d/%d, %zu bytes with the hash table\n", "", g_chunks.count, classes[CHUNK_PAL1], classes[CHUNK_PAL2], classes[CHUNK_PAL4], classes[CHUNK_PAL8], classes[CHUNK_RAW], bytes);
+    }
+    free(sparse_rays.origin);
+    free(sparse_rays.dir);
+    return true;
+}
+
+// Snapshot codec throughput, single-threaded and on every CPU; false when
+// a round trip is not bit-identical.
+static bool bench_snapshots(const BenchOptions* o) {
+    printf("\n[world snapshots, %d MB, %d KB blocks]\n", o->snapshot_mb, SNAPSHOT_BLOCK / 1024);
+    fill_grid(FILL_SCENE);
+    bool ok = true;
+    for (int random = 0; random < 2; random++) {
+        uint8_t* world = make_snapshot_world(o->snapshot_mb, random == 1);
+        const size_t bytes = (size_t) o->snapshot_mb << 20;
+        const int cpus = parallel_threads((int) (bytes / SNAPSHOT_BLOCK));
+        ok = world && bench_snapshot(random ? "fill 10%" : "generated", world, bytes, 1) && ok;
+        if (world && cpus > 1) ok = bench_snapshot(random ? "fill 10%" : "generated", world, bytes, cpus) && ok;
+        free(world);
+    }
+    if (!ok) printf("FAIL: snapshot round trip is not bit-identical\n");
+    return ok;
+}
+
+// A frame whose only spill is inside a released arena scope, as in the mesh
+// and chunk passes; the arena must still grow so later frames do not spill.
+static int bench_scoped_spill(int frames) {
+    static FrameArena arena = { .name = "scoped arena" };
+    int allocs = 0;
+    for (int i = 0; i < BENCH_WARMUP_FRAMES + frames; i++) {
+        const uint32_t before = __atomic_load_n(&g_memory.system_allocs, __ATOMIC_RELAXED);
+        arena_reset(&arena);
+        const ArenaMark scope = arena_mark(&arena);
+        memset(arena_alloc(&arena, BENCH_SCOPED_BYTES), 0, BENCH_SCOPED_BYTES);
+        arena_release(&arena, scope);
+        if (i >= BENCH_WARMUP_FRAMES) {
+            allocs += (int) (__atomic_load_n(&g_memory.system_allocs, __ATOMIC_RELAXED) - before);
+        }
+    }
+    printf("  %-20s arena capacity %8.1f KB  %d system allocs in %d frames\n", "scoped spill", (double) arena.capacity / 1024.0, allocs, frames);
+    return allocs;
+}
+
+// Whole frames per feature configuration; false when a steady-state frame
+// made a system allocation call.
+static bool bench_all_frames(const BenchOptions* o) {
+    printf("\n[frames, steady state after %d warm-up frames]\n", BENCH_WARMUP_FRAMES);
+    const CliOptions defaults = { .frames = o->frames, .numa_node = -1 };
+    init_state(&defaults);
+    int allocs = 0;
+    printf("  worker pool: %d threads\n", g_pool.workers);
+    for (size_t c = 0; c < sizeof(FRAME_CONFIGS) / sizeof(FRAME_CONFIGS[0]); c++) {
+        allocs += bench_frames(&FRAME_CONFIGS[c], o->frames);
+    }
+    allocs += bench_scoped_spill(o->frames);
+    if (allocs > 0) printf("FAIL: %d system allocation calls in steady-state frames\n", allocs);
+    return allocs == 0;
+}
+
+typedef struct {
+    const char* name;
+    bool (*run)(const BenchOptions* o);
+} BenchSection;
+
+static const BenchSection BENCH_SECTIONS[] = {
+    { "walks", bench_walks },
+    { "rle", bench_rle_storage },
+    { "palette", bench_palette_storage },
+    { "sparse", bench_sparse },
+    { "snapshots", bench_snapshots },
+    { "frames", bench_all_frames },
+};
+enum { BENCH_SECTION_COUNT = (int) (sizeof(BENCH_SECTIONS) / sizeof(BENCH_SECTIONS[0])) };
+
+static void usage(const char* exe) {
+    fprintf(stderr, "usage: %s [--only walks,rle,palette,sparse,snapshots,frames] [--min-time SECONDS] [--rays N] [--densities scene,terrain,procedural,0,0.02,...] [--frames N] [--snapshot-mb N] [--threads N]\n", exe);
+}
+
+int main(int argc, char** argv) {
+    BenchOptions o = {
+        .min_time = 0.2,
+        .rays = BENCH_DEFAULT_RAYS,
+        .densities = { FILL_SCENE, FILL_TERRAIN, FILL_PROCEDURAL, 0.0f, 0.02f, 0.1f, 0.3f },
+        .density_count = 7,
+        .frames = BENCH_DEFAULT_FRAMES,
+        .snapshot_mb = BENCH_DEFAULT_SNAPSHOT_MB,
+        .threads = 0,
+    };
+    bool selected[BENCH_SECTION_COUNT];
+    for (int i = 0; i < BENCH_SECTION_COUNT; i++) selected[i] = true;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            o.min_time = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--rays") == 0 && i + 1 < argc) {
+            o.rays = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            o.frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            o.threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--snapshot-mb") == 0 && i + 1 < argc) {
+            o.snapshot_mb = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--densities") == 0 && i + 1 < argc) {
+            o.density_count = 0;
+            for (char* tok = strtok(argv[++i], ","); tok && o.density_count < BENCH_MAX_DENSITIES; tok = strtok(NULL, ",")) {
+                o.densities[o.density_count++] = (strcmp(tok, "scene") == 0) ? (float) FILL_SCENE
+                                               : (strcmp(tok, "terrain") == 0) ? (float) FILL_TERRAIN
+                                               : (strcmp(tok, "procedural") == 0) ? (float) FILL_PROCEDURAL : (float) atof(tok);
+            }
+        } else if (strcmp(argv[i], "--only") == 0 && i + 1 < argc) {
+            for (int s = 0; s < BENCH_SECTION_COUNT; s++) selected[s] = false;
+            for (char* tok = strtok(argv[++i], ","); tok; tok = strtok(NULL, ",")) {
+                int s = 0;
+                while (s < BENCH_SECTION_COUNT && strcmp(tok, BENCH_SECTIONS[s].name) != 0) s++;
+                if (s == BENCH_SECTION_COUNT) {
+                    fprintf(stderr, "unknown benchmark '%s'\n", tok);
+                    usage(argv[0]);
+                    return 2;
+                }
+                selected[s] = true;
+            }
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (o.rays < 1) o.rays = 1;
+    if (o.frames < 1) o.frames = 1;
+    if (o.snapshot_mb < 1) o.snapshot_mb = 1;
+
+    if (!state_buffers_alloc()) return 1;
+    pool_start(o.threads, false);
+    g_state.rng_state = 0x2545f491u;
+    g_state.ao_mode = AO_HEIGHT;
+
+    bool ok = true;
+    for (int s = 0; s < BENCH_SECTION_COUNT; s++) {
+        if (selected[s]) ok = BENCH_SECTIONS[s].run(&o) && ok;
+    }
+    pool_stop();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,91 @@
+// Shared-memory frame ring shared by the renderer (--shm) and
+// tools/frame_consumer.c.
+//
+// The renderer owns a POSIX shared-memory object holding a small header and
+// FRAME_RING_SLOTS RGBA frames. Frame n goes to slot n % FRAME_RING_SLOTS.
+// Each slot is a seqlock: `state` is 2n+1 while frame n is being written and
+// 2n+2 once it is complete, so readers can use the pixels in place and detect
+// a frame overwritten underneath them by re-checking `state` afterwards.
+// After each publish the renderer bumps `notify` and, when `waiters` says a
+// consumer is blocked in frame_ring_wait, wakes it through a futex (Linux;
+// elsewhere consumers poll). A reader with frames to catch up on costs the
+// renderer no system call.
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define FRAME_RING_MAGIC 0x52465856u  // "VXFR"
+#define FRAME_RING_VERSION 2u
+
+enum { FRAME_RING_SLOTS = 4 };
+
+typedef struct {
+    uint64_t state;         // seqlock word, see above
+    uint64_t frame;         // frame number
+    uint64_t render_ns;     // CLOCK_MONOTONIC when rendering started
+    uint64_t publish_ns;    // CLOCK_MONOTONIC when the pixels were complete
+} FrameRingSlot;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t slots;
+    uint32_t closed;        // set by the renderer on exit
+    uint32_t notify;        // futex word, bumped per published frame
+    uint32_t waiters;       // consumers inside frame_ring_wait
+    uint64_t published;     // frames published so far
+    uint64_t pixel_offset;  // byte offset of slot 0's RGBA pixels
+    uint64_t slot_bytes;    // bytes per frame
+    FrameRingSlot slot[FRAME_RING_SLOTS];
+} FrameRingHeader;
+
+static inline uint64_t frame_ring_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+static inline uint64_t frame_ring_bytes(uint32_t width, uint32_t height) {
+    const uint64_t header = (sizeof(FrameRingHeader) + 63u) & ~(uint64_t) 63u;
+    return header + (uint64_t) FRAME_RING_SLOTS * width * height * 4u;
+}
+
+// Both sides order their store before the other's load (sequentially
+// consistent), so either the waiter's futex sees the new `notify` or the
+// renderer sees the waiter; no wake-up is lost.
+static inline void frame_ring_wake(FrameRingHeader* h) {
+    __atomic_fetch_add(&h->notify, 1u, __ATOMIC_SEQ_CST);
+#if defined(__linux__)
+    if (__atomic_load_n(&h->waiters, __ATOMIC_SEQ_CST) != 0) {
+        syscall(SYS_futex, &h->notify, FUTEX_WAKE, 0x7fffffff, NULL, NULL, 0);
+    }
+#endif
+}
+
+// Wait until `notify` moves past `seen` or the timeout expires.
+static inline void frame_ring_wait(FrameRingHeader* h, uint32_t seen, long timeout_ns) {
+    struct timespec ts = { timeout_ns / 1000000000L, timeout_ns % 1000000000L };
+#if defined(__linux__)
+    __atomic_fetch_add(&h->waiters, 1u, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &h->notify, FUTEX_WAIT, seen, &ts, NULL, 0);
+    __atomic_fetch_sub(&h->waiters, 1u, __ATOMIC_SEQ_CST);
+#else
+    if (__atomic_load_n(&h->notify, __ATOMIC_ACQUIRE) == seen) {
+        ts.tv_sec = 0;
+        ts.tv_nsec = 1000000L;
+        nanosleep(&ts, NULL);
+    }
+#endif
+}
+
+#endif
@@ -1,12 +1,53 @@
+#include <limits.h>
 #include <math.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define VOXEL_HAVE_SSE2 1
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "frame_ring.h"
+#define VOXEL_HAVE_PTHREADS 1
+#define VOXEL_HAVE_SHM 1
+#define VOXEL_HAVE_MMAP 1
+#endif
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#endif
 
 #include "raylib.h"
 #include "raymath.h"
 
+// Marks entry points only main() calls; tools that include this file with
+// VOXEL_NO_MAIN leave them unused.
+#if defined(__GNUC__)
+#define VOXEL_MAYBE_UNUSED __attribute__((unused))
+#else
+#define VOXEL_MAYBE_UNUSED
+#endif
+
+// Per-thread globals (C99 has no _Thread_local).
+#if defined(_MSC_VER)
+#define VOXEL_THREAD_LOCAL __declspec(thread)
+#else
+#define VOXEL_THREAD_LOCAL __thread
+#endif
+
 // -----------------------------------------------------------------------------
 // Tutorial overview
 // -----------------------------------------------------------------------------
@@ -20,18 +61,123 @@
 // 6) Upload that CPU buffer into a raylib texture.
 // 7) Draw texture fullscreen and draw a runtime diagnostics overlay.
 
+#ifndef VOXEL_GRID_X
+#define VOXEL_GRID_X 24
+#endif
+#ifndef VOXEL_GRID_Y
+#define VOXEL_GRID_Y 16
+#endif
+#ifndef VOXEL_GRID_Z
+#define VOXEL_GRID_Z 24
+#endif
+
 enum {
     // CPU ray buffer resolution.
     IMG_W = 320,
     IMG_H = 180,
 
-    // Voxel world dimensions.
-    GRID_X = 24,
-    GRID_Y = 16,
-    GRID_Z = 24,
+    // Presentation rate; also the deadline the quality scheduler plans for.
+    TARGET_FPS = 60,
+
+    // Voxel world dimensions (override with -DVOXEL_GRID_X=... etc.).
+    GRID_X = VOXEL_GRID_X,
+    GRID_Y = VOXEL_GRID_Y,
+    GRID_Z = VOXEL_GRID_Z,
     GRID_SIZE = GRID_X * GRID_Y * GRID_Z,
+    GRID_MAX_DIM = (GRID_X > GRID_Y) ? ((GRID_X > GRID_Z) ? GRID_X : GRID_Z) : ((GRID_Y > GRID_Z) ? GRID_Y : GRID_Z),
+
+    // A ray crosses at most one cell per axis boundary inside the grid.
+    MAX_DDA_STEPS = GRID_X + GRID_Y + GRID_Z,
+
+    // Screen tiles used for partial re-rendering after voxel edits.
+    TILE_SIZE = 8,
+    TILES_X = (IMG_W + TILE_SIZE - 1) / TILE_SIZE,
+    TILES_Y = (IMG_H + TILE_SIZE - 1) / TILE_SIZE,
+    TILE_COUNT = TILES_X * TILES_Y,
+
+    // Edit regions kept before merging kicks in.
+    MAX_DIRTY_REGIONS = 32,
+
+    // Coarse occupancy level: one flag per BRICK_SIZE^3 block of voxels.
+    BRICK_SIZE = 4,
+    BRICKS_X = (GRID_X + BRICK_SIZE - 1) / BRICK_SIZE,
+    BRICKS_Y = (GRID_Y + BRICK_SIZE - 1) / BRICK_SIZE,
+    BRICKS_Z = (GRID_Z + BRICK_SIZE - 1) / BRICK_SIZE,
+    BRICK_COUNT = BRICKS_X * BRICKS_Y * BRICKS_Z,
+    BRICK_VOXELS = BRICK_SIZE * BRICK_SIZE * BRICK_SIZE,
+    FACE_AO_BLOCK = BRICK_VOXELS * 6,
+
+    // Quality scheduler: preset ladder size and per-frame level history. A
+    // level change redraws a still screen QUALITY_REFRESH_TILES tiles per
+    // frame rather than all at once.
+    QUALITY_LEVEL_COUNT = 5,
+    QUALITY_LOG_SIZE = 600,
+    QUALITY_REFRESH_TILES = (TILE_COUNT + 7) / 8,
+
+    // LOD mip chain: level L cells cover 2^L voxels per axis. Level 0 is the
+    // voxel grid itself; coarser levels live in one packed array.
+    LOD_LEVELS = 5,
+    LOD_CAPACITY = GRID_SIZE / 7 + (GRID_X * GRID_Y + GRID_Y * GRID_Z + GRID_X * GRID_Z) / 3
+                 + GRID_X + GRID_Y + GRID_Z + LOD_LEVELS + 2,
+
+    // Sparse world: CHUNK_SIZE^3 chunks in a spatial hash, streamed within
+    // SPARSE_VIEW_CHUNKS of the camera and SPARSE_CHUNKS_Y chunks tall.
+    CHUNK_SHIFT = 4,
+    CHUNK_SIZE = 1 << CHUNK_SHIFT,
+    CHUNK_VOXELS = CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE,
+    CHUNK_TABLE_MIN = 256,
+    SPARSE_VIEW_CHUNKS = 6,
+    SPARSE_CHUNKS_Y = 3,
+    SPARSE_MAX_DISTANCE = (SPARSE_VIEW_CHUNKS - 1) * CHUNK_SIZE,
+    SPARSE_MAX_STEPS = 4 * SPARSE_MAX_DISTANCE,
+
+    LOS_TARGET_MAX = 3,
+
+    // Secondary ray stream: ambient-occlusion probes per primary hit, binned
+    // by direction octant and by the REGION_SIZE^3 block holding the origin.
+    AO_RAYS_PER_HIT = 4,
+    AO_RAY_RANGE = 4,
+    RAY_BATCH = 64,
+    REGION_SIZE = 8,
+    REGIONS_X = (GRID_X + REGION_SIZE - 1) / REGION_SIZE,
+    REGIONS_Y = (GRID_Y + REGION_SIZE - 1) / REGION_SIZE,
+    REGIONS_Z = (GRID_Z + REGION_SIZE - 1) / REGION_SIZE,
+    REGION_COUNT = REGIONS_X * REGIONS_Y * REGIONS_Z,
+    // Huge grids fold regions together rather than growing the bin table.
+    REGION_BINS = (REGION_COUNT < 4096) ? REGION_COUNT : 4096,
+    SECONDARY_BINS = 8 * REGION_BINS,
+
+    // Raster prepass depth/visibility buffers are tile-major and padded to
+    // whole tiles.
+    TILE_PIXELS = TILE_SIZE * TILE_SIZE,
+    VIS_BUFFER_SIZE = TILE_COUNT * TILE_PIXELS,
 };
 
+// Source of the ambient-occlusion term in shading.
+typedef enum {
+    AO_HEIGHT = 0,  // cheap height gradient
+    AO_BAKED,       // per-face corner AO baked from the 3x3 neighborhood
+    AO_RAYS,        // traced hemisphere probes (secondary ray stream)
+    AO_MODE_COUNT,
+} AoMode;
+
+// How primary visibility is resolved.
+typedef enum {
+    PRIMARY_DDA = 0,    // one Amanatides-Woo walk per pixel
+    PRIMARY_RASTER,     // greedy-meshed faces rasterized into a visibility buffer
+    PRIMARY_RLE,        // 2D walk over (x, z) columns of the run-length store
+    PRIMARY_MODE_COUNT,
+} PrimaryMode;
+
+// Which pixels of a dirty tile get a primary ray this frame.
+typedef enum {
+    SAMPLE_FULL = 0,        // every pixel
+    SAMPLE_CHECKERBOARD,    // alternating half, the rest reprojected / interpolated
+    SAMPLE_ADAPTIVE,        // every 2nd pixel per axis, full rate only at discontinuities
+    SAMPLE_FOVEATED,        // full rate in the fovea, 2x2 / 4x4 blocks further out
+    SAMPLE_MODE_COUNT,
+} SampleMode;
+
 // Scale for overlay text and controls.
 static const float UI_FONT_SCALE = 1.2f;
 
@@ -41,6 +187,22 @@ typedef struct {
     int z;
 } IVec3;
 
+// Inclusive voxel-space box touched by an edit.
+typedef struct {
+    IVec3 lo;
+    IVec3 hi;
+} VoxelBox;
+
+// Pinhole camera pose and projection used to build primary rays.
+typedef struct {
+    Vector3 pos;
+    Vector3 forward;
+    Vector3 right;
+    Vector3 up;
+    float aspect;
+    float fov_scale;
+} CameraRig;
+
 // Per-frame traversal diagnostics shown in the overlay.
 typedef struct {
     int rays;
@@ -52,6 +214,51 @@ typedef struct {
     float hit_ratio;
     float rays_per_sec;
     float steps_per_sec;
+    int tiles_traced;
+    int dirty_regions;
+    int edited_voxels;
+    int raster_quads;
+    int raster_triangles;
+    float raster_ms;
+    float render_ms;
+    int beam_samples;
+    int steps_saved;
+    float beam_ms;
+    int secondary_rays;
+    int secondary_batches;
+    int secondary_steps;
+    float batch_fill;
+    float secondary_sort_ms;
+    float secondary_trace_ms;
+    bool secondary_sorted;
+    float primary_ms;
+    int shadow_rays;
+    int shadow_batches;
+    int shadow_occluded;
+    int shadow_steps;
+    float shadow_ms;
+    int los_visible;
+    int system_allocs;      // malloc/mmap calls made while rendering this frame
+    int growth_allocs;      // of those, mesh or chunk storage growing
+    int lod_rays[LOD_LEVELS];
+    int effective_rays;
+    int reprojected;
+    int interpolated;
+    int tiles_refined;
+    int fovea_rays[3];      // rays traced at 1x1, 2x2 and 4x4 shading rate
+    float ray_setup_ms;
+    float reconstruct_ms;   // checkerboard / adaptive / foveated fill-in
+    int quality_level;      // scheduler level this frame ran at
+    int chunks_streamed;    // sparse world: chunks entering / leaving the window
+    int chunks_evicted;
+    int chunk_lookups;
+    int chunk_probes;       // slots inspected over all lookups
+    int chunk_max_probe;
+    float stream_ms;
+    int pool_threads;       // worker pool, the render thread included
+    int pool_tasks;         // ranges run by the pool this frame
+    int pool_steals;        // ranges taken from another worker's deque
+    float pool_utilization; // busy share of the pool during parallel passes
 } FrameStats;
 
 // Result returned by one ray traversal.
@@ -59,22 +266,221 @@ typedef struct {
     bool hit;
     bool entered_grid;
     int steps;
+    int steps_skipped;
     Vector3 col;
+    // Hit details (valid when `hit`): distance, cell, entry-face normal, material.
+    float t;
+    IVec3 cell;
+    IVec3 normal;
+    uint8_t id;
 } TraceResult;
 
+// Primary hit kept per pixel for secondary passes and deferred shading.
+typedef struct {
+    Vector3 pos;
+    IVec3 cell;
+    uint8_t material; // 0 = primary ray missed
+    uint8_t face;
+} PrimaryHit;
+
+// Structure-of-arrays queue of secondary rays; the arrays live in the
+// render thread's frame arena and hold `capacity` rays.
+typedef struct {
+    float* ox;
+    float* oy;
+    float* oz;
+    float* dx;
+    float* dy;
+    float* dz;
+    int32_t* pixel;
+    uint16_t* bin;
+    int count;
+    int capacity;
+} RayStream;
+
+// One vertical run of a voxel column: `length` cells of `material` (0 = air).
+typedef struct {
+    uint8_t material;
+    uint16_t length;
+} ColumnRun;
+
+// One greedy-merged rectangle of exposed voxel faces.
+// `face` is axis * 2 + (1 for +axis normal); u/v span the other two axes
+// in (axis + 1) % 3, (axis + 2) % 3 order, upper bounds exclusive.
+typedef struct {
+    uint16_t u0, v0, u1, v1;
+    uint16_t layer;
+    uint8_t face;
+    uint8_t material;
+} FaceQuad;
+
+// Quads of one face direction on one grid layer, re-meshed as a unit.
+typedef struct {
+    FaceQuad* quads;
+    int count;
+    int capacity;
+} FaceSlice;
+
 // Global app state:
 // - `pixels`: CPU-side RGBA render target (one color per ray/pixel).
 // - `voxels`: tiny tutorial voxel scene (0 = empty, non-zero = material id).
 // - runtime fields for timing, camera mode, and diagnostics overlay.
+//
+// The voxel store, its per-voxel derived data and the pixel buffer are heap
+// buffers from big_alloc (see "Large allocations").
 typedef struct {
     Texture2D ray_texture;
-    Color pixels[IMG_W * IMG_H];
-    uint8_t voxels[GRID_SIZE];
+    Color* pixels;          // IMG_W * IMG_H
+    uint8_t* voxels;        // GRID_SIZE
 
     float time_s;
     bool freeze_camera;
     bool request_quit;
 
+    // Edit batch since the last flush: merged dirty boxes plus voxel count.
+    VoxelBox dirty_regions[MAX_DIRTY_REGIONS];
+    int dirty_count;
+    int edited_voxels;
+    bool edit_demo;
+    float edit_demo_time;
+    Vector3 edit_demo_center;   // blob drawn by the last demo step
+    bool edit_demo_has_blob;    // cleared with the grid it was drawn into
+    uint32_t rng_state;
+
+    // Tiles re-traced this frame; everything else keeps last frame's pixels.
+    uint8_t tile_dirty[TILE_COUNT];
+    CameraRig last_camera;
+    bool have_last_frame;
+
+    // Primary ray table. Camera-space directions (right/up/forward components,
+    // normalized) depend only on resolution and FOV and are rebuilt when the
+    // projection changes; each new camera pose rotates them into world-space
+    // directions with reciprocals and octant sign bits, all SoA per pixel.
+    bool ray_table_valid;
+    CameraRig ray_table_rig;
+    float cam_dir_x[IMG_W * IMG_H];
+    float cam_dir_y[IMG_W * IMG_H];
+    float cam_dir_z[IMG_W * IMG_H];
+    float ray_dx[IMG_W * IMG_H];
+    float ray_dy[IMG_W * IMG_H];
+    float ray_dz[IMG_W * IMG_H];
+    float ray_ix[IMG_W * IMG_H];
+    float ray_iy[IMG_W * IMG_H];
+    float ray_iz[IMG_W * IMG_H];
+    uint8_t ray_sign[IMG_W * IMG_H];
+
+    // Checkerboard sampling: tiles freshly dirtied last frame still owe their
+    // other half, so they are traced once more. Last frame's image and hits
+    // are kept as history to reproject the untraced half from. A settled
+    // tile traced its untraced half last frame and has not been dirtied
+    // since, so that half is kept from history as is.
+    SampleMode sample_mode;
+    uint8_t tile_pending[TILE_COUNT];
+    uint8_t tile_settled[TILE_COUNT];
+    Color history_pixels[IMG_W * IMG_H];
+    PrimaryHit history_hits[IMG_W * IMG_H];
+    // Adaptive sampling refines a tile when neighboring coarse samples differ
+    // in voxel id or face, or by more than this summed RGB distance.
+    int refine_threshold;
+    // Foveated sampling: per-tile shading rate (1, 2 or 4) from the distance
+    // to the fovea center, which is either fixed or follows the mouse.
+    Vector2 fovea_center;
+    float fovea_radius;
+    bool fovea_follow_mouse;
+    uint8_t tile_rate[TILE_COUNT];
+
+    // Raster prepass: exposed-face mesh per (face direction, layer) and the
+    // tile-major visibility buffer it fills.
+    PrimaryMode primary_mode;
+    bool mesh_valid;            // false also when the last mesh ran out of memory
+    int mesh_failures;
+    FaceSlice face_slices[6][GRID_MAX_DIM];
+    int mesh_quads;
+    float vis_inv_depth[VIS_BUFFER_SIZE];
+    uint8_t vis_material[VIS_BUFFER_SIZE];
+    uint8_t vis_face[VIS_BUFFER_SIZE];
+    float primary_ms[PRIMARY_MODE_COUNT];
+    float primary_steps[PRIMARY_MODE_COUNT];    // smoothed steps/ray per mode
+
+    // Column-RLE store: per (x, z) column, runs bottom-up from y = 0 in
+    // rle_runs[rle_col_start[c] .. + rle_col_runs[c]); air above the top
+    // solid run is implicit. Slots past rle_run_used are the spare tail that
+    // edited columns move into. Kept only while the RLE primary mode is in use.
+    bool rle_valid;
+    uint32_t* rle_col_start;    // per column
+    uint16_t* rle_col_runs;     // per column, runs in use
+    uint16_t* rle_col_slots;    // per column, slots it may fill in place
+    uint16_t* rle_col_top;      // per column, one past the top solid cell
+    ColumnRun* rle_runs;
+    int rle_run_capacity;
+    int rle_run_used;           // slots handed out, the spare tail follows
+    int rle_run_total;          // runs in use over all columns
+    int rle_rebuilds;
+
+    // Unbounded world from the sparse chunk store, seen from a roaming camera.
+    bool sparse_world;
+
+    // Dense grid from world_generate(world_seed) instead of build_scene.
+    bool procedural_world;
+    uint32_t world_seed;
+
+    // Beam prepass: coarse occupancy and the safe DDA start per screen tile.
+    bool beam_prepass;
+    uint8_t brick_occupied[BRICK_COUNT];
+    float tile_t_start[TILE_COUNT];
+
+    // Secondary rays: per-pixel primary hits, AO probe results (the ray
+    // queues themselves are per-frame arena buffers) and smoothed trace
+    // times for sorted vs. unsorted order.
+    AoMode ao_mode;
+    bool compare_unsorted;
+    uint32_t frame_index;
+    PrimaryHit primary_hits[IMG_W * IMG_H];
+    uint8_t ao_visible[IMG_W * IMG_H];
+    float secondary_ms_sorted;
+    float secondary_ms_unsorted;
+
+    // Hard shadows toward LIGHT_DIR, traced per tile with the any-hit kernel.
+    bool shadows;
+    bool show_cost_breakdown;
+    uint8_t shadow_visible[IMG_W * IMG_H];
+    // Line-of-sight probe targets, just above the columns the world builder
+    // placed.
+    Vector3 los_targets[LOS_TARGET_MAX];
+    int los_target_count;
+
+    // Level-of-detail traversal: majority-material mip chain and the
+    // footprint multiplier (1 = switch when a pixel covers a whole cell).
+    bool lod_enabled;
+    float lod_bias;
+    int lod_dims[LOD_LEVELS][3];
+    int lod_offset[LOD_LEVELS];
+    uint8_t* lod_cells;     // LOD_CAPACITY
+
+    // Frame-budget scheduler (see the quality section).
+    bool auto_quality;
+    int quality_level;
+    int quality_over_frames;
+    int quality_headroom_frames;
+    float quality_cost_ms[QUALITY_LEVEL_COUNT];
+    int quality_refresh_tile;   // next tile of a rolling redraw, TILE_COUNT when done
+    uint8_t quality_log[QUALITY_LOG_SIZE];  // level per frame, ring of the last ~10 s
+    int quality_log_count;
+    FILE* quality_log_file;
+
+    // Baked vertex-style AO: per voxel, 6 faces x 4 corners x 2 bits
+    // (0 = fully occluded .. 3 = open). Only bricks with an exposed face keep
+    // a block of FACE_AO_BLOCK bytes, indexed (voxel in brick) * 6 + face;
+    // face_ao_brick maps each brick to its block + 1, 0 for none. Released
+    // blocks are chained through their first word for reuse.
+    bool face_ao_valid;
+    uint32_t* face_ao_brick;    // BRICK_COUNT
+    uint8_t* face_ao;           // face_ao_capacity blocks
+    int face_ao_capacity;
+    int face_ao_blocks;         // blocks in use
+    int face_ao_next;           // blocks ever handed out
+    uint32_t face_ao_free;      // first released block + 1, 0 for none
+
     FrameStats frame_stats;
     float frame_ms;
     float fps_smooth;
@@ -88,16 +494,526 @@ static inline int clamp_i32(int v, int lo, int hi) {
     return (v < lo) ? lo : (v > hi) ? hi : v;
 }
 
+static inline int min_i32(int a, int b) {
+    return (a < b) ? a : b;
+}
+
+static inline int max_i32(int a, int b) {
+    return (a > b) ? a : b;
+}
+
 static inline float clamp_f32(float v, float lo, float hi) {
     return (v < lo) ? lo : (v > hi) ? hi : v;
 }
 
+// Monotonic wall clock for pass timings.
+static double now_seconds(void) {
+#if defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+#else
+    return (double) clock() / (double) CLOCKS_PER_SEC;
+#endif
+}
+
+// -----------------------------------------------------------------------------
+// Large allocations
+// -----------------------------------------------------------------------------
+// The voxel store and the big per-pixel buffers are mapped at startup rather
+// than living in .bss, so large grids can sit on huge pages (far fewer dTLB
+// misses for the scattered reads of DDA traversal) and on the NUMA node the
+// render thread is pinned to. Buffers of at least half a huge page try
+// explicit huge pages first (MAP_HUGETLB, 1 GB then 2 MB; these need pages
+// reserved in /proc/sys/vm/nr_hugepages), then a 2 MB-aligned mapping
+// advised for transparent huge pages, then plain pages. With --numa-node N
+// the render thread (and the I/O and pool threads it starts) runs on N's
+// CPUs and every mapping prefers N's memory, bound before the first touch.
+// Without --numa-node the pool spans every node, so the data the traversal
+// kernels read at random gets a read-only replica per node (see "NUMA
+// replicas").
+
+enum { MAX_BIG_ALLOCS = 32, NUMA_MAX_NODES = 64, NUMA_MAX_CPUS = 1024 };
+
+#define HUGE_PAGE_2M ((size_t) 2 << 20)
+#define HUGE_PAGE_1G ((size_t) 1 << 30)
+#define MASK_WORD_BITS ((int) (8 * sizeof(unsigned long)))
+
+typedef enum {
+    PAGES_HEAP = 0,     // malloc, where mmap is not available
+    PAGES_4K,
+    PAGES_THP,          // madvise(MADV_HUGEPAGE); the kernel may still decline
+    PAGES_2M,
+    PAGES_1G,
+    PAGE_KIND_COUNT,
+} PageKind;
+
+static const char* PAGE_KIND_NAMES[PAGE_KIND_COUNT] = { "heap", "4K", "THP", "2M", "1G" };
+
+typedef struct {
+    const char* name;
+    void* ptr;
+    size_t bytes;       // mapped length
+    PageKind pages;
+} BigAlloc;
+
+typedef struct {
+    bool huge_pages;    // --huge-pages off: plain pages only
+    int numa_node;      // -1 = kernel default placement
+    int numa_nodes;     // nodes listed in sysfs (0 = no NUMA information)
+    BigAlloc allocs[MAX_BIG_ALLOCS];
+    int count;
+    uint32_t system_allocs; // malloc/mmap calls made by the renderer so far
+    uint32_t growth_allocs; // of those, growth of persistent storage (mesh slices, chunk store)
+} MemoryLayer;
+
+static MemoryLayer g_memory = { .huge_pages = true, .numa_node = -1 };
+
+// The table is shared with the I/O thread, whose frame arena may regrow.
+#if defined(VOXEL_HAVE_PTHREADS)
+static pthread_mutex_t g_memory_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static inline void memory_lock(void) {
+#if defined(VOXEL_HAVE_PTHREADS)
+    pthread_mutex_lock(&g_memory_lock);
+#endif
+}
+
+static inline void memory_unlock(void) {
+#if defined(VOXEL_HAVE_PTHREADS)
+    pthread_mutex_unlock(&g_memory_lock);
+#endif
+}
+
+static inline void count_system_alloc(void) {
+    __atomic_fetch_add(&g_memory.system_allocs, 1u, __ATOMIC_RELAXED);
+}
+
+static inline void count_growth_alloc(void) {
+    count_system_alloc();
+    __atomic_fetch_add(&g_memory.growth_allocs, 1u, __ATOMIC_RELAXED);
+}
+
+static inline size_t round_up_size(size_t v, size_t align) {
+    return (v + align - 1) / align * align;
+}
+
+#if defined(VOXEL_HAVE_MMAP)
+static void* map_anonymous(size_t bytes, int extra_flags) {
+    void* p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | extra_flags, -1, 0);
+    return (p == MAP_FAILED) ? NULL : p;
+}
+#endif
+
+// Prefer `node`'s memory for a fresh (untouched) mapping; -1 leaves the
+// kernel default.
+static void numa_bind(void* p, size_t bytes, int node) {
+#if defined(__linux__)
+    if (node < 0) return;
+    unsigned long mask[NUMA_MAX_NODES / MASK_WORD_BITS + 1] = { 0 };
+    mask[node / MASK_WORD_BITS] |= 1ul << (node % MASK_WORD_BITS);
+    if (syscall(SYS_mbind, p, bytes, MPOL_PREFERRED, mask, (unsigned long) NUMA_MAX_NODES + 1, 0) != 0) {
+        perror("mbind");
+    }
+#else
+    (void) p;
+    (void) bytes;
+    (void) node;
+#endif
+}
+
+// Zeroed buffer of at least `bytes` on `node`'s memory (-1 = kernel
+// default), page aligned when mapped; NULL when out of memory.
+static void* big_alloc_on(const char* name, size_t bytes, int node) {
+    BigAlloc a = { name, NULL, bytes, PAGES_HEAP };
+#if defined(VOXEL_HAVE_MMAP)
+    const bool huge = g_memory.huge_pages && bytes >= HUGE_PAGE_2M / 2;
+#if defined(MAP_HUGETLB)
+#if !defined(MAP_HUGE_SHIFT)
+#define MAP_HUGE_SHIFT 26
+#endif
+    if (huge && bytes >= HUGE_PAGE_1G / 2) {
+        a.bytes = round_up_size(bytes, HUGE_PAGE_1G);
+        a.ptr = map_anonymous(a.bytes, MAP_HUGETLB | (30 << MAP_HUGE_SHIFT));
+        a.pages = PAGES_1G;
+    }
+    if (huge && !a.ptr) {
+        a.bytes = round_up_size(bytes, HUGE_PAGE_2M);
+        a.ptr = map_anonymous(a.bytes, MAP_HUGETLB | (21 << MAP_HUGE_SHIFT));
+        a.pages = PAGES_2M;
+    }
+#endif
+#if defined(MADV_HUGEPAGE)
+    if (huge && !a.ptr) {
+        // Over-map by one huge page and trim so the region is 2 MB aligned.
+        a.bytes = round_up_size(bytes, HUGE_PAGE_2M);
+        uint8_t* raw = (uint8_t*) map_anonymous(a.bytes + HUGE_PAGE_2M, 0);
+        if (raw) {
+            uint8_t* aligned = (uint8_t*) round_up_size((size_t) (uintptr_t) raw, HUGE_PAGE_2M);
+            const size_t head = (size_t) (aligned - raw);
+            if (head > 0) munmap(raw, head);
+            munmap(aligned + a.bytes, HUGE_PAGE_2M - head);
+            madvise(aligned, a.bytes, MADV_HUGEPAGE);
+            a.ptr = aligned;
+            a.pages = PAGES_THP;
+        }
+    }
+#endif
+    if (!a.ptr) {
+        a.bytes = round_up_size(bytes, 4096);
+        a.ptr = map_anonymous(a.bytes, 0);
+        a.pages = PAGES_4K;
+    }
+    if (a.ptr) numa_bind(a.ptr, a.bytes, node);
+#else
+    (void) node;
+#endif
+    if (!a.ptr) {
+        a.bytes = bytes;
+        a.ptr = calloc(1, bytes);
+        a.pages = PAGES_HEAP;
+    }
+    if (!a.ptr) return NULL;
+    count_system_alloc();
+    memory_lock();
+    const bool stored = g_memory.count < MAX_BIG_ALLOCS;
+    if (stored) g_memory.allocs[g_memory.count++] = a;
+    memory_unlock();
+    if (!stored) {
+        fprintf(stderr, "big_alloc: table full (%d mappings), cannot map %s; raise MAX_BIG_ALLOCS\n", MAX_BIG_ALLOCS, name);
+#if defined(VOXEL_HAVE_MMAP)
+        if (a.pages != PAGES_HEAP) {
+            munmap(a.ptr, a.bytes);
+            return NULL;
+        }
+#endif
+        free(a.ptr);
+        return NULL;
+    }
+    return a.ptr;
+}
+
+// big_alloc_on the pinned node, if any.
+static void* big_alloc(const char* name, size_t bytes) {
+    return big_alloc_on(name, bytes, g_memory.numa_node);
+}
+
+static void big_free(void* p) {
+    if (!p) return;
+    memory_lock();
+    for (int i = 0; i < g_memory.count; i++) {
+        BigAlloc* a = &g_memory.allocs[i];
+        if (a->ptr != p) continue;
+#if defined(VOXEL_HAVE_MMAP)
+        if (a->pages != PAGES_HEAP) {
+            munmap(a->ptr, a->bytes);
+        } else
+#endif
+        {
+            free(a->ptr);
+        }
+        *a = g_memory.allocs[--g_memory.count];
+        break;
+    }
+    memory_unlock();
+}
+
+// Bytes currently mapped with each page kind.
+static void big_alloc_totals(size_t totals[PAGE_KIND_COUNT]) {
+    for (int k = 0; k < PAGE_KIND_COUNT; k++) totals[k] = 0;
+    memory_lock();
+    for (int i = 0; i < g_memory.count; i++) {
+        totals[g_memory.allocs[i].pages] += g_memory.allocs[i].bytes;
+    }
+    memory_unlock();
+}
+
+static void memory_report(FILE* out) {
+    fprintf(out, "memory:");
+    memory_lock();
+    for (int i = 0; i < g_memory.count; i++) {
+        const BigAlloc* a = &g_memory.allocs[i];
+        fprintf(out, "%s %s %.0f KB %s", (i > 0) ? "," : "", a->name, (double) a->bytes / 1024.0, PAGE_KIND_NAMES[a->pages]);
+    }
+    memory_unlock();
+    fprintf(out, " | NUMA node %d of %d\n", g_memory.numa_node, g_memory.numa_nodes);
+}
+
+// Parse sysfs' cpulist format ("0-7,16-23") into an affinity mask.
+static bool numa_node_cpus(int node, unsigned long* mask, int words) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE* f = fopen(path, "r");
+    if (!f) return false;
+    bool any = false;
+    int lo = 0;
+    while (fscanf(f, "%d", &lo) == 1) {
+        int hi = lo;
+        int c = fgetc(f);
+        if (c == '-') {
+            if (fscanf(f, "%d", &hi) != 1) break;
+            c = fgetc(f);
+        }
+        for (int cpu = lo; cpu <= hi && cpu < words * MASK_WORD_BITS; cpu++) {
+            mask[cpu / MASK_WORD_BITS] |= 1ul << (cpu % MASK_WORD_BITS);
+            any = true;
+        }
+        if (c != ',') break;
+    }
+    fclose(f);
+    return any;
+}
+
+// Count NUMA nodes and, with `node` >= 0, pin the calling thread to that
+// node's CPUs so later mappings and first touches are local to it.
+VOXEL_MAYBE_UNUSED static bool memory_setup(bool huge_pages, int node) {
+    g_memory.huge_pages = huge_pages;
+    g_memory.numa_nodes = 0;
+    unsigned long probe[NUMA_MAX_CPUS / MASK_WORD_BITS] = { 0 };
+    while (g_memory.numa_nodes < NUMA_MAX_NODES && numa_node_cpus(g_memory.numa_nodes, probe, NUMA_MAX_CPUS / MASK_WORD_BITS)) {
+        g_memory.numa_nodes += 1;
+    }
+    if (node < 0) return true;
+#if defined(__linux__)
+    unsigned long mask[NUMA_MAX_CPUS / MASK_WORD_BITS] = { 0 };
+    if (!numa_node_cpus(node, mask, NUMA_MAX_CPUS / MASK_WORD_BITS)) {
+        fprintf(stderr, "--numa-node %d: no such node with CPUs (%d nodes)\n", node, g_memory.numa_nodes);
+        return false;
+    }
+    if (syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) != 0) {
+        perror("sched_setaffinity");
+        return false;
+    }
+    g_memory.numa_node = node;
+    return true;
+#else
+    fprintf(stderr, "--numa-node needs Linux\n");
+    return false;
+#endif
+}
+
+// -----------------------------------------------------------------------------
+// NUMA replicas
+// -----------------------------------------------------------------------------
+// The traversal kernels read the voxel store, the brick map and the LOD
+// cells at random. Without --numa-node, pool workers run on every node, so
+// each node other than the render thread's gets a read-only copy of all
+// three in one mapping on its own memory. A worker looks up its node when
+// it joins a pool job and reads that node's copy until the job ends.
+// Everything outside pool jobs, and every write, uses the g_state
+// originals. flush_voxel_edits copies each dirty region into the replicas
+// before the frame's jobs start.
+
+enum {
+    REPLICA_BRICKS = (GRID_SIZE + 63) / 64 * 64,
+    REPLICA_LOD = (REPLICA_BRICKS + BRICK_COUNT + 63) / 64 * 64,
+    REPLICA_BYTES = REPLICA_LOD + LOD_CAPACITY,
+};
+
+typedef struct {
+    uint8_t* base;          // voxels at 0, bricks at REPLICA_BRICKS, LOD at REPLICA_LOD
+} VoxelReplica;
+
+typedef struct {
+    int home_node;          // render thread's node, served by the originals
+    int count;
+    VoxelReplica node[NUMA_MAX_NODES];     // base NULL = no copy on that node
+} ReplicaSet;
+
+static ReplicaSet g_replicas = { .home_node = -1 };
+// The calling thread's copy while it works on a pool job, else NULL.
+static VOXEL_THREAD_LOCAL const VoxelReplica* t_replica;
+
+static inline const uint8_t* read_voxels(void) {
+    return t_replica ? t_replica->base : g_state.voxels;
+}
+
+static inline const uint8_t* read_bricks(void) {
+    return t_replica ? t_replica->base + REPLICA_BRICKS : g_state.brick_occupied;
+}
+
+static inline const uint8_t* read_lod_cells(void) {
+    return t_replica ? t_replica->base + REPLICA_LOD : g_state.lod_cells;
+}
+
+// NUMA node the calling thread is running on, -1 when unknown.
+static int current_numa_node(void) {
+#if defined(__linux__) && defined(SYS_getcpu)
+    unsigned cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0) return (int) node;
+#endif
+    return -1;
+}
+
+// Pick the calling thread's copy at the start of a pool job.
+static inline void replica_enter(void) {
+    if (g_replicas.count == 0) return;
+    const int node = current_numa_node();
+    t_replica = (node >= 0 && node < NUMA_MAX_NODES && g_replicas.node[node].base) ? &g_replicas.node[node] : NULL;
+}
+
+static inline void replica_leave(void) {
+    t_replica = NULL;
+}
+
+// -----------------------------------------------------------------------------
+// Frame arenas
+// -----------------------------------------------------------------------------
+// Transient per-frame buffers (AO ray streams and their sort tables, greedy
+// meshing masks, output conversion planes) are bump-allocated from an arena
+// owned by the one thread that uses them and reset once per frame. A request
+// that does not fit spills into a malloc'd overflow block. The next reset
+// frees those and re-maps the arena at its high-water mark plus slack, so
+// after a warm-up frame (or a jump in work, e.g. switching to traced AO) the
+// steady state makes no system allocation calls at all.
+
+enum {
+    ARENA_ALIGN = 64,
+    ARENA_MAX_OVERFLOW = 16,
+    ARENA_MIN_OVERFLOW = 256 * 1024,
+    ARENA_GRANULE = 64 * 1024,
+};
+
+typedef enum {
+    FRAME_ARENA_RENDER = 0,     // render thread
+    FRAME_ARENA_IO,             // frame output thread
+    FRAME_ARENA_COUNT,
+} FrameArenaId;
+
+typedef struct {
+    void* raw;                  // as returned by malloc
+    uint8_t* ptr;               // ARENA_ALIGN aligned start
+    size_t size;
+    size_t used;
+} ArenaOverflow;
+
+typedef struct {
+    const char* name;
+    uint8_t* base;              // main block, from big_alloc
+    size_t capacity;
+    size_t used;
+    size_t frame_bytes;         // requested since the last reset, spills included
+    size_t high_water;          // largest frame_bytes so far
+    ArenaOverflow overflow[ARENA_MAX_OVERFLOW];
+    int overflow_count;
+    int regrows;
+    int regrow_failures;
+} FrameArena;
+
+// Scope inside a frame, for scratch that is dead before the frame ends.
+typedef struct {
+    size_t used;
+    size_t frame_bytes;
+    int overflow_count;
+    size_t overflow_used;
+} ArenaMark;
+
+static FrameArena g_frame_arenas[FRAME_ARENA_COUNT] = {
+    { .name = "render arena" },
+    { .name = "I/O arena" },
+};
+
+// Returns NULL, after reporting, when the arena cannot grow.
+static void* arena_try_alloc(FrameArena* a, size_t bytes) {
+    bytes = round_up_size(bytes > 0 ? bytes : 1, ARENA_ALIGN);
+    a->frame_bytes += bytes;
+    if (a->frame_bytes > a->high_water) a->high_water = a->frame_bytes;
+    if (a->overflow_count == 0 && a->used + bytes <= a->capacity) {
+        void* p = a->base + a->used;
+        a->used += bytes;
+        return p;
+    }
+
+    ArenaOverflow* o = (a->overflow_count > 0) ? &a->overflow[a->overflow_count - 1] : NULL;
+    if (!o || o->used + bytes > o->size) {
+        if (a->overflow_count == ARENA_MAX_OVERFLOW) {
+            fprintf(stderr, "%s: more than %d overflow blocks in one frame\n", a->name, ARENA_MAX_OVERFLOW);
+            a->frame_bytes -= bytes;
+            return NULL;
+        }
+        // Blocks at least double the frame's total so far, so a cold frame
+        // needs only a handful of them.
+        o = &a->overflow[a->overflow_count];
+        o->size = (a->frame_bytes > ARENA_MIN_OVERFLOW) ? a->frame_bytes : ARENA_MIN_OVERFLOW;
+        if (o->size < bytes) o->size = bytes;
+        o->raw = malloc(o->size + ARENA_ALIGN);
+        if (!o->raw) {
+            fprintf(stderr, "%s: out of memory (%zu bytes)\n", a->name, o->size);
+            a->frame_bytes -= bytes;
+            return NULL;
+        }
+        count_system_alloc();
+        o->ptr = (uint8_t*) round_up_size((size_t) (uintptr_t) o->raw, ARENA_ALIGN);
+        o->used = 0;
+        a->overflow_count += 1;
+    }
+    void* p = o->ptr + o->used;
+    o->used += bytes;
+    return p;
+}
+
+// For scratch the caller cannot do without.
+static void* arena_alloc(FrameArena* a, size_t bytes) {
+    void* p = arena_try_alloc(a, bytes);
+    if (!p) exit(1);
+    return p;
+}
+
+static inline ArenaMark arena_mark(const FrameArena* a) {
+    const ArenaMark m = { a->used, a->frame_bytes, a->overflow_count,
+                          (a->overflow_count > 0) ? a->overflow[a->overflow_count - 1].used : 0 };
+    return m;
+}
+
+// Drop everything allocated since `m`.
+static void arena_release(FrameArena* a, ArenaMark m) {
+    while (a->overflow_count > m.overflow_count) {
+        free(a->overflow[--a->overflow_count].raw);
+    }
+    if (a->overflow_count > 0) a->overflow[a->overflow_count - 1].used = m.overflow_used;
+    a->used = m.used;
+    a->frame_bytes = m.frame_bytes;
+}
+
+// Start a new frame; regrow to the high-water mark if a frame spilled. Spills
+// inside a released scope are gone by now, so the high-water mark decides.
+static void arena_reset(FrameArena* a) {
+    while (a->overflow_count > 0) {
+        free(a->overflow[--a->overflow_count].raw);
+    }
+    if (a->high_water > a->capacity) {
+        // Map the new block before dropping the old one, so a failed regrow
+        // keeps the current capacity and only costs spills next frame.
+        const size_t want = round_up_size(a->high_water + a->high_water / 4, ARENA_GRANULE);
+        uint8_t* grown = (uint8_t*) big_alloc(a->name, want);
+        if (grown) {
+            big_free(a->base);
+            a->base = grown;
+            a->capacity = want;
+            a->regrows += 1;
+        } else {
+            // Reported once; a persistent failure would repeat every frame.
+            if (a->regrow_failures == 0) {
+                fprintf(stderr, "%s: cannot grow to %zu bytes, keeping %zu and spilling\n", a->name, want, a->capacity);
+            }
+            a->regrow_failures += 1;
+        }
+    }
+    a->used = 0;
+    a->frame_bytes = 0;
+}
+
 // Convert 3D voxel coords to linear index.
 // Can be optimized by using z-order curve algorithm
 static inline int voxel_index(int x, int y, int z) {
     return x + y * GRID_X + z * GRID_X * GRID_Y;
 }
 
+static inline int brick_index(int bx, int by, int bz) {
+    return bx + by * BRICKS_X + bz * BRICKS_X * BRICKS_Y;
+}
+
 static inline bool inside_grid(int x, int y, int z) {
     return x >= 0 && x < GRID_X && y >= 0 && y < GRID_Y && z >= 0 && z < GRID_Z;
 }
@@ -109,13 +1025,184 @@ static inline void set_voxel(int x, int y, int z, uint8_t value) {
     }
 }
 
+static inline int box_volume(const VoxelBox* b) {
+    return (b->hi.x - b->lo.x + 1) * (b->hi.y - b->lo.y + 1) * (b->hi.z - b->lo.z + 1);
+}
+
+static inline VoxelBox box_union(const VoxelBox* a, const VoxelBox* b) {
+    VoxelBox out = {
+        { a->lo.x < b->lo.x ? a->lo.x : b->lo.x, a->lo.y < b->lo.y ? a->lo.y : b->lo.y, a->lo.z < b->lo.z ? a->lo.z : b->lo.z },
+        { a->hi.x > b->hi.x ? a->hi.x : b->hi.x, a->hi.y > b->hi.y ? a->hi.y : b->hi.y, a->hi.z > b->hi.z ? a->hi.z : b->hi.z },
+    };
+    return out;
+}
+
+// Clip box to grid bounds. Returns false when nothing is left.
+static bool clip_box_to_grid(VoxelBox* b) {
+    b->lo.x = clamp_i32(b->lo.x, 0, GRID_X - 1);
+    b->lo.y = clamp_i32(b->lo.y, 0, GRID_Y - 1);
+    b->lo.z = clamp_i32(b->lo.z, 0, GRID_Z - 1);
+    b->hi.x = clamp_i32(b->hi.x, -1, GRID_X - 1);
+    b->hi.y = clamp_i32(b->hi.y, -1, GRID_Y - 1);
+    b->hi.z = clamp_i32(b->hi.z, -1, GRID_Z - 1);
+    return b->lo.x <= b->hi.x && b->lo.y <= b->hi.y && b->lo.z <= b->hi.z;
+}
+
+// Queue a changed region for derived-structure and screen updates.
+// Overlapping boxes are merged when the union costs no extra volume;
+// when the list is full the cheapest union is taken instead.
+static void mark_dirty(VoxelBox box) {
+    for (int i = 0; i < g_state.dirty_count; i++) {
+        const VoxelBox u = box_union(&g_state.dirty_regions[i], &box);
+        if (box_volume(&u) <= box_volume(&g_state.dirty_regions[i]) + box_volume(&box)) {
+            g_state.dirty_regions[i] = u;
+            return;
+        }
+    }
+    if (g_state.dirty_count < MAX_DIRTY_REGIONS) {
+        g_state.dirty_regions[g_state.dirty_count++] = box;
+        return;
+    }
+
+    int best = 0;
+    int best_growth = 0x7fffffff;
+    for (int i = 0; i < g_state.dirty_count; i++) {
+        const VoxelBox u = box_union(&g_state.dirty_regions[i], &box);
+        const int growth = box_volume(&u) - box_volume(&g_state.dirty_regions[i]);
+        if (growth < best_growth) {
+            best_growth = growth;
+            best = i;
+        }
+    }
+    g_state.dirty_regions[best] = box_union(&g_state.dirty_regions[best], &box);
+}
+
+// Bounds of voxels actually changed by one edit call.
+typedef struct {
+    VoxelBox box;
+    int count;
+} EditTouch;
+
+static inline void edit_write(EditTouch* touch, int x, int y, int z, uint8_t value) {
+    uint8_t* v = &g_state.voxels[voxel_index(x, y, z)];
+    if (*v == value) {
+        return;
+    }
+    *v = value;
+
+    const VoxelBox cell = { { x, y, z }, { x, y, z } };
+    touch->box = (touch->count == 0) ? cell : box_union(&touch->box, &cell);
+    touch->count += 1;
+}
+
+static void edit_commit(const EditTouch* touch) {
+    if (touch->count > 0) {
+        g_state.edited_voxels += touch->count;
+        mark_dirty(touch->box);
+    }
+}
+
+// Batched edit API. Writes go straight into the voxel store; derived data
+// and the screen catch up on the next flush_voxel_edits().
+
+// Fill inclusive box [lo, hi] with `value`.
+static void edit_set_box(IVec3 lo, IVec3 hi, uint8_t value) {
+    VoxelBox box = { lo, hi };
+    if (!clip_box_to_grid(&box)) return;
+
+    EditTouch touch = { 0 };
+    for (int z = box.lo.z; z <= box.hi.z; z++) {
+        for (int y = box.lo.y; y <= box.hi.y; y++) {
+            for (int x = box.lo.x; x <= box.hi.x; x++) {
+                edit_write(&touch, x, y, z, value);
+            }
+        }
+    }
+    edit_commit(&touch);
+}
+
+// Fill every voxel whose center lies within `radius` of `center`.
+static void edit_set_sphere(Vector3 center, float radius, uint8_t value) {
+    VoxelBox box = {
+        { (int) floorf(center.x - radius), (int) floorf(center.y - radius), (int) floorf(center.z - radius) },
+        { (int) floorf(center.x + radius), (int) floorf(center.y + radius), (int) floorf(center.z + radius) },
+    };
+    if (!clip_box_to_grid(&box)) return;
+
+    const float r2 = radius * radius;
+    EditTouch touch = { 0 };
+    for (int z = box.lo.z; z <= box.hi.z; z++) {
+        for (int y = box.lo.y; y <= box.hi.y; y++) {
+            for (int x = box.lo.x; x <= box.hi.x; x++) {
+                const float dx = (float) x + 0.5f - center.x;
+                const float dy = (float) y + 0.5f - center.y;
+                const float dz = (float) z + 0.5f - center.z;
+                if (dx * dx + dy * dy + dz * dz <= r2) {
+                    edit_write(&touch, x, y, z, value);
+                }
+            }
+        }
+    }
+    edit_commit(&touch);
+}
+
+// Copy inclusive box [src_lo, src_hi] so that src_lo lands on dst_lo.
+// Overlapping source/destination behave like memmove.
+static void edit_copy_region(IVec3 src_lo, IVec3 src_hi, IVec3 dst_lo) {
+    const IVec3 off = { dst_lo.x - src_lo.x, dst_lo.y - src_lo.y, dst_lo.z - src_lo.z };
+
+    // Clip the source, then the destination, keeping both in lockstep.
+    VoxelBox src = { src_lo, src_hi };
+    if (!clip_box_to_grid(&src)) return;
+    VoxelBox dst = {
+        { src.lo.x + off.x, src.lo.y + off.y, src.lo.z + off.z },
+        { src.hi.x + off.x, src.hi.y + off.y, src.hi.z + off.z },
+    };
+    if (!clip_box_to_grid(&dst)) return;
+    src = (VoxelBox){
+        { dst.lo.x - off.x, dst.lo.y - off.y, dst.lo.z - off.z },
+        { dst.hi.x - off.x, dst.hi.y - off.y, dst.hi.z - off.z },
+    };
+
+    // Walk backwards through memory when the destination lies ahead of the source.
+    const bool backwards = voxel_index(off.x, off.y, off.z) > 0;
+    const int nx = src.hi.x - src.lo.x + 1;
+    const int ny = src.hi.y - src.lo.y + 1;
+    const int nz = src.hi.z - src.lo.z + 1;
+
+    EditTouch touch = { 0 };
+    for (int k = 0; k < nz; k++) {
+        const int z = backwards ? src.hi.z - k : src.lo.z + k;
+        for (int j = 0; j < ny; j++) {
+            const int y = backwards ? src.hi.y - j : src.lo.y + j;
+            for (int i = 0; i < nx; i++) {
+                const int x = backwards ? src.hi.x - i : src.lo.x + i;
+                const uint8_t id = g_state.voxels[voxel_index(x, y, z)];
+                edit_write(&touch, x + off.x, y + off.y, z + off.z, id);
+            }
+        }
+    }
+    edit_commit(&touch);
+}
+
+// Record a line-of-sight target half a voxel above the top of `column`.
+static void los_target_add(const VoxelBox* column) {
+    if (g_state.los_target_count >= LOS_TARGET_MAX || column->hi.x >= GRID_X || column->hi.z >= GRID_Z) return;
+    g_state.los_targets[g_state.los_target_count++] = (Vector3){
+        0.5f * (float) (column->lo.x + column->hi.x + 1),
+        (float) clamp_i32(column->hi.y, 0, GRID_Y - 1) + 1.5f,
+        0.5f * (float) (column->lo.z + column->hi.z + 1),
+    };
+}
+
 // Build tutorial scene:
 // - ground plane
 // - red column
 // - green wall
 // - blue column
 static void build_scene(void) {
-    memset(g_state.voxels, 0, sizeof(g_state.voxels));
+    memset(g_state.voxels, 0, GRID_SIZE);
+    g_state.los_target_count = 0;
 
     for (int z = 0; z < GRID_Z; z++) {
         for (int x = 0; x < GRID_X; x++) {
@@ -129,16 +1216,60 @@ static void build_scene(void) {
         set_voxel(8, y, 9, 2);
         set_voxel(9, y, 9, 2);
     }
+    los_target_add(&(VoxelBox){ { 8, 1, 8 }, { 9, 5, 9 } });
 
     for (int y = 1; y <= 3; y++) {
         for (int x = 14; x <= 18; x++) {
             set_voxel(x, y, 14, 3);
         }
     }
+    los_target_add(&(VoxelBox){ { 14, 1, 14 }, { 18, 3, 14 } });
 
     for (int y = 1; y <= 7; y++) {
         set_voxel(17, y, 6, 4);
     }
+    los_target_add(&(VoxelBox){ { 17, 1, 6 }, { 17, 7, 6 } });
+
+    // Whole grid changed: derived data and the screen rebuild on next flush.
+    g_state.edit_demo_has_blob = false;
+    g_state.dirty_count = 0;
+    mark_dirty((VoxelBox){ { 0, 0, 0 }, { GRID_X - 1, GRID_Y - 1, GRID_Z - 1 } });
+}
+
+static inline uint32_t rng_next(void) {
+    uint32_t x = g_state.rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    g_state.rng_state = x;
+    return x;
+}
+
+// Live-edit demo: a blob bouncing through the empty space above the scene,
+// erased and redrawn every frame, plus a layer of random boxes that scrolls
+// one voxel along +X per frame.
+static void run_edit_demo(float time_s) {
+    const float radius = 2.5f;
+    const Vector3 center = {
+        (float) GRID_X * 0.5f + sinf(time_s * 1.3f) * ((float) GRID_X * 0.5f - radius),
+        (float) GRID_Y - radius - 0.5f,
+        (float) GRID_Z * 0.5f + cosf(time_s * 0.9f) * ((float) GRID_Z * 0.5f - radius),
+    };
+
+    if (g_state.edit_demo_has_blob) {
+        edit_set_sphere(g_state.edit_demo_center, radius, 0);
+    }
+    edit_set_sphere(center, radius, 3);
+    g_state.edit_demo_center = center;
+    g_state.edit_demo_has_blob = true;
+
+    edit_copy_region((IVec3){ 0, GRID_Y - 8, 0 }, (IVec3){ GRID_X - 2, GRID_Y - 7, GRID_Z - 1 }, (IVec3){ 1, GRID_Y - 8, 0 });
+    edit_set_box((IVec3){ 0, GRID_Y - 8, 0 }, (IVec3){ 0, GRID_Y - 7, GRID_Z - 1 }, 0);
+
+    const uint32_t r = rng_next();
+    const IVec3 lo = { 0, GRID_Y - 8, (int) ((r >> 8) % (GRID_Z - 2)) };
+    const IVec3 hi = { lo.x, lo.y + 1, lo.z + 1 };
+    edit_set_box(lo, hi, ((r >> 16) & 1) ? 2 : 0);
 }
 
 static Vector3 sample_voxel_color(uint8_t id) {
@@ -151,31 +1282,116 @@ static Vector3 sample_voxel_color(uint8_t id) {
     }
 }
 
-// Clip [tmin, tmax] interval against one axis-aligned slab.
-// For nearly parallel rays, hit requires origin to be already inside slab.
-static bool axis_slab(float orig, float dir, float mn, float mx, float* tmin, float* tmax) {
-    if (fabsf(dir) < 1e-6f) {
-        return !(orig < mn || orig > mx);
+// Outward normal for a FaceQuad face index.
+static inline IVec3 face_normal(int face) {
+    IVec3 n = { 0, 0, 0 };
+    const int sign = (face & 1) ? 1 : -1;
+    switch (face >> 1) {
+        case 0: n.x = sign; break;
+        case 1: n.y = sign; break;
+        default: n.z = sign; break;
     }
+    return n;
+}
 
-    const float inv = 1.0f / dir;
-    float t_a = (mn - orig) * inv;
-    float t_b = (mx - orig) * inv;
-    if (t_a > t_b) {
-        const float tmp = t_a;
-        t_a = t_b;
-        t_b = tmp;
-    }
+static inline int normal_to_face(IVec3 n) {
+    if (n.x != 0) return (n.x > 0) ? 1 : 0;
+    if (n.y != 0) return (n.y > 0) ? 3 : 2;
+    return (n.z > 0) ? 5 : 4;
+}
 
-    *tmin = fmaxf(*tmin, t_a);
-    *tmax = fminf(*tmax, t_b);
-    return true;
+// Very simple lighting: lambert scaled by an ambient-occlusion factor and
+// by light visibility (1 = lit, 0 = in shadow).
+static Vector3 shade_voxel(uint8_t id, IVec3 normal, float ao, float light) {
+    const Vector3 base = sample_voxel_color(id);
+    const Vector3 n = { (float) normal.x, (float) normal.y, (float) normal.z };
+    const float ndotl = fmaxf(Vector3DotProduct(n, LIGHT_DIR), 0.0f);
+    return Vector3Scale(base, 0.2f + 0.8f * ndotl * ao * light);
 }
 
-// Ray vs grid AABB intersection.
-// Returns entry/exit parametric distance along the ray.
-static bool ray_aabb(Vector3 ro, Vector3 rd, float* out_t0, float* out_t1) {
-    float tmin = -1e30f;
+static inline float height_ao(int cell_y) {
+    return 0.7f + 0.3f * ((float) cell_y / (float) GRID_Y);
+}
+
+// Baked AO bytes of the voxel's 6 faces, NULL when its brick has no
+// exposed face.
+static inline uint8_t* face_ao_entry(int x, int y, int z) {
+    const uint32_t block = g_state.face_ao_brick[brick_index(x / BRICK_SIZE, y / BRICK_SIZE, z / BRICK_SIZE)];
+    if (block == 0) return NULL;
+    const int local = (x % BRICK_SIZE) + (y % BRICK_SIZE) * BRICK_SIZE + (z % BRICK_SIZE) * BRICK_SIZE * BRICK_SIZE;
+    return &g_state.face_ao[(size_t) (block - 1) * FACE_AO_BLOCK + (size_t) local * 6];
+}
+
+// Bilinear lookup of the baked corner AO at a hit point on a voxel face.
+// Hits on buried faces (LOD cells can land there) read as open.
+static float baked_ao(IVec3 cell, int face, Vector3 pos) {
+    const uint8_t* entry = face_ao_entry(cell.x, cell.y, cell.z);
+    if (!entry) return 1.0f;
+    const uint8_t packed = entry[face];
+    const int axis = face >> 1;
+    const int ua = (axis + 1) % 3;
+    const int va = (axis + 2) % 3;
+    const float p[3] = { pos.x, pos.y, pos.z };
+    const int c[3] = { cell.x, cell.y, cell.z };
+    const float fu = clamp_f32(p[ua] - (float) c[ua], 0.0f, 1.0f);
+    const float fv = clamp_f32(p[va] - (float) c[va], 0.0f, 1.0f);
+
+    const float a00 = (float) (packed & 3);
+    const float a10 = (float) ((packed >> 2) & 3);
+    const float a01 = (float) ((packed >> 4) & 3);
+    const float a11 = (float) ((packed >> 6) & 3);
+    const float v = ((a00 + (a10 - a00) * fu) * (1.0f - fv) + (a01 + (a11 - a01) * fu) * fv) * (1.0f / 3.0f);
+    return 0.55f + 0.45f * v;
+}
+
+// Ambient term for a primary hit. Traced AO is applied later by the
+// secondary passes, so that mode starts from the height term here.
+static inline float surface_ao(IVec3 cell, IVec3 normal, Vector3 pos) {
+    if (g_state.ao_mode == AO_BAKED) {
+        return baked_ao(cell, normal_to_face(normal), pos);
+    }
+    return height_ao(cell.y);
+}
+
+// Default shading for a primary hit, no shadows.
+static Vector3 shade_voxel_hit(uint8_t id, IVec3 normal, IVec3 cell, Vector3 pos) {
+    return shade_voxel(id, normal, surface_ao(cell, normal, pos), 1.0f);
+}
+
+// Background gradient; rays that crossed the grid get a slightly darker tint.
+static inline Vector3 sky_color(Vector3 rd, bool entered_grid) {
+    const float sky = clamp_f32(0.5f * (rd.y + 1.0f), 0.0f, 1.0f);
+    if (entered_grid) {
+        return (Vector3){ 0.5f + 0.3f * sky, 0.65f + 0.2f * sky, 0.95f };
+    }
+    return (Vector3){ 0.55f + 0.2f * sky, 0.7f + 0.15f * sky, 0.95f };
+}
+
+// Clip [tmin, tmax] interval against one axis-aligned slab.
+// For nearly parallel rays, hit requires origin to be already inside slab.
+static bool axis_slab(float orig, float dir, float mn, float mx, float* tmin, float* tmax) {
+    if (fabsf(dir) < 1e-6f) {
+        return !(orig < mn || orig > mx);
+    }
+
+    const float inv = 1.0f / dir;
+    float t_a = (mn - orig) * inv;
+    float t_b = (mx - orig) * inv;
+    if (t_a > t_b) {
+        const float tmp = t_a;
+        t_a = t_b;
+        t_b = tmp;
+    }
+
+    *tmin = fmaxf(*tmin, t_a);
+    *tmax = fminf(*tmax, t_b);
+    return true;
+}
+
+// Ray vs grid AABB intersection.
+// Returns entry/exit parametric distance along the ray.
+static bool ray_aabb(Vector3 ro, Vector3 rd, float* out_t0, float* out_t1) {
+    float tmin = -1e30f;
     float tmax = 1e30f;
 
     if (!axis_slab(ro.x, rd.x, 0.0f, (float) GRID_X, &tmin, &tmax)) return false;
@@ -189,23 +1405,27 @@ static bool ray_aabb(Vector3 ro, Vector3 rd, float* out_t0, float* out_t1) {
 }
 
 // Core algorithm: Amanatides-Woo 3D DDA traversal.
-static TraceResult trace_ray_amanatides_woo(Vector3 ro, Vector3 rd) {
+// `inv_rd` and `sign` (bit 0/1/2 set for negative x/y/z) come from the ray
+// setup, e.g. the cached primary ray table. `t_min` lets callers skip space
+// already proven empty (beam prepass); pass 0 to start at the grid entry.
+static TraceResult trace_ray_dda(Vector3 ro, Vector3 rd, Vector3 inv_rd, int sign, float t_min) {
     float t_enter = 0.0f;
     float t_exit = 0.0f;
     // Step 1: clip ray to the voxel grid bounds.
     if (!ray_aabb(ro, rd, &t_enter, &t_exit)) {
-        const float sky = clamp_f32(0.5f * (rd.y + 1.0f), 0.0f, 1.0f);
         TraceResult out = {
             .hit = false,
             .entered_grid = false,
             .steps = 0,
-            .col = (Vector3){ 0.55f + 0.2f * sky, 0.7f + 0.15f * sky, 0.95f },
+            .col = sky_color(rd, false),
         };
         return out;
     }
 
-    // Step 2: start at entry point (or origin if already inside bounds).
-    float t = fmaxf(t_enter, 0.0f);
+    // Step 2: start at entry point (or origin if already inside bounds),
+    // or further along when the caller knows the space before is empty.
+    const float t_entry = fmaxf(t_enter, 0.0f);
+    float t = fmaxf(t_entry, t_min);
     const Vector3 p = Vector3Add(ro, Vector3Scale(rd, t));
 
     // Step 3: map start point to initial voxel cell.
@@ -213,11 +1433,21 @@ static TraceResult trace_ray_amanatides_woo(Vector3 ro, Vector3 rd) {
     int cell_y = clamp_i32((int) floorf(p.y), 0, GRID_Y - 1);
     int cell_z = clamp_i32((int) floorf(p.z), 0, GRID_Z - 1);
 
+    // Cells between entry and start are exactly the DDA steps skipped:
+    // each step moves one cell along one axis, monotonically. A start past
+    // the exit skips the whole walk, including the last cell.
+    int steps_skipped = 0;
+    if (t > t_entry) {
+        const Vector3 pe = Vector3Add(ro, Vector3Scale(rd, t_entry));
+        const Vector3 ps = (t <= t_exit) ? p : Vector3Add(ro, Vector3Scale(rd, t_exit));
+        steps_skipped = abs(clamp_i32((int) floorf(ps.x), 0, GRID_X - 1) - clamp_i32((int) floorf(pe.x), 0, GRID_X - 1))
+                      + abs(clamp_i32((int) floorf(ps.y), 0, GRID_Y - 1) - clamp_i32((int) floorf(pe.y), 0, GRID_Y - 1))
+                      + abs(clamp_i32((int) floorf(ps.z), 0, GRID_Z - 1) - clamp_i32((int) floorf(pe.z), 0, GRID_Z - 1))
+                      + ((t > t_exit) ? 1 : 0);
+    }
+
     // Step 4: determine travel direction (+1 or -1) per axis.
-    IVec3 step = { -1, -1, -1 };
-    if (rd.x > 0.0f) step.x = 1;
-    if (rd.y > 0.0f) step.y = 1;
-    if (rd.z > 0.0f) step.z = 1;
+    const IVec3 step = { (sign & 1) ? -1 : 1, (sign & 2) ? -1 : 1, (sign & 4) ? -1 : 1 };
 
     // First boundary crossing candidate on each axis.
     const Vector3 next_boundary = {
@@ -237,23 +1467,24 @@ static TraceResult trace_ray_amanatides_woo(Vector3 ro, Vector3 rd) {
     // t_max_*: next crossing along that axis.
     // t_delta_*: crossing distance increment per voxel step on that axis.
     if (fabsf(rd.x) > 1e-6f) {
-        t_max_x = t + (next_boundary.x - p.x) / rd.x;
-        t_delta_x = fabsf(1.0f / rd.x);
+        t_max_x = t + (next_boundary.x - p.x) * inv_rd.x;
+        t_delta_x = fabsf(inv_rd.x);
     }
     if (fabsf(rd.y) > 1e-6f) {
-        t_max_y = t + (next_boundary.y - p.y) / rd.y;
-        t_delta_y = fabsf(1.0f / rd.y);
+        t_max_y = t + (next_boundary.y - p.y) * inv_rd.y;
+        t_delta_y = fabsf(inv_rd.y);
     }
     if (fabsf(rd.z) > 1e-6f) {
-        t_max_z = t + (next_boundary.z - p.z) / rd.z;
-        t_delta_z = fabsf(1.0f / rd.z);
+        t_max_z = t + (next_boundary.z - p.z) * inv_rd.z;
+        t_delta_z = fabsf(inv_rd.z);
     }
 
     IVec3 normal = { 0, 1, 0 };
     int steps = 0;
+    const uint8_t* voxels = read_voxels();
 
     // Core DDA loop: walk voxel-by-voxel along the ray.
-    for (int i = 0; i < 256; i++) {
+    for (int i = 0; i < MAX_DDA_STEPS; i++) {
         // Terminate when outside clipped segment or outside grid.
         if (!inside_grid(cell_x, cell_y, cell_z) || (t > t_exit)) {
             break;
@@ -261,18 +1492,18 @@ static TraceResult trace_ray_amanatides_woo(Vector3 ro, Vector3 rd) {
         steps += 1;
 
         // Hit test current voxel.
-        const uint8_t id = g_state.voxels[voxel_index(cell_x, cell_y, cell_z)];
+        const uint8_t id = voxels[voxel_index(cell_x, cell_y, cell_z)];
         if (id != 0) {
-            // Very simple lighting: lambert + height-based ambient term.
-            const Vector3 base = sample_voxel_color(id);
-            const Vector3 n = { (float) normal.x, (float) normal.y, (float) normal.z };
-            const float ndotl = fmaxf(Vector3DotProduct(n, LIGHT_DIR), 0.0f);
-            const float ao = 0.7f + 0.3f * ((float) cell_y / (float) GRID_Y);
             TraceResult out = {
                 .hit = true,
                 .entered_grid = true,
                 .steps = steps,
-                .col = Vector3Scale(base, 0.2f + 0.8f * ndotl * ao),
+                .steps_skipped = steps_skipped,
+                .col = shade_voxel_hit(id, normal, (IVec3){ cell_x, cell_y, cell_z }, Vector3Add(ro, Vector3Scale(rd, t))),
+                .t = t,
+                .cell = { cell_x, cell_y, cell_z },
+                .normal = normal,
+                .id = id,
             };
             return out;
         }
@@ -296,197 +1527,5201 @@ static TraceResult trace_ray_amanatides_woo(Vector3 ro, Vector3 rd) {
         }
     }
 
-    const float sky = clamp_f32(0.5f * (rd.y + 1.0f), 0.0f, 1.0f);
     TraceResult out = {
         .hit = false,
         .entered_grid = true,
         .steps = steps,
-        .col = (Vector3){ 0.5f + 0.3f * sky, 0.65f + 0.2f * sky, 0.95f },
+        .steps_skipped = steps_skipped,
+        .col = sky_color(rd, true),
     };
     return out;
 }
 
-// CPU renderer: one ray per output pixel.
-// This is the direct compute-shader candidate if moving traversal to GPU.
-static FrameStats render_voxel_image(float dt) {
-    FrameStats stats;
-    memset(&stats, 0, sizeof(stats));
-    stats.rays = IMG_W * IMG_H;
+// Camera at `pos` looking along `dir`, with the shared pinhole projection.
+static CameraRig camera_rig_look(Vector3 pos, Vector3 dir) {
+    // Build orthonormal camera basis.
+    CameraRig rig;
+    rig.pos = pos;
+    rig.forward = Vector3Normalize(dir);
+    rig.right = Vector3Normalize(Vector3CrossProduct(rig.forward, (Vector3){ 0.0f, 1.0f, 0.0f }));
+    rig.up = Vector3Normalize(Vector3CrossProduct(rig.right, rig.forward));
+
+    // Pinhole camera projection constants.
+    rig.aspect = (float) IMG_W / (float) IMG_H;
+    rig.fov_scale = tanf((55.0f * 0.5f) * (3.14159265358979323846f / 180.0f));
+    return rig;
+}
 
-    const Vector3 center = { (float) GRID_X * 0.5f, 3.0f, (float) GRID_Z * 0.5f };
-    const float orbit_t = g_state.time_s * 0.6f;
-    const float radius = 18.0f;
+// Orbit camera around scene center to make traversal behavior visible.
+static CameraRig camera_rig_for_time(float time_s, bool frozen) {
+    // Scaled with the grid: radius 18, heights 3 and 8.5 at 24x16x24.
+    const Vector3 center = { (float) GRID_X * 0.5f, (float) GRID_Y * 0.1875f, (float) GRID_Z * 0.5f };
+    const float orbit_t = time_s * 0.6f;
+    const float radius = 0.75f * (float) ((GRID_X > GRID_Z) ? GRID_X : GRID_Z);
+    const float height = (float) GRID_Y * 0.53125f;
 
-    // Orbit camera around scene center to make traversal behavior visible.
     Vector3 cam = (Vector3){
         center.x + cosf(orbit_t) * radius,
-        8.5f + sinf(orbit_t * 0.7f) * 1.5f,
+        height + sinf(orbit_t * 0.7f) * ((float) GRID_Y * 0.09375f),
         center.z + sinf(orbit_t) * radius
     };
-    if (g_state.freeze_camera) {
-        cam = (Vector3){ center.x + radius, 8.5f, center.z };
+    if (frozen) {
+        cam = (Vector3){ center.x + radius, height, center.z };
     }
+    return camera_rig_look(cam, Vector3Subtract(center, cam));
+}
 
-    // Build orthonormal camera basis.
-    const Vector3 forward = Vector3Normalize(Vector3Subtract(center, cam));
-    const Vector3 right = Vector3Normalize(Vector3CrossProduct(forward, (Vector3){ 0.0f, 1.0f, 0.0f }));
-    const Vector3 up = Vector3Normalize(Vector3CrossProduct(right, forward));
+// Sparse world: fly along +x over the generated terrain, weaving in z,
+// starting just before the dense grid. Coordinates grow without bound; the
+// chunk window follows the camera instead of the world being re-centered.
+static CameraRig camera_rig_roaming(float time_s, bool frozen) {
+    const float t = frozen ? 0.0f : time_s;
+    const Vector3 pos = {
+        -24.0f + 6.0f * t,
+        12.0f + 2.0f * sinf(t * 0.3f),
+        (float) GRID_Z * 0.5f + 12.0f * sinf(t * 0.1f)
+    };
+    return camera_rig_look(pos, (Vector3){ 1.0f, -0.3f, 0.2f * cosf(t * 0.1f) });
+}
 
-    // Pinhole camera projection constants.
-    const float aspect = (float) IMG_W / (float) IMG_H;
-    const float fov_scale = tanf((55.0f * 0.5f) * (3.14159265358979323846f / 180.0f));
-    const float inv_img_w = 1.0f / (float) IMG_W;
-    const float inv_img_h = 1.0f / (float) IMG_H;
-
-    // Incremental ray setup reduces math inside the inner x loop.
-    const float u_step = 2.0f * aspect * fov_scale * inv_img_w;
-    const float v_step = -2.0f * fov_scale * inv_img_h;
-    const float u_start = (-1.0f + inv_img_w) * aspect * fov_scale;
-    const float v_start = (1.0f - inv_img_h) * fov_scale;
-    const Vector3 ray_step_x = Vector3Scale(right, u_step);
-
-    // Main render loop: trace one ray per output pixel.
-    for (int y = 0; y < IMG_H; y++) {
-        const float v = v_start + (float) y * v_step;
-        const Vector3 row_base = Vector3Add(forward, Vector3Scale(up, v));
-        Vector3 ray = Vector3Add(row_base, Vector3Scale(right, u_start));
+static bool camera_rig_equal(const CameraRig* a, const CameraRig* b) {
+    return memcmp(a, b, sizeof(*a)) == 0;
+}
 
-        int pixel_index = y * IMG_W;
-        for (int x = 0; x < IMG_W; x++) {
-            const Vector3 dir = Vector3Normalize(ray);
-            const TraceResult tr = trace_ray_amanatides_woo(cam, dir);
-
-            if (tr.entered_grid) stats.rays_entered_grid += 1;
-            if (tr.hit) stats.hits += 1;
-            stats.total_steps += tr.steps;
-            if (tr.steps > stats.max_steps) stats.max_steps = tr.steps;
-
-            const int r = clamp_i32((int) (tr.col.x * 255.0f), 0, 255);
-            const int g = clamp_i32((int) (tr.col.y * 255.0f), 0, 255);
-            const int b = clamp_i32((int) (tr.col.z * 255.0f), 0, 255);
-            // Store shaded color in CPU image buffer.
-            g_state.pixels[pixel_index++] = (Color){
-                (unsigned char) r,
-                (unsigned char) g,
-                (unsigned char) b,
-                255
-            };
+// Project a world point to continuous pixel coordinates (pixel centers at
+// +0.5). False when the point is behind the camera.
+static bool project_to_pixel(const CameraRig* cam, Vector3 p, float* px, float* py) {
+    const Vector3 rel = Vector3Subtract(p, cam->pos);
+    const float depth = Vector3DotProduct(rel, cam->forward);
+    if (depth < 1e-3f) return false;
+    const float u = Vector3DotProduct(rel, cam->right) / (depth * cam->aspect * cam->fov_scale);
+    const float v = Vector3DotProduct(rel, cam->up) / (depth * cam->fov_scale);
+    *px = (u + 1.0f) * 0.5f * (float) IMG_W;
+    *py = (1.0f - v) * 0.5f * (float) IMG_H;
+    return true;
+}
 
-            ray = Vector3Add(ray, ray_step_x);
+// Mark the screen tiles covered by the projection of a voxel box.
+// Boxes reaching behind the camera invalidate the whole screen.
+static void invalidate_box_tiles(const CameraRig* cam, const VoxelBox* box) {
+    float px0 = 1e30f, py0 = 1e30f, px1 = -1e30f, py1 = -1e30f;
+    for (int c = 0; c < 8; c++) {
+        const Vector3 corner = {
+            (float) ((c & 1) ? box->hi.x + 1 : box->lo.x),
+            (float) ((c & 2) ? box->hi.y + 1 : box->lo.y),
+            (float) ((c & 4) ? box->hi.z + 1 : box->lo.z),
+        };
+        float px = 0.0f, py = 0.0f;
+        if (!project_to_pixel(cam, corner, &px, &py)) {
+            memset(g_state.tile_dirty, 1, sizeof(g_state.tile_dirty));
+            return;
         }
+        px0 = fminf(px0, px);
+        py0 = fminf(py0, py);
+        px1 = fmaxf(px1, px);
+        py1 = fmaxf(py1, py);
     }
 
-    if (stats.rays > 0) {
-        stats.avg_steps_per_ray = (float) stats.total_steps / (float) stats.rays;
-        stats.hit_ratio = (float) stats.hits / (float) stats.rays;
+    // One pixel of slack absorbs rounding along the silhouette.
+    const int tx0 = clamp_i32((int) floorf(px0 - 1.0f) / TILE_SIZE, 0, TILES_X - 1);
+    const int ty0 = clamp_i32((int) floorf(py0 - 1.0f) / TILE_SIZE, 0, TILES_Y - 1);
+    const int tx1 = clamp_i32((int) floorf(px1 + 1.0f) / TILE_SIZE, 0, TILES_X - 1);
+    const int ty1 = clamp_i32((int) floorf(py1 + 1.0f) / TILE_SIZE, 0, TILES_Y - 1);
+    if (px1 < 0.0f || py1 < 0.0f || px0 > (float) IMG_W || py0 > (float) IMG_H) {
+        return;
     }
-    if (dt > 1e-6f) {
-        stats.rays_per_sec = (float) stats.rays / dt;
-        stats.steps_per_sec = (float) stats.total_steps / dt;
+    for (int ty = ty0; ty <= ty1; ty++) {
+        for (int tx = tx0; tx <= tx1; tx++) {
+            g_state.tile_dirty[ty * TILES_X + tx] = 1;
+        }
     }
+}
 
-    return stats;
+// Any-hit occlusion traversal: true as soon as a solid voxel lies along the
+// ray within [0, t_max]. Same stepping as the walk above, but it tracks only
+// the linear cell index and returns on the first solid cell: no color,
+// normal or hit bookkeeping. Shadow rays, AO probes and line-of-sight
+// queries all go through here.
+static bool trace_any_hit(Vector3 ro, Vector3 rd, float t_max, int* steps) {
+    float t_enter = 0.0f;
+    float t_exit = 0.0f;
+    if (!ray_aabb(ro, rd, &t_enter, &t_exit)) return false;
+
+    const float t = fmaxf(t_enter, 0.0f);
+    const float t_end = fminf(t_exit, t_max);
+    if (t > t_end) return false;
+
+    const Vector3 p = Vector3Add(ro, Vector3Scale(rd, t));
+    int cx = clamp_i32((int) floorf(p.x), 0, GRID_X - 1);
+    int cy = clamp_i32((int) floorf(p.y), 0, GRID_Y - 1);
+    int cz = clamp_i32((int) floorf(p.z), 0, GRID_Z - 1);
+    int idx = voxel_index(cx, cy, cz);
+
+    const int sx = (rd.x > 0.0f) ? 1 : -1;
+    const int sy = (rd.y > 0.0f) ? 1 : -1;
+    const int sz = (rd.z > 0.0f) ? 1 : -1;
+
+    const float inf = 1e30f;
+    float t_max_x = inf, t_max_y = inf, t_max_z = inf;
+    float t_delta_x = inf, t_delta_y = inf, t_delta_z = inf;
+    if (fabsf(rd.x) > 1e-6f) {
+        t_max_x = t + ((float) (cx + (sx > 0)) - p.x) / rd.x;
+        t_delta_x = fabsf(1.0f / rd.x);
+    }
+    if (fabsf(rd.y) > 1e-6f) {
+        t_max_y = t + ((float) (cy + (sy > 0)) - p.y) / rd.y;
+        t_delta_y = fabsf(1.0f / rd.y);
+    }
+    if (fabsf(rd.z) > 1e-6f) {
+        t_max_z = t + ((float) (cz + (sz > 0)) - p.z) / rd.z;
+        t_delta_z = fabsf(1.0f / rd.z);
+    }
+
+    const uint8_t* voxels = read_voxels();
+    int n = 0;
+    for (;;) {
+        n += 1;
+        if (voxels[idx] != 0) {
+            *steps += n;
+            return true;
+        }
+
+        if ((t_max_x < t_max_y) && (t_max_x < t_max_z)) {
+            if (t_max_x > t_end) break;
+            cx += sx;
+            if (cx < 0 || cx >= GRID_X) break;
+            idx += sx;
+            t_max_x += t_delta_x;
+        } else if (t_max_y < t_max_z) {
+            if (t_max_y > t_end) break;
+            cy += sy;
+            if (cy < 0 || cy >= GRID_Y) break;
+            idx += sy * GRID_X;
+            t_max_y += t_delta_y;
+        } else {
+            if (t_max_z > t_end) break;
+            cz += sz;
+            if (cz < 0 || cz >= GRID_Z) break;
+            idx += sz * GRID_X * GRID_Y;
+            t_max_z += t_delta_z;
+        }
+    }
+    *steps += n;
+    return false;
 }
 
-static inline int ui_font_size(void) {
-    const int fs = (int) lroundf(18.0f * UI_FONT_SCALE);
-    return (fs > 8) ? fs : 8;
+// Line-of-sight query between two world-space points (gameplay/AI use).
+static bool voxel_line_of_sight(Vector3 from, Vector3 to) {
+    const Vector3 d = Vector3Subtract(to, from);
+    const float len = Vector3Length(d);
+    if (len < 1e-6f) return true;
+    int steps = 0;
+    return !trace_any_hit(from, Vector3Scale(d, 1.0f / len), len, &steps);
 }
 
-static inline int ui_line_height(void) {
-    return ui_font_size() + (int) lroundf(6.0f * UI_FONT_SCALE);
+// -----------------------------------------------------------------------------
+// Primary-visibility raster prepass
+// -----------------------------------------------------------------------------
+// Exposed voxel faces are greedy-meshed per (face direction, layer) and
+// rasterized into a tile-major visibility buffer (material, face, 1/depth).
+// Shading then reads the buffer instead of walking the grid.
+
+static inline bool voxel_solid_or_zero(int x, int y, int z) {
+    return inside_grid(x, y, z) && g_state.voxels[voxel_index(x, y, z)] != 0;
 }
 
-static bool ui_button(Rectangle rect, const char* label) {
-    const Vector2 m = GetMousePosition();
-    const bool hover = CheckCollisionPointRec(m, rect);
-    const bool pressed = hover && IsMouseButtonPressed(MOUSE_BUTTON_LEFT);
+// False when the slice cannot grow; the quad is not stored.
+static bool face_slice_push(FaceSlice* slice, FaceQuad q) {
+    if (slice->count == slice->capacity) {
+        const int cap = (slice->capacity > 0) ? slice->capacity * 2 : 16;
+        FaceQuad* grown = (FaceQuad*) realloc(slice->quads, (size_t) cap * sizeof(FaceQuad));
+        count_growth_alloc();
+        if (grown == NULL) {
+            return false;
+        }
+        slice->quads = grown;
+        slice->capacity = cap;
+    }
+    slice->quads[slice->count++] = q;
+    return true;
+}
 
-    const Color bg = hover ? (Color){ 100, 106, 118, 235 } : (Color){ 76, 80, 90, 235 };
-    DrawRectangleRec(rect, bg);
-    DrawRectangleLinesEx(rect, 1.0f, (Color){ 32, 34, 40, 255 });
+// Re-mesh one layer of one face direction with the classic greedy sweep:
+// grow each exposed face along u, then along v while the whole row matches.
+// Returns false when a quad could not be stored, leaving the slice partial.
+static bool mesh_face_slice(int face, int layer) {
+    FrameArena* arena = &g_frame_arenas[FRAME_ARENA_RENDER];
+    const ArenaMark scratch = arena_mark(arena);
+    uint8_t* mask = (uint8_t*) arena_alloc(arena, GRID_MAX_DIM * GRID_MAX_DIM);
 
-    const int fs = ui_font_size();
-    const int tw = MeasureText(label, fs);
-    DrawText(
-        label,
-        (int) (rect.x + (rect.width - (float) tw) * 0.5f),
-        (int) (rect.y + (rect.height - (float) fs) * 0.5f),
-        fs,
-        (Color){ 245, 245, 245, 255 }
-    );
+    const int axis = face >> 1;
+    const int ua = (axis + 1) % 3;
+    const int va = (axis + 2) % 3;
+    const int dims[3] = { GRID_X, GRID_Y, GRID_Z };
+    const int du = dims[ua];
+    const int dv = dims[va];
+    const int nstep = (face & 1) ? 1 : -1;
 
-    return pressed;
+    FaceSlice* slice = &g_state.face_slices[face][layer];
+    g_state.mesh_quads -= slice->count;
+    slice->count = 0;
+
+    bool complete = true;
+    int c[3];
+    c[axis] = layer;
+    for (int j = 0; j < dv; j++) {
+        c[va] = j;
+        for (int i = 0; i < du; i++) {
+            c[ua] = i;
+            const uint8_t id = g_state.voxels[voxel_index(c[0], c[1], c[2])];
+            uint8_t m = 0;
+            if (id != 0) {
+                int n[3] = { c[0], c[1], c[2] };
+                n[axis] += nstep;
+                if (!voxel_solid_or_zero(n[0], n[1], n[2])) {
+                    m = id;
+                }
+            }
+            mask[i + j * du] = m;
+        }
+    }
+
+    for (int j = 0; j < dv; j++) {
+        for (int i = 0; i < du;) {
+            const uint8_t m = mask[i + j * du];
+            if (m == 0) {
+                i++;
+                continue;
+            }
+
+            int w = 1;
+            while (i + w < du && mask[i + w + j * du] == m) w++;
+
+            int h = 1;
+            for (; j + h < dv; h++) {
+                bool row_ok = true;
+                for (int k = 0; k < w; k++) {
+                    if (mask[i + k + (j + h) * du] != m) {
+                        row_ok = false;
+                        break;
+                    }
+                }
+                if (!row_ok) break;
+            }
+
+            for (int hh = 0; hh < h; hh++) {
+                memset(&mask[i + (j + hh) * du], 0, (size_t) w);
+            }
+
+            const FaceQuad q = {
+                (uint16_t) i, (uint16_t) j, (uint16_t) (i + w), (uint16_t) (j + h),
+                (uint16_t) layer, (uint8_t) face, m,
+            };
+            complete = face_slice_push(slice, q) && complete;
+            i += w;
+        }
+    }
+    g_state.mesh_quads += slice->count;
+    arena_release(arena, scratch);
+    return complete;
 }
 
-// Runtime diagnostics and controls drawn over final image.
-static void draw_overlay(void) {
-    const int line_h = ui_line_height();
-    const int pad = (int) lroundf(10.0f * UI_FONT_SCALE);
-    const int x = 12;
-    const int y = 12;
-    const int w = (int) lroundf(560.0f * UI_FONT_SCALE);
+// Re-mesh every layer whose faces can change when voxels in `box` change:
+// the box itself plus one layer on each side along every axis. False when
+// any layer came out incomplete; the mesh then has holes and must not be
+// rasterized.
+static bool mesh_update_region(const VoxelBox* box) {
+    const int lo[3] = { box->lo.x, box->lo.y, box->lo.z };
+    const int hi[3] = { box->hi.x, box->hi.y, box->hi.z };
+    const int dims[3] = { GRID_X, GRID_Y, GRID_Z };
 
-    const int fs = ui_font_size();
-    const int button_h = fs + (int) lroundf(12.0f * UI_FONT_SCALE);
+    for (int face = 0; face < 6; face++) {
+        const int axis = face >> 1;
+        const int l0 = clamp_i32(lo[axis] - 1, 0, dims[axis] - 1);
+        const int l1 = clamp_i32(hi[axis] + 1, 0, dims[axis] - 1);
+        for (int layer = l0; layer <= l1; layer++) {
+            if (!mesh_face_slice(face, layer)) return false;
+        }
+    }
+    return true;
+}
 
-    int row = 0;
-    row += 11; // text rows
-    row += 1;  // button row
-    const int h = pad * 2 + row * line_h + button_h;
+static inline int vis_index(int x, int y) {
+    return ((y / TILE_SIZE) * TILES_X + x / TILE_SIZE) * TILE_PIXELS + (y % TILE_SIZE) * TILE_SIZE + (x % TILE_SIZE);
+}
 
-    DrawRectangle(x, y, w, h, (Color){ 28, 30, 36, 225 });
-    DrawRectangleLines(x, y, w, h, (Color){ 16, 18, 22, 255 });
+// Screen-space vertex: pixel coordinates plus 1/view-depth (affine in screen space).
+typedef struct {
+    float x;
+    float y;
+    float inv_z;
+} RasterVert;
 
-    int ty = y + pad;
-    const int tx = x + pad;
+// Edge function E(p) = a * x + b * y + c, non-negative on the inner side.
+typedef struct {
+    float a;
+    float b;
+    float c;
+} EdgeFn;
 
-    DrawText(TextFormat("Technique: Fast Voxel Traversal (3D DDA)"), tx, ty, fs, RAYWHITE); ty += line_h;
-    DrawText(TextFormat("Grid: %dx%dx%d voxels", GRID_X, GRID_Y, GRID_Z), tx, ty, fs, RAYWHITE); ty += line_h;
-    DrawText(TextFormat("Ray buffer: %dx%d (%d rays/frame)", IMG_W, IMG_H, g_state.frame_stats.rays), tx, ty, fs, RAYWHITE); ty += line_h;
-    DrawText(TextFormat("Camera: %s", g_state.freeze_camera ? "frozen" : "orbiting"), tx, ty, fs, RAYWHITE); ty += line_h;
-    DrawText(TextFormat("DDA: AABB entry -> tMax/tDelta stepping per axis"), tx, ty, fs, RAYWHITE); ty += line_h;
-    DrawText(TextFormat("Exit: first solid voxel, grid boundary, or 256 steps"), tx, ty, fs, RAYWHITE); ty += line_h;
-    DrawText(TextFormat("Frame: %.2f ms | FPS(avg): %.1f", g_state.frame_ms, g_state.fps_smooth), tx, ty, fs, RAYWHITE); ty += line_h;
-    DrawText(TextFormat("Rays/s: %.2f M | Steps/s: %.2f M", g_state.frame_stats.rays_per_sec / 1000000.0f, g_state.frame_stats.steps_per_sec / 1000000.0f), tx, ty, fs, RAYWHITE); ty += line_h;
-    DrawText(TextFormat("AABB entered: %d / %d", g_state.frame_stats.rays_entered_grid, g_state.frame_stats.rays), tx, ty, fs, RAYWHITE); ty += line_h;
-    DrawText(TextFormat("Hits: %d (%.1f%%)", g_state.frame_stats.hits, g_state.frame_stats.hit_ratio * 100.0f), tx, ty, fs, RAYWHITE); ty += line_h;
-    DrawText(TextFormat("Traversal steps: avg %.2f | max %d", g_state.frame_stats.avg_steps_per_ray, g_state.frame_stats.max_steps), tx, ty, fs, RAYWHITE); ty += line_h;
+static inline EdgeFn edge_fn(const RasterVert* v0, const RasterVert* v1) {
+    EdgeFn e;
+    e.a = -(v1->y - v0->y);
+    e.b = v1->x - v0->x;
+    e.c = -e.a * v0->x - e.b * v0->y;
+    return e;
+}
 
-    const float btn_y = (float) (ty + (int) lroundf(2.0f * UI_FONT_SCALE));
-    const float btn_w = (float) ((w - pad * 3) / 2);
-    const Rectangle btn_freeze = { (float) tx, btn_y, btn_w, (float) button_h };
-    const Rectangle btn_quit = { (float) tx + btn_w + (float) pad, btn_y, btn_w, (float) button_h };
+// Rasterize one triangle into the dirty tiles it overlaps. Tiles are rejected
+// or accepted whole from their corner samples; partial tiles test the three
+// edge functions four pixels at a time.
+static void raster_triangle(RasterVert a, RasterVert b, RasterVert c, uint8_t material, uint8_t face) {
+    float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+    if (fabsf(area) < 1e-8f) return;
+    if (area < 0.0f) {
+        const RasterVert tmp = b;
+        b = c;
+        c = tmp;
+        area = -area;
+    }
 
-    if (ui_button(btn_freeze, g_state.freeze_camera ? "Resume Camera" : "Freeze Camera")) {
-        g_state.freeze_camera = !g_state.freeze_camera;
+    const EdgeFn e0 = edge_fn(&b, &c);
+    const EdgeFn e1 = edge_fn(&c, &a);
+    const EdgeFn e2 = edge_fn(&a, &b);
+    const float inv_area = 1.0f / area;
+    const EdgeFn ez = {
+        (e0.a * a.inv_z + e1.a * b.inv_z + e2.a * c.inv_z) * inv_area,
+        (e0.b * a.inv_z + e1.b * b.inv_z + e2.b * c.inv_z) * inv_area,
+        (e0.c * a.inv_z + e1.c * b.inv_z + e2.c * c.inv_z) * inv_area,
+    };
+
+    // Inclusive edges with a small bias keep T-junctions between greedy quads crack-free.
+    const float bias = -1e-4f * area;
+
+    // Pixel centers sit at (x + 0.5, y + 0.5).
+    const float min_x = fminf(a.x, fminf(b.x, c.x));
+    const float max_x = fmaxf(a.x, fmaxf(b.x, c.x));
+    const float min_y = fminf(a.y, fminf(b.y, c.y));
+    const float max_y = fmaxf(a.y, fmaxf(b.y, c.y));
+    if (max_x < 0.0f || max_y < 0.0f || min_x > (float) IMG_W || min_y > (float) IMG_H) return;
+    const int px0 = clamp_i32((int) ceilf(min_x - 0.5f), 0, IMG_W - 1);
+    const int px1 = clamp_i32((int) floorf(max_x - 0.5f), 0, IMG_W - 1);
+    const int py0 = clamp_i32((int) ceilf(min_y - 0.5f), 0, IMG_H - 1);
+    const int py1 = clamp_i32((int) floorf(max_y - 0.5f), 0, IMG_H - 1);
+    if (px0 > px1 || py0 > py1) return;
+
+    for (int ty = py0 / TILE_SIZE; ty <= py1 / TILE_SIZE; ty++) {
+        for (int tx = px0 / TILE_SIZE; tx <= px1 / TILE_SIZE; tx++) {
+            const int tile = ty * TILES_X + tx;
+            if (!g_state.tile_dirty[tile]) continue;
+
+            // Corner pixel centers of the tile.
+            const float cx0 = (float) (tx * TILE_SIZE) + 0.5f;
+            const float cy0 = (float) (ty * TILE_SIZE) + 0.5f;
+            const float cx1 = cx0 + (float) (TILE_SIZE - 1);
+            const float cy1 = cy0 + (float) (TILE_SIZE - 1);
+
+            bool reject = false;
+            bool accept = true;
+            const EdgeFn* edges[3] = { &e0, &e1, &e2 };
+            for (int k = 0; k < 3; k++) {
+                const EdgeFn* e = edges[k];
+                const float v00 = e->a * cx0 + e->b * cy0 + e->c;
+                const float v10 = e->a * cx1 + e->b * cy0 + e->c;
+                const float v01 = e->a * cx0 + e->b * cy1 + e->c;
+                const float v11 = e->a * cx1 + e->b * cy1 + e->c;
+                const float vmax = fmaxf(fmaxf(v00, v10), fmaxf(v01, v11));
+                const float vmin = fminf(fminf(v00, v10), fminf(v01, v11));
+                if (vmax < bias) reject = true;
+                if (vmin < bias) accept = false;
+            }
+            if (reject) continue;
+
+            float* depth = &g_state.vis_inv_depth[tile * TILE_PIXELS];
+            uint8_t* mat = &g_state.vis_material[tile * TILE_PIXELS];
+            uint8_t* fc = &g_state.vis_face[tile * TILE_PIXELS];
+
+            const int row0 = (ty == py0 / TILE_SIZE) ? py0 % TILE_SIZE : 0;
+            const int row1 = (ty == py1 / TILE_SIZE) ? py1 % TILE_SIZE : TILE_SIZE - 1;
+            const int col0 = (tx == px0 / TILE_SIZE) ? px0 % TILE_SIZE : 0;
+            const int col1 = (tx == px1 / TILE_SIZE) ? px1 % TILE_SIZE : TILE_SIZE - 1;
+
+            for (int r = row0; r <= row1; r++) {
+                const float py = cy0 + (float) r;
+                float* drow = depth + r * TILE_SIZE;
+#if defined(VOXEL_HAVE_SSE2)
+                // Two 4-wide column groups cover the 8-pixel tile row.
+                const __m128 lane = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+                const __m128 vbias = _mm_set1_ps(bias);
+                for (int g = 0; g < TILE_SIZE; g += 4) {
+                    if (g + 3 < col0 || g > col1) continue;
+                    const __m128 px = _mm_add_ps(_mm_set1_ps(cx0 + (float) g), lane);
+                    const __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(ez.a), px), _mm_set1_ps(ez.b * py + ez.c));
+                    __m128 inside = _mm_cmpgt_ps(z, _mm_loadu_ps(drow + g));
+                    if (!accept) {
+                        const __m128 w0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(e0.a), px), _mm_set1_ps(e0.b * py + e0.c));
+                        const __m128 w1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(e1.a), px), _mm_set1_ps(e1.b * py + e1.c));
+                        const __m128 w2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(e2.a), px), _mm_set1_ps(e2.b * py + e2.c));
+                        inside = _mm_and_ps(inside, _mm_cmpge_ps(w0, vbias));
+                        inside = _mm_and_ps(inside, _mm_cmpge_ps(w1, vbias));
+                        inside = _mm_and_ps(inside, _mm_cmpge_ps(w2, vbias));
+                    }
+                    const __m128 span = _mm_castsi128_ps(_mm_set_epi32(
+                        (g + 3 >= col0 && g + 3 <= col1) ? -1 : 0,
+                        (g + 2 >= col0 && g + 2 <= col1) ? -1 : 0,
+                        (g + 1 >= col0 && g + 1 <= col1) ? -1 : 0,
+                        (g >= col0 && g <= col1) ? -1 : 0));
+                    inside = _mm_and_ps(inside, span);
+                    const int bits = _mm_movemask_ps(inside);
+                    if (bits == 0) continue;
+                    _mm_storeu_ps(drow + g, _mm_or_ps(_mm_and_ps(inside, z), _mm_andnot_ps(inside, _mm_loadu_ps(drow + g))));
+                    for (int k = 0; k < 4; k++) {
+                        if (bits & (1 << k)) {
+                            mat[r * TILE_SIZE + g + k] = material;
+                            fc[r * TILE_SIZE + g + k] = face;
+                        }
+                    }
+                }
+#else
+                for (int col = col0; col <= col1; col++) {
+                    const float px = cx0 + (float) col;
+                    const float z = ez.a * px + ez.b * py + ez.c;
+                    if (z <= drow[col]) continue;
+                    if (!accept) {
+                        if (e0.a * px + e0.b * py + e0.c < bias) continue;
+                        if (e1.a * px + e1.b * py + e1.c < bias) continue;
+                        if (e2.a * px + e2.b * py + e2.c < bias) continue;
+                    }
+                    drow[col] = z;
+                    mat[r * TILE_SIZE + col] = material;
+                    fc[r * TILE_SIZE + col] = face;
+                }
+#endif
+            }
+        }
     }
-    if (ui_button(btn_quit, "Quit")) {
-        g_state.request_quit = true;
+}
+
+// Clip a camera-space polygon against the near plane (Sutherland-Hodgman).
+static int clip_near(const Vector3* in, int n, Vector3* out, float near_z) {
+    int m = 0;
+    for (int i = 0; i < n; i++) {
+        const Vector3 a = in[i];
+        const Vector3 b = in[(i + 1) % n];
+        const bool a_in = a.z >= near_z;
+        const bool b_in = b.z >= near_z;
+        if (a_in) out[m++] = a;
+        if (a_in != b_in) {
+            const float t = (near_z - a.z) / (b.z - a.z);
+            out[m++] = Vector3Lerp(a, b, t);
+        }
     }
+    return m;
 }
 
-int main(void) {
-    // 1) Initialize window and target framerate.
-    InitWindow(1280, 720, "C + raylib + Amanatides-Woo");
-    SetTargetFPS(60);
+// Rasterize all camera-facing quads into the dirty tiles of the visibility buffer.
+static void raster_prepass(const CameraRig* cam, FrameStats* stats) {
+    for (int tile = 0; tile < TILE_COUNT; tile++) {
+        if (!g_state.tile_dirty[tile]) continue;
+        memset(&g_state.vis_inv_depth[tile * TILE_PIXELS], 0, TILE_PIXELS * sizeof(float));
+        memset(&g_state.vis_material[tile * TILE_PIXELS], 0, TILE_PIXELS);
+    }
 
-    // 2) Build scene and initialize CPU/GPU image resources.
-    build_scene();
-    memset(g_state.pixels, 0, sizeof(g_state.pixels));
+    const float cam_p[3] = { cam->pos.x, cam->pos.y, cam->pos.z };
+    const int dims[3] = { GRID_X, GRID_Y, GRID_Z };
+    const float sx = 0.5f * (float) IMG_W / (cam->aspect * cam->fov_scale);
+    const float sy = 0.5f * (float) IMG_H / cam->fov_scale;
 
-    Image img = GenImageColor(IMG_W, IMG_H, BLACK);
-    g_state.ray_texture = LoadTextureFromImage(img);
-    UnloadImage(img);
-    SetTextureFilter(g_state.ray_texture, TEXTURE_FILTER_POINT);
+    for (int face = 0; face < 6; face++) {
+        const int axis = face >> 1;
+        const int ua = (axis + 1) % 3;
+        const int va = (axis + 2) % 3;
+        const bool positive = (face & 1) != 0;
 
-    // 3) Standard raylib frame loop.
-    while (!WindowShouldClose() && !g_state.request_quit) {
-        const float dt = clamp_f32(GetFrameTime(), 1e-5f, 0.25f);
+        for (int layer = 0; layer < dims[axis]; layer++) {
+            // Back-face cull the whole layer: the camera must be on the normal side.
+            const float plane = (float) layer + (positive ? 1.0f : 0.0f);
+            if (positive ? (cam_p[axis] <= plane) : (cam_p[axis] >= plane)) continue;
 
-        // Update camera timer (unless frozen from UI).
-        if (!g_state.freeze_camera) {
-            g_state.time_s += dt;
+            const FaceSlice* slice = &g_state.face_slices[face][layer];
+            for (int qi = 0; qi < slice->count; qi++) {
+                const FaceQuad* q = &slice->quads[qi];
+                stats->raster_quads += 1;
+
+                Vector3 poly[4];
+                for (int k = 0; k < 4; k++) {
+                    float w[3];
+                    w[axis] = plane;
+                    w[ua] = (float) ((k == 1 || k == 2) ? q->u1 : q->u0);
+                    w[va] = (float) ((k >= 2) ? q->v1 : q->v0);
+                    const Vector3 rel = { w[0] - cam_p[0], w[1] - cam_p[1], w[2] - cam_p[2] };
+                    poly[k] = (Vector3){
+                        Vector3DotProduct(rel, cam->right),
+                        Vector3DotProduct(rel, cam->up),
+                        Vector3DotProduct(rel, cam->forward),
+                    };
+                }
+
+                Vector3 clipped[5];
+                const int n = clip_near(poly, 4, clipped, 1e-3f);
+                if (n < 3) continue;
+
+                RasterVert sv[5];
+                for (int k = 0; k < n; k++) {
+                    const float iz = 1.0f / clipped[k].z;
+                    sv[k].x = (float) IMG_W * 0.5f + clipped[k].x * iz * sx;
+                    sv[k].y = (float) IMG_H * 0.5f - clipped[k].y * iz * sy;
+                    sv[k].inv_z = iz;
+                }
+                for (int k = 1; k + 1 < n; k++) {
+                    raster_triangle(sv[0], sv[k], sv[k + 1], q->material, q->face);
+                    stats->raster_triangles += 1;
+                }
+            }
+        }
+    }
+}
+
+// Shade one pixel from the visibility buffer; no grid traversal involved.
+static TraceResult resolve_raster_pixel(const CameraRig* cam, Vector3 rd, int x, int y) {
+    const int idx = vis_index(x, y);
+    const uint8_t id = g_state.vis_material[idx];
+    if (id == 0) {
+        float t0 = 0.0f;
+        float t1 = 0.0f;
+        const bool entered = ray_aabb(cam->pos, rd, &t0, &t1);
+        TraceResult out = { .hit = false, .entered_grid = entered, .steps = 0, .col = sky_color(rd, entered) };
+        return out;
+    }
+
+    // Depth along the view axis -> distance along this ray -> hit cell.
+    const IVec3 normal = face_normal(g_state.vis_face[idx]);
+    const float t = 1.0f / (g_state.vis_inv_depth[idx] * Vector3DotProduct(rd, cam->forward));
+    const Vector3 hit = Vector3Add(cam->pos, Vector3Scale(rd, t));
+    const IVec3 cell = {
+        clamp_i32((int) floorf(hit.x - 0.5f * (float) normal.x), 0, GRID_X - 1),
+        clamp_i32((int) floorf(hit.y - 0.5f * (float) normal.y), 0, GRID_Y - 1),
+        clamp_i32((int) floorf(hit.z - 0.5f * (float) normal.z), 0, GRID_Z - 1),
+    };
+
+    TraceResult out = {
+        .hit = true,
+        .entered_grid = true,
+        .steps = 0,
+        .col = shade_voxel_hit(id, normal, cell, hit),
+        .t = t,
+        .cell = cell,
+        .normal = normal,
+        .id = id,
+    };
+    return out;
+}
+
+// -----------------------------------------------------------------------------
+// Beam prepass
+// -----------------------------------------------------------------------------
+// One cone per screen tile, bounding every primary ray of the tile, is
+// marched through the coarse brick occupancy. The first axial distance where
+// the cone may touch an occupied brick is a safe DDA start for all rays in
+// the tile: a ray's axial distance never exceeds its own t.
+
+// Recompute occupancy flags for every brick overlapping `box`.
+static void bricks_update_region(const VoxelBox* box) {
+    for (int bz = box->lo.z / BRICK_SIZE; bz <= box->hi.z / BRICK_SIZE; bz++) {
+        for (int by = box->lo.y / BRICK_SIZE; by <= box->hi.y / BRICK_SIZE; by++) {
+            for (int bx = box->lo.x / BRICK_SIZE; bx <= box->hi.x / BRICK_SIZE; bx++) {
+                uint8_t occupied = 0;
+                const int x1 = (bx + 1) * BRICK_SIZE < GRID_X ? (bx + 1) * BRICK_SIZE : GRID_X;
+                const int y1 = (by + 1) * BRICK_SIZE < GRID_Y ? (by + 1) * BRICK_SIZE : GRID_Y;
+                const int z1 = (bz + 1) * BRICK_SIZE < GRID_Z ? (bz + 1) * BRICK_SIZE : GRID_Z;
+                for (int z = bz * BRICK_SIZE; z < z1 && !occupied; z++) {
+                    for (int y = by * BRICK_SIZE; y < y1 && !occupied; y++) {
+                        for (int x = bx * BRICK_SIZE; x < x1; x++) {
+                            if (g_state.voxels[voxel_index(x, y, z)] != 0) {
+                                occupied = 1;
+                                break;
+                            }
+                        }
+                    }
+                }
+                g_state.brick_occupied[brick_index(bx, by, bz)] = occupied;
+            }
+        }
+    }
+}
+
+// True when any occupied brick overlaps the voxel-space box [lo, hi].
+static bool bricks_any_in_box(Vector3 lo, Vector3 hi) {
+    const int bx0 = clamp_i32((int) floorf(lo.x / (float) BRICK_SIZE), 0, BRICKS_X);
+    const int by0 = clamp_i32((int) floorf(lo.y / (float) BRICK_SIZE), 0, BRICKS_Y);
+    const int bz0 = clamp_i32((int) floorf(lo.z / (float) BRICK_SIZE), 0, BRICKS_Z);
+    const int bx1 = clamp_i32((int) floorf(hi.x / (float) BRICK_SIZE), -1, BRICKS_X - 1);
+    const int by1 = clamp_i32((int) floorf(hi.y / (float) BRICK_SIZE), -1, BRICKS_Y - 1);
+    const int bz1 = clamp_i32((int) floorf(hi.z / (float) BRICK_SIZE), -1, BRICKS_Z - 1);
+    const uint8_t* bricks = read_bricks();
+    for (int bz = bz0; bz <= bz1; bz++) {
+        for (int by = by0; by <= by1; by++) {
+            for (int bx = bx0; bx <= bx1; bx++) {
+                if (bricks[brick_index(bx, by, bz)]) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+// Camera-space ray direction (unnormalized) through the center of pixel (x, y).
+static inline Vector3 pixel_ray_dir(const CameraRig* cam, float x, float y) {
+    const float u = (-1.0f + (2.0f * x + 1.0f) / (float) IMG_W) * cam->aspect * cam->fov_scale;
+    const float v = (1.0f - (2.0f * y + 1.0f) / (float) IMG_H) * cam->fov_scale;
+    return Vector3Add(cam->forward, Vector3Add(Vector3Scale(cam->right, u), Vector3Scale(cam->up, v)));
+}
+
+// March one bounding cone for tile (tx, ty); returns the safe start distance.
+static float beam_trace_tile(const CameraRig* cam, int tx, int ty, float t_far, int* samples) {
+    const float x0 = (float) (tx * TILE_SIZE);
+    const float y0 = (float) (ty * TILE_SIZE);
+    const float x1 = (float) ((tx + 1) * TILE_SIZE < IMG_W ? (tx + 1) * TILE_SIZE - 1 : IMG_W - 1);
+    const float y1 = (float) ((ty + 1) * TILE_SIZE < IMG_H ? (ty + 1) * TILE_SIZE - 1 : IMG_H - 1);
+
+    Vector3 corners[4] = {
+        Vector3Normalize(pixel_ray_dir(cam, x0, y0)),
+        Vector3Normalize(pixel_ray_dir(cam, x1, y0)),
+        Vector3Normalize(pixel_ray_dir(cam, x0, y1)),
+        Vector3Normalize(pixel_ray_dir(cam, x1, y1)),
+    };
+    const Vector3 axis = Vector3Normalize(Vector3Add(Vector3Add(corners[0], corners[1]), Vector3Add(corners[2], corners[3])));
+    float cos_min = 1.0f;
+    for (int k = 0; k < 4; k++) {
+        cos_min = fminf(cos_min, Vector3DotProduct(axis, corners[k]));
+    }
+    // Small widening absorbs float error in the per-pixel ray setup.
+    const float tan_half = sqrtf(fmaxf(1.0f - cos_min * cos_min, 0.0f)) / cos_min + 1e-3f;
+
+    // Each sample covers the axial segment [t, t + step] with a bounding box.
+    const float step = (float) BRICK_SIZE * 0.5f;
+    const Vector3 grid_max = { (float) GRID_X, (float) GRID_Y, (float) GRID_Z };
+    for (float t = 0.0f; t < t_far; t += step) {
+        const float radius = 0.5f * step + (t + step) * tan_half;
+        const Vector3 c = Vector3Add(cam->pos, Vector3Scale(axis, t + 0.5f * step));
+        const Vector3 lo = { c.x - radius, c.y - radius, c.z - radius };
+        const Vector3 hi = { c.x + radius, c.y + radius, c.z + radius };
+        if (hi.x < 0.0f || hi.y < 0.0f || hi.z < 0.0f || lo.x > grid_max.x || lo.y > grid_max.y || lo.z > grid_max.z) {
+            continue;
+        }
+        *samples += 1;
+        if (bricks_any_in_box(lo, hi)) {
+            return t;
+        }
+    }
+    return t_far;
+}
+
+// Fill tile_t_start for every tile that is traced this frame.
+static void beam_prepass(const CameraRig* cam, FrameStats* stats) {
+    // Nothing in the grid lies further than its farthest corner.
+    float t_far = 0.0f;
+    for (int c = 0; c < 8; c++) {
+        const Vector3 corner = {
+            (c & 1) ? (float) GRID_X : 0.0f,
+            (c & 2) ? (float) GRID_Y : 0.0f,
+            (c & 4) ? (float) GRID_Z : 0.0f,
+        };
+        t_far = fmaxf(t_far, Vector3Distance(corner, cam->pos));
+    }
+
+    for (int ty = 0; ty < TILES_Y; ty++) {
+        for (int tx = 0; tx < TILES_X; tx++) {
+            const int tile = ty * TILES_X + tx;
+            if (g_state.tile_dirty[tile]) {
+                g_state.tile_t_start[tile] = beam_trace_tile(cam, tx, ty, t_far, &stats->beam_samples);
+            }
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+// LOD mip chain
+// -----------------------------------------------------------------------------
+// Level L stores one material per 2^L-voxel block: the most common non-empty
+// child material when at least half of the existing children are solid,
+// otherwise empty. Far rays switch to coarser levels once their pixel
+// footprint outgrows the cell, which bounds steps per ray on huge grids.
+
+static void lod_init_layout(void) {
+    int offset = 0;
+    for (int level = 0; level < LOD_LEVELS; level++) {
+        g_state.lod_dims[level][0] = (GRID_X + (1 << level) - 1) >> level;
+        g_state.lod_dims[level][1] = (GRID_Y + (1 << level) - 1) >> level;
+        g_state.lod_dims[level][2] = (GRID_Z + (1 << level) - 1) >> level;
+        g_state.lod_offset[level] = offset;
+        if (level > 0) {
+            offset += g_state.lod_dims[level][0] * g_state.lod_dims[level][1] * g_state.lod_dims[level][2];
+        }
+    }
+}
+
+static inline uint8_t lod_cell(int level, int x, int y, int z) {
+    if (level == 0) {
+        return read_voxels()[voxel_index(x, y, z)];
+    }
+    const int* d = g_state.lod_dims[level];
+    return read_lod_cells()[g_state.lod_offset[level] + x + y * d[0] + z * d[0] * d[1]];
+}
+
+// Rebuild the mip cells above `box`, one level at a time from the finer one.
+static void lod_update_region(const VoxelBox* box) {
+    for (int level = 1; level < LOD_LEVELS; level++) {
+        const int* d = g_state.lod_dims[level];
+        const int* fd = g_state.lod_dims[level - 1];
+        for (int z = box->lo.z >> level; z <= box->hi.z >> level; z++) {
+            for (int y = box->lo.y >> level; y <= box->hi.y >> level; y++) {
+                for (int x = box->lo.x >> level; x <= box->hi.x >> level; x++) {
+                    int counts[256];
+                    memset(counts, 0, sizeof(counts));
+                    int children = 0;
+                    int solid = 0;
+                    uint8_t best = 0;
+                    for (int c = 0; c < 8; c++) {
+                        const int cx = x * 2 + (c & 1);
+                        const int cy = y * 2 + ((c >> 1) & 1);
+                        const int cz = z * 2 + (c >> 2);
+                        if (cx >= fd[0] || cy >= fd[1] || cz >= fd[2]) continue;
+                        children += 1;
+                        const uint8_t id = lod_cell(level - 1, cx, cy, cz);
+                        if (id == 0) continue;
+                        solid += 1;
+                        counts[id] += 1;
+                        if (best == 0 || counts[id] > counts[best]) best = id;
+                    }
+                    g_state.lod_cells[g_state.lod_offset[level] + x + y * d[0] + z * d[0] * d[1]] = (solid * 2 >= children) ? best : 0;
+                }
+            }
+        }
+    }
+}
+
+// DDA that coarsens as it goes: whenever t * pixel_angle * lod_bias exceeds
+// the current cell size, the walk re-enters the grid one level up at the
+// current point. Levels only ever get coarser along a ray.
+static TraceResult trace_ray_lod(Vector3 ro, Vector3 rd, float t_min, float pixel_angle, int* level_out) {
+    float t_enter = 0.0f;
+    float t_exit = 0.0f;
+    *level_out = 0;
+    if (!ray_aabb(ro, rd, &t_enter, &t_exit)) {
+        TraceResult out = { .hit = false, .entered_grid = false, .steps = 0, .col = sky_color(rd, false) };
+        return out;
+    }
+
+    float t = fmaxf(fmaxf(t_enter, 0.0f), t_min);
+    const float footprint_scale = pixel_angle * g_state.lod_bias;
+    const float inf = 1e30f;
+    const IVec3 step = { (rd.x > 0.0f) ? 1 : -1, (rd.y > 0.0f) ? 1 : -1, (rd.z > 0.0f) ? 1 : -1 };
+    const float inv_x = (fabsf(rd.x) > 1e-6f) ? 1.0f / rd.x : 0.0f;
+    const float inv_y = (fabsf(rd.y) > 1e-6f) ? 1.0f / rd.y : 0.0f;
+    const float inv_z = (fabsf(rd.z) > 1e-6f) ? 1.0f / rd.z : 0.0f;
+
+    int level = -1;
+    int cell_x = 0, cell_y = 0, cell_z = 0;
+    float t_max_x = inf, t_max_y = inf, t_max_z = inf;
+    float t_delta_x = inf, t_delta_y = inf, t_delta_z = inf;
+    IVec3 normal = { 0, 1, 0 };
+    int steps = 0;
+
+    for (int i = 0; i < MAX_DDA_STEPS; i++) {
+        if (t > t_exit) break;
+
+        // (Re)enter at the level the current footprint asks for.
+        int want = level < 0 ? 0 : level;
+        while (want + 1 < LOD_LEVELS && t * footprint_scale > (float) (1 << want)) want++;
+        if (want != level) {
+            level = want;
+            const float size = (float) (1 << level);
+            const Vector3 p = Vector3Add(ro, Vector3Scale(rd, t));
+            const int* d = (level == 0) ? (const int[3]){ GRID_X, GRID_Y, GRID_Z } : g_state.lod_dims[level];
+            cell_x = clamp_i32((int) floorf(p.x / size), 0, d[0] - 1);
+            cell_y = clamp_i32((int) floorf(p.y / size), 0, d[1] - 1);
+            cell_z = clamp_i32((int) floorf(p.z / size), 0, d[2] - 1);
+            t_max_x = (inv_x != 0.0f) ? ((float) (cell_x + (step.x > 0)) * size - ro.x) * inv_x : inf;
+            t_max_y = (inv_y != 0.0f) ? ((float) (cell_y + (step.y > 0)) * size - ro.y) * inv_y : inf;
+            t_max_z = (inv_z != 0.0f) ? ((float) (cell_z + (step.z > 0)) * size - ro.z) * inv_z : inf;
+            t_delta_x = (inv_x != 0.0f) ? fabsf(size * inv_x) : inf;
+            t_delta_y = (inv_y != 0.0f) ? fabsf(size * inv_y) : inf;
+            t_delta_z = (inv_z != 0.0f) ? fabsf(size * inv_z) : inf;
+        }
+
+        const int* d = (level == 0) ? (const int[3]){ GRID_X, GRID_Y, GRID_Z } : g_state.lod_dims[level];
+        if (cell_x < 0 || cell_x >= d[0] || cell_y < 0 || cell_y >= d[1] || cell_z < 0 || cell_z >= d[2]) break;
+        steps += 1;
+
+        const uint8_t id = lod_cell(level, cell_x, cell_y, cell_z);
+        if (id != 0) {
+            const Vector3 hit = Vector3Add(ro, Vector3Scale(rd, t));
+            const IVec3 cell = {
+                clamp_i32((int) floorf(hit.x - 0.5f * (float) normal.x), 0, GRID_X - 1),
+                clamp_i32((int) floorf(hit.y - 0.5f * (float) normal.y), 0, GRID_Y - 1),
+                clamp_i32((int) floorf(hit.z - 0.5f * (float) normal.z), 0, GRID_Z - 1),
+            };
+            *level_out = level;
+            TraceResult out = {
+                .hit = true,
+                .entered_grid = true,
+                .steps = steps,
+                .col = shade_voxel_hit(id, normal, cell, hit),
+                .t = t,
+                .cell = cell,
+                .normal = normal,
+                .id = id,
+            };
+            return out;
+        }
+
+        if ((t_max_x < t_max_y) && (t_max_x < t_max_z)) {
+            cell_x += step.x;
+            t = t_max_x;
+            t_max_x += t_delta_x;
+            normal = (IVec3){ -step.x, 0, 0 };
+        } else if (t_max_y < t_max_z) {
+            cell_y += step.y;
+            t = t_max_y;
+            t_max_y += t_delta_y;
+            normal = (IVec3){ 0, -step.y, 0 };
+        } else {
+            cell_z += step.z;
+            t = t_max_z;
+            t_max_z += t_delta_z;
+            normal = (IVec3){ 0, 0, -step.z };
+        }
+    }
+
+    *level_out = (level < 0) ? 0 : level;
+    TraceResult out = { .hit = false, .entered_grid = true, .steps = steps, .col = sky_color(rd, true) };
+    return out;
+}
+
+// -----------------------------------------------------------------------------
+// Column-RLE store
+// -----------------------------------------------------------------------------
+// Terrain is mostly columns that are solid up to some height and air above,
+// so each (x, z) column is stored as (material, length) runs sorted by y.
+// Traversal walks the columns with a 2D DDA in x/z; inside a column it
+// clips the ray's y extent against whole runs instead of stepping cell by
+// cell, so vertical travel through long runs costs one step per run.
+// A build gives every column RLE_COLUMN_SLACK spare slots after its runs
+// and leaves a spare tail of a quarter to a half as many slots again. Edits
+// re-encode the touched columns in place; a column that outgrows its slots
+// moves to the tail, again with slack. Only when the tail is used up is the
+// store rebuilt, which packs it again.
+
+enum { RLE_COLUMN_SLACK = 2 };      // one carved gap splits a run into three
+
+static inline int rle_column(int x, int z) {
+    return x + z * GRID_X;
+}
+
+// Runs of one dense column, trailing air dropped; returns the run count.
+// `out` may be NULL to count only; otherwise the column top and run count
+// are stored too.
+static int rle_encode_column(int x, int z, ColumnRun* out) {
+    int runs = 0;
+    int top = GRID_Y;
+    while (top > 0 && g_state.voxels[voxel_index(x, top - 1, z)] == 0) top -= 1;
+    for (int y = 0; y < top;) {
+        const uint8_t m = g_state.voxels[voxel_index(x, y, z)];
+        int len = 1;
+        while (y + len < top && g_state.voxels[voxel_index(x, y + len, z)] == m) len += 1;
+        if (out) out[runs] = (ColumnRun){ m, (uint16_t) len };
+        runs += 1;
+        y += len;
+    }
+    if (out) {
+        g_state.rle_col_top[rle_column(x, z)] = (uint16_t) top;
+        g_state.rle_col_runs[rle_column(x, z)] = (uint16_t) runs;
+    }
+    return runs;
+}
+
+// Convert the whole dense grid.
+static bool rle_build(void) {
+    if (!g_state.rle_col_start) {
+        g_state.rle_col_start = (uint32_t*) malloc(sizeof(uint32_t) * GRID_X * GRID_Z);
+        g_state.rle_col_runs = (uint16_t*) malloc(sizeof(uint16_t) * GRID_X * GRID_Z);
+        g_state.rle_col_slots = (uint16_t*) malloc(sizeof(uint16_t) * GRID_X * GRID_Z);
+        g_state.rle_col_top = (uint16_t*) malloc(sizeof(uint16_t) * GRID_X * GRID_Z);
+        for (int i = 0; i < 4; i++) count_system_alloc();
+        if (!g_state.rle_col_start || !g_state.rle_col_runs || !g_state.rle_col_slots || !g_state.rle_col_top) return false;
+    }
+    uint32_t total = 0;
+    for (int z = 0; z < GRID_Z; z++) {
+        for (int x = 0; x < GRID_X; x++) {
+            const int c = rle_column(x, z);
+            const int runs = rle_encode_column(x, z, NULL);
+            g_state.rle_col_start[c] = total;
+            g_state.rle_col_slots[c] = (uint16_t) (runs + RLE_COLUMN_SLACK);
+            total += (uint32_t) (runs + RLE_COLUMN_SLACK);
+        }
+    }
+    g_state.rle_run_used = (int) total;
+    if ((int) total + (int) total / 4 + 16 > g_state.rle_run_capacity) {
+        const int cap = (int) total + (int) total / 2 + 16;
+        ColumnRun* grown = (ColumnRun*) realloc(g_state.rle_runs, (size_t) cap * sizeof(ColumnRun));
+        count_growth_alloc();
+        if (!grown) return false;
+        g_state.rle_runs = grown;
+        g_state.rle_run_capacity = cap;
+    }
+    int runs = 0;
+    for (int z = 0; z < GRID_Z; z++) {
+        for (int x = 0; x < GRID_X; x++) {
+            runs += rle_encode_column(x, z, &g_state.rle_runs[g_state.rle_col_start[rle_column(x, z)]]);
+        }
+    }
+    g_state.rle_run_total = runs;
+    g_state.rle_rebuilds += 1;
+    return true;
+}
+
+// Re-encode the columns under `box`, moving those that outgrew their slots
+// to the spare tail; false when the tail is used up and the caller has to
+// rebuild. Columns re-encoded before that are left consistent.
+static bool rle_update_region(const VoxelBox* box) {
+    for (int z = box->lo.z; z <= box->hi.z; z++) {
+        for (int x = box->lo.x; x <= box->hi.x; x++) {
+            const int c = rle_column(x, z);
+            const int runs = rle_encode_column(x, z, NULL);
+            if (runs > g_state.rle_col_slots[c]) {
+                const int slots = runs + RLE_COLUMN_SLACK;
+                if (g_state.rle_run_used + slots > g_state.rle_run_capacity) return false;
+                g_state.rle_col_start[c] = (uint32_t) g_state.rle_run_used;
+                g_state.rle_col_slots[c] = (uint16_t) slots;
+                g_state.rle_run_used += slots;
+            }
+            g_state.rle_run_total -= g_state.rle_col_runs[c];
+            g_state.rle_run_total += rle_encode_column(x, z, &g_state.rle_runs[g_state.rle_col_start[c]]);
+        }
+    }
+    return true;
+}
+
+static inline int rle_run_count(void) {
+    return g_state.rle_run_total;
+}
+
+// Column tables plus the run slots handed out, column slack included; the
+// spare tail is not counted.
+static inline size_t rle_bytes(void) {
+    return (sizeof(uint32_t) + 3 * sizeof(uint16_t)) * (GRID_X * GRID_Z) + sizeof(ColumnRun) * (size_t) g_state.rle_run_used;
+}
+
+// Column walk over the RLE store. Steps count columns visited plus runs
+// tested, the analogue of cells visited by trace_ray_dda. Columns whose top
+// is below the ray's y extent are passed without touching their runs.
+// `t_min` is a known-empty prefix, as for trace_ray_dda.
+static TraceResult trace_ray_rle(Vector3 ro, Vector3 rd, Vector3 inv_rd, int sign, float t_min) {
+    float t_enter = 0.0f;
+    float t_exit = 0.0f;
+    if (!ray_aabb(ro, rd, &t_enter, &t_exit)) {
+        TraceResult out = { .hit = false, .entered_grid = false, .col = sky_color(rd, false) };
+        return out;
+    }
+
+    float t = fmaxf(fmaxf(t_enter, 0.0f), t_min);
+    const Vector3 p = Vector3Add(ro, Vector3Scale(rd, t));
+    int cell_x = clamp_i32((int) floorf(p.x), 0, GRID_X - 1);
+    int cell_z = clamp_i32((int) floorf(p.z), 0, GRID_Z - 1);
+    const int step_x = (sign & 1) ? -1 : 1;
+    const int step_z = (sign & 4) ? -1 : 1;
+    const bool vertical = fabsf(rd.y) > 1e-6f;
+
+    const float inf = 1e30f;
+    float t_max_x = (fabsf(rd.x) > 1e-6f) ? t + ((float) (cell_x + (step_x > 0)) - p.x) * inv_rd.x : inf;
+    float t_max_z = (fabsf(rd.z) > 1e-6f) ? t + ((float) (cell_z + (step_z > 0)) - p.z) * inv_rd.z : inf;
+    const float t_delta_x = (fabsf(rd.x) > 1e-6f) ? fabsf(inv_rd.x) : inf;
+    const float t_delta_z = (fabsf(rd.z) > 1e-6f) ? fabsf(inv_rd.z) : inf;
+
+    IVec3 normal = { 0, 1, 0 };
+    int steps = 0;
+    while (cell_x >= 0 && cell_x < GRID_X && cell_z >= 0 && cell_z < GRID_Z && t <= t_exit) {
+        steps += 1;
+        // The ray's y extent while inside this column.
+        const float t_out = fminf(fminf(t_max_x, t_max_z), t_exit);
+        const float ya = ro.y + rd.y * t;
+        const float yb = ro.y + rd.y * t_out;
+        const float y_lo = fminf(ya, yb);
+        const float y_hi = fmaxf(ya, yb);
+
+        const int c = rle_column(cell_x, cell_z);
+        const ColumnRun* run = &g_state.rle_runs[g_state.rle_col_start[c]];
+        const ColumnRun* end = (y_lo < (float) g_state.rle_col_top[c]) ? run + g_state.rle_col_runs[c] : run;
+        float best_t = inf;
+        IVec3 best_normal = normal;
+        int best_y = 0;
+        uint8_t best_id = 0;
+        for (int y0 = 0; run < end && (float) y0 <= y_hi; y0 += run->length, run++) {
+            steps += 1;
+            const int y1 = y0 + run->length;
+            if (run->material == 0 || (float) y1 < y_lo) continue;
+            if (ya >= (float) y0 && ya <= (float) y1) {
+                // Entered the column inside this run: side (or entry) face.
+                best_t = t;
+                best_normal = normal;
+                best_y = clamp_i32((int) floorf(ya), y0, y1 - 1);
+                best_id = run->material;
+                break;
+            }
+            if (!vertical) continue;
+            // Otherwise the ray reaches the run through its top or bottom.
+            const float th = ((rd.y < 0.0f) ? (float) y1 - ro.y : (float) y0 - ro.y) * inv_rd.y;
+            if (th < best_t) {
+                best_t = th;
+                best_normal = (IVec3){ 0, (rd.y < 0.0f) ? 1 : -1, 0 };
+                best_y = (rd.y < 0.0f) ? y1 - 1 : y0;
+                best_id = run->material;
+            }
+        }
+        if (best_id != 0) {
+            const IVec3 cell = { cell_x, best_y, cell_z };
+            TraceResult out = {
+                .hit = true,
+                .entered_grid = true,
+                .steps = steps,
+                .col = shade_voxel_hit(best_id, best_normal, cell, Vector3Add(ro, Vector3Scale(rd, best_t))),
+                .t = best_t,
+                .cell = cell,
+                .normal = best_normal,
+                .id = best_id,
+            };
+            return out;
+        }
+
+        if (t_max_x < t_max_z) {
+            cell_x += step_x;
+            t = t_max_x;
+            t_max_x += t_delta_x;
+            normal = (IVec3){ -step_x, 0, 0 };
+        } else {
+            cell_z += step_z;
+            t = t_max_z;
+            t_max_z += t_delta_z;
+            normal = (IVec3){ 0, 0, -step_z };
+        }
+    }
+
+    TraceResult out = { .hit = false, .entered_grid = true, .steps = steps, .col = sky_color(rd, true) };
+    return out;
+}
+
+// -----------------------------------------------------------------------------
+// Sparse chunk store
+// -----------------------------------------------------------------------------
+// An unbounded world kept as CHUNK_SIZE^3 chunks in an open-addressing hash
+// table keyed by chunk coordinates. Slots are 16 bytes (four per cache line)
+// and probed linearly; the table doubles past half load and deletes by
+// shifting the cluster back, so there are no tombstones. Only chunks with a
+// solid voxel are stored: inside the streamed window around the camera a
+// missing key means an empty chunk, which traversal crosses in one step.
+// The dense grid is copied in at its place at the origin; everything else
+// comes from a deterministic generator.
+//
+// Chunks are palette-compressed by default: a local palette of the
+// materials the chunk uses, and 1, 2, 4 or 8-bit indices into it. Indices
+// never straddle a byte, so decoding is a shift and a mask. Each width has
+// its own block pool. `--chunk-format raw` (key P) stores plain bytes
+// instead, for comparison.
+
+// Storage classes; a chunk's class is picked from its distinct materials.
+typedef enum {
+    CHUNK_RAW = 0,  // one byte per voxel
+    CHUNK_PAL1,     // up to 2 materials (air counts)
+    CHUNK_PAL2,     // up to 4
+    CHUNK_PAL4,     // up to 16
+    CHUNK_PAL8,     // up to 256
+    CHUNK_CLASS_COUNT,
+} ChunkClass;
+
+// log2 of the index width per class; -1 = raw bytes.
+static const int CHUNK_CLASS_SHIFT[CHUNK_CLASS_COUNT] = { -1, 0, 1, 2, 3 };
+
+typedef struct {
+    int32_t x, y, z;
+    uint32_t chunk;     // class << 28 | (block + 1); 0 = free slot
+} ChunkSlot;
+
+// Fixed-size blocks of one class. A palette block is the packed indices,
+// then 2^bits palette entries, the entry count and, 2-byte aligned, how
+// many voxels use each entry. A raw block is the voxels and the number of
+// solid ones.
+typedef struct {
+    uint8_t* blocks;
+    uint32_t* free_list;
+    int block_bytes;
+    int capacity;
+    int used;           // blocks ever handed out
+    int free_count;
+} ChunkPool;
+
+typedef struct {
+    ChunkSlot* slots;
+    int capacity;       // power of two
+    int count;
+    bool palette;       // new chunks are palette-compressed
+    ChunkPool pools[CHUNK_CLASS_COUNT];
+    // Streamed window in chunk coordinates, inclusive.
+    bool window_valid;
+    IVec3 window_lo;
+    IVec3 window_hi;
+} ChunkStore;
+
+static ChunkStore g_chunks;
+
+// Lookup cost, kept per caller so concurrent walks do not share counters.
+typedef struct {
+    int lookups;
+    int probes;
+    int max_probe;
+} ChunkLookups;
+
+// What traversal needs to read one stored chunk.
+typedef struct {
+    const uint8_t* data;
+    const uint8_t* palette;
+    int shift;          // CHUNK_CLASS_SHIFT of the chunk
+    unsigned mask;      // index mask
+} ChunkView;
+
+// Floor division by 2^shift, negative coordinates included.
+static inline int floor_shift(int v, int shift) {
+    return (v >= 0) ? (v >> shift) : ~((~v) >> shift);
+}
+
+static inline int chunk_coord(int v) {
+    return floor_shift(v, CHUNK_SHIFT);
+}
+
+static inline int chunk_voxel_index(int x, int y, int z) {
+    const unsigned m = CHUNK_SIZE - 1;
+    return (int) (((unsigned) x & m) | (((unsigned) y & m) << CHUNK_SHIFT) | (((unsigned) z & m) << (2 * CHUNK_SHIFT)));
+}
+
+static inline uint8_t chunk_view_voxel(const ChunkView* v, int i) {
+    if (v->shift < 0) return v->data[i];
+    const int bit = i << v->shift;
+    return v->palette[(v->data[bit >> 3] >> (bit & 7)) & v->mask];
+}
+
+static inline int chunk_data_bytes(ChunkClass cls) {
+    return (cls == CHUNK_RAW) ? CHUNK_VOXELS : (CHUNK_VOXELS << CHUNK_CLASS_SHIFT[cls]) / 8;
+}
+
+static inline int chunk_palette_size(ChunkClass cls) {
+    return (cls == CHUNK_RAW) ? 0 : 1 << (1 << CHUNK_CLASS_SHIFT[cls]);
+}
+
+// Offset of the use counts: per palette entry, or one solid count for raw.
+static inline int chunk_uses_offset(ChunkClass cls) {
+    const int bytes = chunk_data_bytes(cls) + ((cls == CHUNK_RAW) ? 0 : chunk_palette_size(cls) + 1);
+    return (bytes + 1) & ~1;
+}
+
+// Whole block, rounded to a cache line.
+static inline int chunk_block_bytes(ChunkClass cls) {
+    const int entries = (cls == CHUNK_RAW) ? 1 : chunk_palette_size(cls);
+    const int bytes = chunk_uses_offset(cls) + entries * (int) sizeof(uint16_t);
+    return (bytes + 63) & ~63;
+}
+
+static inline uint8_t* chunk_block(uint32_t ref) {
+    const ChunkPool* pool = &g_chunks.pools[ref >> 28];
+    return &pool->blocks[(size_t) ((ref & 0x0fffffffu) - 1u) * (size_t) pool->block_bytes];
+}
+
+static inline ChunkView chunk_view(uint32_t ref) {
+    const ChunkClass cls = (ChunkClass) (ref >> 28);
+    const uint8_t* block = chunk_block(ref);
+    const int shift = CHUNK_CLASS_SHIFT[cls];
+    const ChunkView v = { block, block + chunk_data_bytes(cls), shift, (shift < 0) ? 0xffu : (1u << (1 << shift)) - 1u };
+    return v;
+}
+
+static inline uint32_t chunk_hash(int x, int y, int z) {
+    uint32_t h = ((uint32_t) x * 0x8da6b343u) ^ ((uint32_t) y * 0xd8163841u) ^ ((uint32_t) z * 0xcb1ab31fu);
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+// Slot holding chunk (x, y, z), or the free slot ending its probe sequence.
+static inline uint32_t chunk_probe(int x, int y, int z, int* probes) {
+    const uint32_t mask = (uint32_t) g_chunks.capacity - 1u;
+    uint32_t i = chunk_hash(x, y, z) & mask;
+    int n = 1;
+    for (;;) {
+        const ChunkSlot* s = &g_chunks.slots[i];
+        if (s->chunk == 0 || (s->x == x && s->y == y && s->z == z)) break;
+        i = (i + 1u) & mask;
+        n += 1;
+    }
+    *probes = n;
+    return i;
+}
+
+// Reader for chunk (x, y, z); false when it is not stored.
+static bool chunk_find(int x, int y, int z, ChunkView* out, ChunkLookups* cost) {
+    if (g_chunks.count == 0) return false;
+    int probes = 0;
+    const ChunkSlot* s = &g_chunks.slots[chunk_probe(x, y, z, &probes)];
+    cost->lookups += 1;
+    cost->probes += probes;
+    if (probes > cost->max_probe) cost->max_probe = probes;
+    if (s->chunk == 0) return false;
+    *out = chunk_view(s->chunk);
+    return true;
+}
+
+static bool chunk_table_grow(void) {
+    const int capacity = (g_chunks.capacity > 0) ? g_chunks.capacity * 2 : CHUNK_TABLE_MIN;
+    ChunkSlot* slots = (ChunkSlot*) calloc((size_t) capacity, sizeof(ChunkSlot));
+    count_growth_alloc();
+    if (!slots) return false;
+    ChunkSlot* old = g_chunks.slots;
+    const int old_capacity = g_chunks.capacity;
+    g_chunks.slots = slots;
+    g_chunks.capacity = capacity;
+    for (int i = 0; i < old_capacity; i++) {
+        if (old[i].chunk == 0) continue;
+        int probes = 0;
+        slots[chunk_probe(old[i].x, old[i].y, old[i].z, &probes)] = old[i];
+    }
+    free(old);
+    return true;
+}
+
+// Block reference for a new chunk of class `cls`; 0 when out of memory.
+static uint32_t chunk_block_alloc(ChunkClass cls) {
+    ChunkPool* pool = &g_chunks.pools[cls];
+    uint32_t index;
+    if (pool->free_count > 0) {
+        index = pool->free_list[--pool->free_count];
+    } else {
+        if (pool->used == pool->capacity) {
+            const int capacity = (pool->capacity > 0) ? pool->capacity * 2 : 64;
+            pool->block_bytes = chunk_block_bytes(cls);
+            uint8_t* blocks = (uint8_t*) realloc(pool->blocks, (size_t) capacity * (size_t) pool->block_bytes);
+            if (blocks) pool->blocks = blocks;
+            uint32_t* free_list = (uint32_t*) realloc(pool->free_list, sizeof(uint32_t) * (size_t) capacity);
+            if (free_list) pool->free_list = free_list;
+            count_growth_alloc();
+            count_growth_alloc();
+            if (!blocks || !free_list) return 0;
+            pool->capacity = capacity;
+        }
+        index = (uint32_t) pool->used++;
+    }
+    return ((uint32_t) cls << 28) | (index + 1u);
+}
+
+static void chunk_block_free(uint32_t ref) {
+    ChunkPool* pool = &g_chunks.pools[ref >> 28];
+    pool->free_list[pool->free_count++] = (ref & 0x0fffffffu) - 1u;
+}
+
+// Class for `voxels` under the store's format; `palette` receives the
+// distinct materials in first-seen order.
+static ChunkClass chunk_classify(const uint8_t* voxels, uint8_t* palette, int* palette_count) {
+    *palette_count = 0;
+    if (!g_chunks.palette) return CHUNK_RAW;
+    uint8_t seen[256] = { 0 };
+    int n = 0;
+    for (int i = 0; i < CHUNK_VOXELS; i++) {
+        const uint8_t v = voxels[i];
+        if (!seen[v]) {
+            seen[v] = 1;
+            palette[n++] = v;
+        }
+    }
+    *palette_count = n;
+    return (n <= 2) ? CHUNK_PAL1 : (n <= 4) ? CHUNK_PAL2 : (n <= 16) ? CHUNK_PAL4 : CHUNK_PAL8;
+}
+
+static inline uint16_t* chunk_uses(ChunkClass cls, uint8_t* block) {
+    return (uint16_t*) (block + chunk_uses_offset(cls));
+}
+
+static void chunk_pack(ChunkClass cls, const uint8_t* voxels, const uint8_t* palette, int palette_count, uint8_t* block) {
+    uint16_t* uses = chunk_uses(cls, block);
+    if (cls == CHUNK_RAW) {
+        memcpy(block, voxels, CHUNK_VOXELS);
+        int solid = 0;
+        for (int i = 0; i < CHUNK_VOXELS; i++) solid += voxels[i] != 0;
+        uses[0] = (uint16_t) solid;
+        return;
+    }
+    uint8_t index[256];
+    for (int k = 0; k < palette_count; k++) index[palette[k]] = (uint8_t) k;
+    const int shift = CHUNK_CLASS_SHIFT[cls];
+    const int data_bytes = chunk_data_bytes(cls);
+    memset(block, 0, (size_t) data_bytes);
+    memset(uses, 0, sizeof(uint16_t) * (size_t) chunk_palette_size(cls));
+    for (int i = 0; i < CHUNK_VOXELS; i++) {
+        const int bit = i << shift;
+        block[bit >> 3] |= (uint8_t) (index[voxels[i]] << (bit & 7));
+        uses[index[voxels[i]]] += 1;
+    }
+    memcpy(block + data_bytes, palette, (size_t) palette_count);
+    block[data_bytes + chunk_palette_size(cls)] = (uint8_t) (palette_count - 1);
+}
+
+static void chunk_unpack(uint32_t ref, uint8_t* voxels) {
+    const ChunkView v = chunk_view(ref);
+    for (int i = 0; i < CHUNK_VOXELS; i++) voxels[i] = chunk_view_voxel(&v, i);
+}
+
+// Pack `voxels` into a new block; 0 when out of memory.
+static uint32_t chunk_encode(const uint8_t* voxels) {
+    uint8_t palette[256];
+    int palette_count = 0;
+    const ChunkClass cls = chunk_classify(voxels, palette, &palette_count);
+    const uint32_t ref = chunk_block_alloc(cls);
+    if (ref != 0) chunk_pack(cls, voxels, palette, palette_count, chunk_block(ref));
+    return ref;
+}
+
+// Store `voxels` as chunk (x, y, z), which must not be present.
+static bool chunk_insert(int x, int y, int z, const uint8_t* voxels) {
+    if ((g_chunks.count + 1) * 2 > g_chunks.capacity && !chunk_table_grow()) return false;
+    const uint32_t ref = chunk_encode(voxels);
+    if (ref == 0) return false;
+    int probes = 0;
+    g_chunks.slots[chunk_probe(x, y, z, &probes)] = (ChunkSlot){ x, y, z, ref };
+    g_chunks.count += 1;
+    return true;
+}
+
+static void chunk_remove(int x, int y, int z) {
+    if (g_chunks.count == 0) return;
+    const uint32_t mask = (uint32_t) g_chunks.capacity - 1u;
+    int probes = 0;
+    uint32_t hole = chunk_probe(x, y, z, &probes);
+    if (g_chunks.slots[hole].chunk == 0) return;
+    chunk_block_free(g_chunks.slots[hole].chunk);
+    g_chunks.count -= 1;
+
+    // Pull later members of the cluster into the hole unless their home
+    // slot lies cyclically in (hole, j], where the hole would cut them off.
+    for (uint32_t j = (hole + 1u) & mask; g_chunks.slots[j].chunk != 0; j = (j + 1u) & mask) {
+        const ChunkSlot* s = &g_chunks.slots[j];
+        const uint32_t home = chunk_hash(s->x, s->y, s->z) & mask;
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            g_chunks.slots[hole] = *s;
+            hole = j;
+        }
+    }
+    g_chunks.slots[hole].chunk = 0;
+}
+
+typedef enum {
+    CHUNK_WRITE_OK = 0,
+    CHUNK_WRITE_EMPTY,      // written; no solid voxel is left
+    CHUNK_WRITE_FULL,       // not written; the palette has no room
+} ChunkWrite;
+
+// Set voxel `i` of stored chunk `ref` in place, keeping the use counts. A
+// palette chunk takes a new material into a spare palette entry, or into
+// one no voxel uses any more.
+static ChunkWrite chunk_write_voxel(uint32_t ref, int i, uint8_t value) {
+    const ChunkClass cls = (ChunkClass) (ref >> 28);
+    uint8_t* block = chunk_block(ref);
+    uint16_t* uses = chunk_uses(cls, block);
+    if (cls == CHUNK_RAW) {
+        const uint8_t old = block[i];
+        block[i] = value;
+        uses[0] = (uint16_t) (uses[0] + (value != 0) - (old != 0));
+        return (uses[0] == 0) ? CHUNK_WRITE_EMPTY : CHUNK_WRITE_OK;
+    }
+    const int shift = CHUNK_CLASS_SHIFT[cls];
+    const int size = chunk_palette_size(cls);
+    uint8_t* palette = block + chunk_data_bytes(cls);
+    uint8_t* last = palette + size;
+    const int bit = i << shift;
+    const unsigned mask = (1u << (1 << shift)) - 1u;
+    const int old = (int) ((block[bit >> 3] >> (bit & 7)) & mask);
+    if (palette[old] == value) return CHUNK_WRITE_OK;
+
+    int k = 0;
+    while (k <= *last && palette[k] != value) k++;
+    if (k > *last) {
+        if (k < size) {
+            *last = (uint8_t) k;
+        } else {
+            for (k = 0; k < size && uses[k] > (k == old); k++) {}
+            if (k == size) return CHUNK_WRITE_FULL;
+        }
+        palette[k] = value;
+    }
+    block[bit >> 3] = (uint8_t) ((block[bit >> 3] & ~(mask << (bit & 7))) | ((unsigned) k << (bit & 7)));
+    uses[old] -= 1;
+    uses[k] += 1;
+    if (value != 0 || uses[old] > 0) return CHUNK_WRITE_OK;
+    // The last voxel of a solid entry went; see whether any other is left.
+    for (int e = 0; e <= *last; e++) {
+        if (palette[e] != 0 && uses[e] > 0) return CHUNK_WRITE_OK;
+    }
+    return CHUNK_WRITE_EMPTY;
+}
+
+// Forget every chunk and the window; storage is kept for reuse.
+static void chunk_store_clear(void) {
+    if (g_chunks.slots) memset(g_chunks.slots, 0, sizeof(ChunkSlot) * (size_t) g_chunks.capacity);
+    g_chunks.count = 0;
+    for (int c = 0; c < CHUNK_CLASS_COUNT; c++) {
+        g_chunks.pools[c].used = 0;
+        g_chunks.pools[c].free_count = 0;
+    }
+    g_chunks.window_valid = false;
+}
+
+// Bytes held by live chunks and by the hash table.
+static size_t chunk_store_bytes(int* class_counts) {
+    size_t bytes = sizeof(ChunkSlot) * (size_t) g_chunks.capacity;
+    for (int c = 0; c < CHUNK_CLASS_COUNT; c++) {
+        const ChunkPool* pool = &g_chunks.pools[c];
+        const int live = pool->used - pool->free_count;
+        if (class_counts) class_counts[c] = live;
+        bytes += (size_t) live * (size_t) chunk_block_bytes((ChunkClass) c);
+    }
+    return bytes;
+}
+
+// Generated world: the dense grid around the origin, elsewhere a ground
+// plane at y = 0 and, on a lattice every 8 cells, 2x2 pillars 3..26 cells
+// tall at about a third of the lattice points.
+static uint8_t sparse_world_voxel(int x, int y, int z) {
+    if (x >= 0 && x < GRID_X && z >= 0 && z < GRID_Z) {
+        return inside_grid(x, y, z) ? g_state.voxels[voxel_index(x, y, z)] : 0;
+    }
+    if (y == 0) return 1;
+    if (y < 0 || ((unsigned) x & 7u) < 3u || ((unsigned) x & 7u) > 4u || ((unsigned) z & 7u) < 3u || ((unsigned) z & 7u) > 4u) {
+        return 0;
+    }
+    const uint32_t h = chunk_hash(floor_shift(x, 3), 7, floor_shift(z, 3));
+    if (h % 3u != 0u || y > 3 + (int) ((h >> 8) % 24u)) return 0;
+    return (uint8_t) (2u + (h >> 16) % 3u);
+}
+
+// Fill `out` with chunk (cx, cy, cz); false when it is all air.
+static bool chunk_generate(int cx, int cy, int cz, uint8_t* out) {
+    uint8_t solid = 0;
+    for (int z = 0; z < CHUNK_SIZE; z++) {
+        for (int y = 0; y < CHUNK_SIZE; y++) {
+            for (int x = 0; x < CHUNK_SIZE; x++) {
+                const uint8_t v = sparse_world_voxel(cx * CHUNK_SIZE + x, cy * CHUNK_SIZE + y, cz * CHUNK_SIZE + z);
+                out[chunk_voxel_index(x, y, z)] = v;
+                solid |= v;
+            }
+        }
+    }
+    return solid != 0;
+}
+
+static inline bool chunk_in_window(int x, int y, int z, IVec3 lo, IVec3 hi) {
+    return x >= lo.x && x <= hi.x && y >= lo.y && y <= hi.y && z >= lo.z && z <= hi.z;
+}
+
+// Move the window to the chunks within SPARSE_VIEW_CHUNKS of `pos`
+// horizontally: evict the ones that left it, generate the ones that entered.
+static void chunk_stream(Vector3 pos, FrameStats* stats) {
+    const int cx = chunk_coord((int) floorf(pos.x));
+    const int cz = chunk_coord((int) floorf(pos.z));
+    const IVec3 lo = { cx - SPARSE_VIEW_CHUNKS, 0, cz - SPARSE_VIEW_CHUNKS };
+    const IVec3 hi = { cx + SPARSE_VIEW_CHUNKS, SPARSE_CHUNKS_Y - 1, cz + SPARSE_VIEW_CHUNKS };
+    const bool had = g_chunks.window_valid;
+    if (had && memcmp(&lo, &g_chunks.window_lo, sizeof(lo)) == 0) return;
+
+    FrameArena* arena = &g_frame_arenas[FRAME_ARENA_RENDER];
+    const ArenaMark scratch = arena_mark(arena);
+    if (had && g_chunks.count > 0) {
+        // Collect first: removal moves entries between slots.
+        IVec3* gone = (IVec3*) arena_alloc(arena, sizeof(IVec3) * (size_t) g_chunks.count);
+        int n = 0;
+        for (int i = 0; i < g_chunks.capacity; i++) {
+            const ChunkSlot* s = &g_chunks.slots[i];
+            if (s->chunk != 0 && !chunk_in_window(s->x, s->y, s->z, lo, hi)) gone[n++] = (IVec3){ s->x, s->y, s->z };
+        }
+        for (int i = 0; i < n; i++) chunk_remove(gone[i].x, gone[i].y, gone[i].z);
+        stats->chunks_evicted = n;
+    }
+
+    uint8_t* voxels = (uint8_t*) arena_alloc(arena, CHUNK_VOXELS);
+    for (int z = lo.z; z <= hi.z; z++) {
+        for (int y = lo.y; y <= hi.y; y++) {
+            for (int x = lo.x; x <= hi.x; x++) {
+                if (had && chunk_in_window(x, y, z, g_chunks.window_lo, g_chunks.window_hi)) continue;
+                stats->chunks_streamed += 1;
+                if (chunk_generate(x, y, z, voxels) && !chunk_insert(x, y, z, voxels)) {
+                    fprintf(stderr, "out of memory streaming chunk (%d, %d, %d)\n", x, y, z);
+                }
+            }
+        }
+    }
+    arena_release(arena, scratch);
+    g_chunks.window_lo = lo;
+    g_chunks.window_hi = hi;
+    g_chunks.window_valid = true;
+}
+
+// Copy the voxels of `box`, which lies inside chunk `c`, from the world
+// into the store with one lookup. A missing chunk is inserted if any of
+// them is solid. A palette chunk that runs out of entries is decoded once
+// and re-packed at the width its materials now need, which also drops
+// entries no voxel uses. A chunk left all air is removed. `scratch` holds
+// CHUNK_VOXELS bytes.
+static bool chunk_refresh_chunk(IVec3 c, const VoxelBox* box, uint8_t* scratch) {
+    int probes = 0;
+    ChunkSlot* s = (g_chunks.count > 0) ? &g_chunks.slots[chunk_probe(c.x, c.y, c.z, &probes)] : NULL;
+    if (!s || s->chunk == 0) {
+        uint8_t solid = 0;
+        memset(scratch, 0, CHUNK_VOXELS);
+        for (int z = box->lo.z; z <= box->hi.z; z++) {
+            for (int y = box->lo.y; y <= box->hi.y; y++) {
+                for (int x = box->lo.x; x <= box->hi.x; x++) {
+                    const uint8_t v = sparse_world_voxel(x, y, z);
+                    scratch[chunk_voxel_index(x, y, z)] = v;
+                    solid |= v;
+                }
+            }
+        }
+        return solid == 0 || chunk_insert(c.x, c.y, c.z, scratch);
+    }
+
+    bool unpacked = false;
+    bool empty = false;
+    for (int z = box->lo.z; z <= box->hi.z; z++) {
+        for (int y = box->lo.y; y <= box->hi.y; y++) {
+            for (int x = box->lo.x; x <= box->hi.x; x++) {
+                const int i = chunk_voxel_index(x, y, z);
+                const uint8_t v = sparse_world_voxel(x, y, z);
+                if (!unpacked) {
+                    const ChunkWrite w = chunk_write_voxel(s->chunk, i, v);
+                    if (w != CHUNK_WRITE_FULL) {
+                        if (w == CHUNK_WRITE_EMPTY) empty = true;
+                        else if (v != 0) empty = false;
+                        continue;
+                    }
+                    chunk_unpack(s->chunk, scratch);
+                    unpacked = true;
+                }
+                scratch[i] = v;
+            }
+        }
+    }
+    if (unpacked) {
+        uint8_t used[256];
+        int used_count = 0;
+        empty = chunk_classify(scratch, used, &used_count) == CHUNK_PAL1 && used_count == 1 && used[0] == 0;
+        if (!empty) {
+            const uint32_t ref = chunk_encode(scratch);
+            if (ref == 0) return false;
+            chunk_block_free(s->chunk);
+            s->chunk = ref;
+        }
+    }
+    if (empty) chunk_remove(c.x, c.y, c.z);
+    return true;
+}
+
+// Edits land in the dense grid; copy the voxels of `box` into the loaded
+// chunks, one chunk at a time.
+static void chunk_refresh_region(const VoxelBox* box) {
+    if (!g_chunks.window_valid) return;
+    FrameArena* arena = &g_frame_arenas[FRAME_ARENA_RENDER];
+    const ArenaMark scratch = arena_mark(arena);
+    uint8_t* voxels = (uint8_t*) arena_alloc(arena, CHUNK_VOXELS);
+    const IVec3 lo = { max_i32(chunk_coord(box->lo.x), g_chunks.window_lo.x), max_i32(chunk_coord(box->lo.y), g_chunks.window_lo.y), max_i32(chunk_coord(box->lo.z), g_chunks.window_lo.z) };
+    const IVec3 hi = { min_i32(chunk_coord(box->hi.x), g_chunks.window_hi.x), min_i32(chunk_coord(box->hi.y), g_chunks.window_hi.y), min_i32(chunk_coord(box->hi.z), g_chunks.window_hi.z) };
+    for (int cz = lo.z; cz <= hi.z; cz++) {
+        for (int cy = lo.y; cy <= hi.y; cy++) {
+            for (int cx = lo.x; cx <= hi.x; cx++) {
+                const VoxelBox part = {
+                    { max_i32(box->lo.x, cx * CHUNK_SIZE), max_i32(box->lo.y, cy * CHUNK_SIZE), max_i32(box->lo.z, cz * CHUNK_SIZE) },
+                    { min_i32(box->hi.x, cx * CHUNK_SIZE + CHUNK_SIZE - 1), min_i32(box->hi.y, cy * CHUNK_SIZE + CHUNK_SIZE - 1), min_i32(box->hi.z, cz * CHUNK_SIZE + CHUNK_SIZE - 1) },
+                };
+                if (!chunk_refresh_chunk((IVec3){ cx, cy, cz }, &part, voxels)) {
+                    fprintf(stderr, "out of memory editing chunk (%d, %d, %d)\n", cx, cy, cz);
+                }
+            }
+        }
+    }
+    arena_release(arena, scratch);
+}
+
+static inline float sparse_boundary_t(int cell, int step, float o, float d, float inv) {
+    return (fabsf(d) > 1e-6f) ? ((float) (cell + ((step > 0) ? 1 : 0)) - o) * inv : 1e30f;
+}
+
+// Voxel DDA through the chunk store, from the camera out to `t_max` or
+// until the ray leaves the window's vertical range. The chunk is looked up
+// only when the walk enters a new one; a chunk with no entry costs a single
+// step that jumps to where the ray leaves it (`steps_skipped` counts the
+// cell steps this saves). Hits are shaded with distance fog so the edge of
+// the streamed window fades into the sky.
+static TraceResult trace_ray_sparse(Vector3 ro, Vector3 rd, Vector3 inv, int sign, float t_max, ChunkLookups* cost) {
+    const IVec3 step = { (sign & 1) ? -1 : 1, (sign & 2) ? -1 : 1, (sign & 4) ? -1 : 1 };
+    const float t_delta_x = (fabsf(rd.x) > 1e-6f) ? fabsf(inv.x) : 1e30f;
+    const float t_delta_y = (fabsf(rd.y) > 1e-6f) ? fabsf(inv.y) : 1e30f;
+    const float t_delta_z = (fabsf(rd.z) > 1e-6f) ? fabsf(inv.z) : 1e30f;
+    IVec3 cell = { (int) floorf(ro.x), (int) floorf(ro.y), (int) floorf(ro.z) };
+    float t_max_x = sparse_boundary_t(cell.x, step.x, ro.x, rd.x, inv.x);
+    float t_max_y = sparse_boundary_t(cell.y, step.y, ro.y, rd.y, inv.y);
+    float t_max_z = sparse_boundary_t(cell.z, step.z, ro.z, rd.z, inv.z);
+
+    IVec3 chunk = { INT_MIN, INT_MIN, INT_MIN };
+    ChunkView view = { NULL, NULL, -1, 0 };
+    bool stored = false;
+    IVec3 normal = { 0, 1, 0 };
+    float t = 0.0f;
+    int steps = 0;
+    int steps_skipped = 0;
+    while (steps < SPARSE_MAX_STEPS && t <= t_max && cell.y >= 0 && cell.y < SPARSE_CHUNKS_Y * CHUNK_SIZE) {
+        steps += 1;
+        const IVec3 c = { chunk_coord(cell.x), chunk_coord(cell.y), chunk_coord(cell.z) };
+        if (c.x != chunk.x || c.y != chunk.y || c.z != chunk.z) {
+            chunk = c;
+            stored = chunk_find(c.x, c.y, c.z, &view, cost);
+        }
+
+        if (!stored) {
+            // Leave the empty chunk through whichever face the ray hits first.
+            const IVec3 base = { c.x * CHUNK_SIZE, c.y * CHUNK_SIZE, c.z * CHUNK_SIZE };
+            const float ex = sparse_boundary_t(base.x + ((step.x > 0) ? CHUNK_SIZE - 1 : 0), step.x, ro.x, rd.x, inv.x);
+            const float ey = sparse_boundary_t(base.y + ((step.y > 0) ? CHUNK_SIZE - 1 : 0), step.y, ro.y, rd.y, inv.y);
+            const float ez = sparse_boundary_t(base.z + ((step.z > 0) ? CHUNK_SIZE - 1 : 0), step.z, ro.z, rd.z, inv.z);
+            const int axis = (ex < ey && ex < ez) ? 0 : (ey < ez) ? 1 : 2;
+            t = (axis == 0) ? ex : (axis == 1) ? ey : ez;
+            const Vector3 p = Vector3Add(ro, Vector3Scale(rd, t));
+            const IVec3 prev = cell;
+            cell.x = clamp_i32((int) floorf(p.x), base.x, base.x + CHUNK_SIZE - 1);
+            cell.y = clamp_i32((int) floorf(p.y), base.y, base.y + CHUNK_SIZE - 1);
+            cell.z = clamp_i32((int) floorf(p.z), base.z, base.z + CHUNK_SIZE - 1);
+            if (axis == 0) {
+                cell.x = (step.x > 0) ? base.x + CHUNK_SIZE : base.x - 1;
+                normal = (IVec3){ -step.x, 0, 0 };
+            } else if (axis == 1) {
+                cell.y = (step.y > 0) ? base.y + CHUNK_SIZE : base.y - 1;
+                normal = (IVec3){ 0, -step.y, 0 };
+            } else {
+                cell.z = (step.z > 0) ? base.z + CHUNK_SIZE : base.z - 1;
+                normal = (IVec3){ 0, 0, -step.z };
+            }
+            steps_skipped += abs(cell.x - prev.x) + abs(cell.y - prev.y) + abs(cell.z - prev.z) - 1;
+            t_max_x = sparse_boundary_t(cell.x, step.x, ro.x, rd.x, inv.x);
+            t_max_y = sparse_boundary_t(cell.y, step.y, ro.y, rd.y, inv.y);
+            t_max_z = sparse_boundary_t(cell.z, step.z, ro.z, rd.z, inv.z);
+            continue;
+        }
+
+        const uint8_t id = chunk_view_voxel(&view, chunk_voxel_index(cell.x, cell.y, cell.z));
+        if (id != 0) {
+            const Vector3 lit = shade_voxel(id, normal, fminf(height_ao(cell.y), 1.0f), 1.0f);
+            const float fog = clamp_f32(t / (float) SPARSE_MAX_DISTANCE, 0.0f, 1.0f);
+            TraceResult out = {
+                .hit = true,
+                .entered_grid = true,
+                .steps = steps,
+                .steps_skipped = steps_skipped,
+                .col = Vector3Add(Vector3Scale(lit, 1.0f - fog * fog), Vector3Scale(sky_color(rd, false), fog * fog)),
+                .t = t,
+                .cell = cell,
+                .normal = normal,
+                .id = id,
+            };
+            return out;
+        }
+
+        if ((t_max_x < t_max_y) && (t_max_x < t_max_z)) {
+            cell.x += step.x;
+            t = t_max_x;
+            t_max_x += t_delta_x;
+            normal = (IVec3){ -step.x, 0, 0 };
+        } else if (t_max_y < t_max_z) {
+            cell.y += step.y;
+            t = t_max_y;
+            t_max_y += t_delta_y;
+            normal = (IVec3){ 0, -step.y, 0 };
+        } else {
+            cell.z += step.z;
+            t = t_max_z;
+            t_max_z += t_delta_z;
+            normal = (IVec3){ 0, 0, -step.z };
+        }
+    }
+
+    TraceResult out = {
+        .hit = false,
+        .entered_grid = true,
+        .steps = steps,
+        .steps_skipped = steps_skipped,
+        .col = sky_color(rd, false),
+    };
+    return out;
+}
+
+// -----------------------------------------------------------------------------
+// Baked face AO
+// -----------------------------------------------------------------------------
+// Minecraft-style vertex AO: each face corner looks at the two edge
+// neighbors and the diagonal neighbor in the layer in front of the face.
+// Two solid edge neighbors fully occlude the corner regardless of the
+// diagonal.
+
+static void bake_voxel_face_ao(int x, int y, int z, uint8_t* out) {
+    if (g_state.voxels[voxel_index(x, y, z)] == 0) {
+        memset(out, 0xff, 6);
+        return;
+    }
+
+    for (int face = 0; face < 6; face++) {
+        const int axis = face >> 1;
+        const int ua = (axis + 1) % 3;
+        const int va = (axis + 2) % 3;
+        int l[3] = { x, y, z };
+        l[axis] += (face & 1) ? 1 : -1;
+
+        uint8_t packed = 0;
+        for (int corner = 0; corner < 4; corner++) {
+            const int su = (corner & 1) ? 1 : -1;
+            const int sv = (corner & 2) ? 1 : -1;
+            int a[3] = { l[0], l[1], l[2] };
+            int b[3] = { l[0], l[1], l[2] };
+            int d[3] = { l[0], l[1], l[2] };
+            a[ua] += su;
+            b[va] += sv;
+            d[ua] += su;
+            d[va] += sv;
+            const int side1 = voxel_solid_or_zero(a[0], a[1], a[2]) ? 1 : 0;
+            const int side2 = voxel_solid_or_zero(b[0], b[1], b[2]) ? 1 : 0;
+            const int diag = voxel_solid_or_zero(d[0], d[1], d[2]) ? 1 : 0;
+            const int level = (side1 && side2) ? 0 : 3 - (side1 + side2 + diag);
+            packed |= (uint8_t) (level << (corner * 2));
+        }
+        out[face] = packed;
+    }
+}
+
+// True when some solid voxel of the brick has an empty (or off-grid)
+// neighbor, i.e. a face a ray can hit.
+static bool brick_has_exposed_face(int bx, int by, int bz) {
+    const int x1 = min_i32((bx + 1) * BRICK_SIZE, GRID_X);
+    const int y1 = min_i32((by + 1) * BRICK_SIZE, GRID_Y);
+    const int z1 = min_i32((bz + 1) * BRICK_SIZE, GRID_Z);
+    for (int z = bz * BRICK_SIZE; z < z1; z++) {
+        for (int y = by * BRICK_SIZE; y < y1; y++) {
+            for (int x = bx * BRICK_SIZE; x < x1; x++) {
+                if (g_state.voxels[voxel_index(x, y, z)] == 0) continue;
+                if (!voxel_solid_or_zero(x - 1, y, z) || !voxel_solid_or_zero(x + 1, y, z)
+                    || !voxel_solid_or_zero(x, y - 1, z) || !voxel_solid_or_zero(x, y + 1, z)
+                    || !voxel_solid_or_zero(x, y, z - 1) || !voxel_solid_or_zero(x, y, z + 1)) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+// A free block, reusing released ones first; 0 when storage cannot grow.
+static uint32_t face_ao_block_alloc(void) {
+    if (g_state.face_ao_free != 0) {
+        const uint32_t block = g_state.face_ao_free;
+        memcpy(&g_state.face_ao_free, &g_state.face_ao[(size_t) (block - 1) * FACE_AO_BLOCK], sizeof(uint32_t));
+        g_state.face_ao_blocks += 1;
+        return block;
+    }
+    if (g_state.face_ao_next == g_state.face_ao_capacity) {
+        const int cap = (g_state.face_ao_capacity > 0) ? g_state.face_ao_capacity * 2 : 64;
+        uint8_t* grown = (uint8_t*) realloc(g_state.face_ao, (size_t) cap * FACE_AO_BLOCK);
+        count_growth_alloc();
+        if (grown == NULL) return 0;
+        g_state.face_ao = grown;
+        g_state.face_ao_capacity = cap;
+    }
+    g_state.face_ao_blocks += 1;
+    return (uint32_t) ++g_state.face_ao_next;
+}
+
+static void face_ao_block_release(uint32_t block) {
+    memcpy(&g_state.face_ao[(size_t) (block - 1) * FACE_AO_BLOCK], &g_state.face_ao_free, sizeof(uint32_t));
+    g_state.face_ao_free = block;
+    g_state.face_ao_blocks -= 1;
+}
+
+// Re-bake every voxel whose corner AO can see a change inside `box`: the
+// box grown by one cell, since corners look one voxel sideways. Bricks that
+// gain an exposed face get a block baked in full; bricks that lose their
+// last one give it back.
+static void face_ao_update_region(const VoxelBox* box) {
+    VoxelBox grown = {
+        { box->lo.x - 1, box->lo.y - 1, box->lo.z - 1 },
+        { box->hi.x + 1, box->hi.y + 1, box->hi.z + 1 },
+    };
+    if (!clip_box_to_grid(&grown)) return;
+    for (int bz = grown.lo.z / BRICK_SIZE; bz <= grown.hi.z / BRICK_SIZE; bz++) {
+        for (int by = grown.lo.y / BRICK_SIZE; by <= grown.hi.y / BRICK_SIZE; by++) {
+            for (int bx = grown.lo.x / BRICK_SIZE; bx <= grown.hi.x / BRICK_SIZE; bx++) {
+                uint32_t* block = &g_state.face_ao_brick[brick_index(bx, by, bz)];
+                if (!brick_has_exposed_face(bx, by, bz)) {
+                    if (*block != 0) face_ao_block_release(*block);
+                    *block = 0;
+                    continue;
+                }
+                VoxelBox bake = {
+                    { bx * BRICK_SIZE, by * BRICK_SIZE, bz * BRICK_SIZE },
+                    { min_i32((bx + 1) * BRICK_SIZE, GRID_X) - 1, min_i32((by + 1) * BRICK_SIZE, GRID_Y) - 1, min_i32((bz + 1) * BRICK_SIZE, GRID_Z) - 1 },
+                };
+                if (*block == 0) {
+                    *block = face_ao_block_alloc();
+                    if (*block == 0) continue;
+                } else {
+                    bake.lo = (IVec3){ max_i32(bake.lo.x, grown.lo.x), max_i32(bake.lo.y, grown.lo.y), max_i32(bake.lo.z, grown.lo.z) };
+                    bake.hi = (IVec3){ min_i32(bake.hi.x, grown.hi.x), min_i32(bake.hi.y, grown.hi.y), min_i32(bake.hi.z, grown.hi.z) };
+                }
+                for (int z = bake.lo.z; z <= bake.hi.z; z++) {
+                    for (int y = bake.lo.y; y <= bake.hi.y; y++) {
+                        for (int x = bake.lo.x; x <= bake.hi.x; x++) {
+                            bake_voxel_face_ao(x, y, z, face_ao_entry(x, y, z));
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+static size_t face_ao_bytes(void) {
+    return (size_t) g_state.face_ao_blocks * FACE_AO_BLOCK + sizeof(uint32_t) * BRICK_COUNT;
+}
+
+// Screen-space reach of an edit: the surfaces whose shading it can change.
+// Baked AO reads the neighbouring cells and traced AO probes reach
+// AO_RAY_RANGE, so those grow the box on every side; a shadow can fall
+// anywhere the box sweeps to when pushed away from the light, so that
+// sweep is added up to where it leaves the grid.
+static VoxelBox edit_shading_reach(const VoxelBox* box) {
+    const float grow = (g_state.ao_mode == AO_RAYS) ? (float) AO_RAY_RANGE : (g_state.ao_mode == AO_BAKED) ? 1.0f : 0.0f;
+    const float lo[3] = { (float) box->lo.x, (float) box->lo.y, (float) box->lo.z };
+    const float hi[3] = { (float) box->hi.x + 1.0f, (float) box->hi.y + 1.0f, (float) box->hi.z + 1.0f };
+    const float size[3] = { (float) GRID_X, (float) GRID_Y, (float) GRID_Z };
+    const float away[3] = { -LIGHT_DIR.x, -LIGHT_DIR.y, -LIGHT_DIR.z };
+    float t = 0.0f;
+    if (g_state.shadows) {
+        t = 1e30f;
+        for (int a = 0; a < 3; a++) {
+            if (away[a] > 0.0f) t = fminf(t, (size[a] - lo[a]) / away[a]);
+            if (away[a] < 0.0f) t = fminf(t, -hi[a] / away[a]);
+        }
+        t = fmaxf(t, 0.0f);
+    }
+    int rlo[3], rhi[3];
+    for (int a = 0; a < 3; a++) {
+        const float moved = away[a] * t;
+        rlo[a] = clamp_i32((int) floorf(fminf(lo[a], lo[a] + moved) - grow), 0, (int) size[a] - 1);
+        rhi[a] = clamp_i32((int) ceilf(fmaxf(hi[a], hi[a] + moved) + grow) - 1, 0, (int) size[a] - 1);
+    }
+    return (VoxelBox){ { rlo[0], rlo[1], rlo[2] }, { rhi[0], rhi[1], rhi[2] } };
+}
+
+// Copy the voxels, brick flags and LOD cells under `box` into every replica.
+static void replicas_update_region(const VoxelBox* box) {
+    if (g_replicas.count == 0) return;
+    const int bx0 = box->lo.x / BRICK_SIZE, bx1 = box->hi.x / BRICK_SIZE;
+    for (int n = 0; n < NUMA_MAX_NODES; n++) {
+        uint8_t* base = g_replicas.node[n].base;
+        if (!base) continue;
+        const bool full_rows = box->lo.x == 0 && box->hi.x == GRID_X - 1;
+        for (int z = box->lo.z; z <= box->hi.z; z++) {
+            if (full_rows) {
+                const int i = voxel_index(0, box->lo.y, z);
+                memcpy(base + i, g_state.voxels + i, (size_t) GRID_X * (size_t) (box->hi.y - box->lo.y + 1));
+                continue;
+            }
+            for (int y = box->lo.y; y <= box->hi.y; y++) {
+                const int i = voxel_index(box->lo.x, y, z);
+                memcpy(base + i, g_state.voxels + i, (size_t) (box->hi.x - box->lo.x + 1));
+            }
+        }
+        for (int bz = box->lo.z / BRICK_SIZE; bz <= box->hi.z / BRICK_SIZE; bz++) {
+            for (int by = box->lo.y / BRICK_SIZE; by <= box->hi.y / BRICK_SIZE; by++) {
+                const int i = brick_index(bx0, by, bz);
+                memcpy(base + REPLICA_BRICKS + i, g_state.brick_occupied + i, (size_t) (bx1 - bx0 + 1));
+            }
+        }
+        for (int level = 1; level < LOD_LEVELS; level++) {
+            const int* d = g_state.lod_dims[level];
+            const int x0 = box->lo.x >> level;
+            for (int z = box->lo.z >> level; z <= box->hi.z >> level; z++) {
+                for (int y = box->lo.y >> level; y <= box->hi.y >> level; y++) {
+                    const int i = g_state.lod_offset[level] + x0 + y * d[0] + z * d[0] * d[1];
+                    memcpy(base + REPLICA_LOD + i, g_state.lod_cells + i, (size_t) ((box->hi.x >> level) - x0 + 1));
+                }
+            }
+        }
+    }
+}
+
+// Report a face mesh that ran out of memory; returns false for mesh_valid.
+static bool mesh_failed(void) {
+    // Reported once; a persistent failure would repeat every frame.
+    if (g_state.mesh_failures == 0) {
+        fprintf(stderr, "raster prepass: cannot grow the face mesh, tracing primary rays with DDA\n");
+    }
+    g_state.mesh_failures += 1;
+    return false;
+}
+
+// Bring everything derived from the voxel store up to date with the pending
+// edit regions and decide which screen tiles need tracing. Each region is
+// handled on its own so cost scales with the edited volume, not the grid.
+static void flush_voxel_edits(const CameraRig* cam, FrameStats* stats) {
+    const bool full_frame = !g_state.have_last_frame || !camera_rig_equal(cam, &g_state.last_camera);
+    memset(g_state.tile_dirty, full_frame ? 1 : 0, sizeof(g_state.tile_dirty));
+    if (g_state.quality_refresh_tile < TILE_COUNT) {
+        const int end = full_frame ? TILE_COUNT : min_i32(g_state.quality_refresh_tile + QUALITY_REFRESH_TILES, TILE_COUNT);
+        memset(&g_state.tile_dirty[g_state.quality_refresh_tile], 1, (size_t) (end - g_state.quality_refresh_tile));
+        g_state.quality_refresh_tile = end;
+    }
+
+    // The face mesh only exists while the raster prepass is in use; turning
+    // it on rebuilds every layer once. A mesh that could not be stored in
+    // full is dropped, primary rays fall back to DDA and the next frame
+    // tries the rebuild again.
+    const bool want_mesh = (g_state.primary_mode == PRIMARY_RASTER);
+    bool mesh_rebuilt = false;
+    if (want_mesh && !g_state.mesh_valid) {
+        const VoxelBox all = { { 0, 0, 0 }, { GRID_X - 1, GRID_Y - 1, GRID_Z - 1 } };
+        g_state.mesh_valid = mesh_update_region(&all) || mesh_failed();
+        mesh_rebuilt = true;
+    } else if (!want_mesh) {
+        g_state.mesh_valid = false;
+    }
+
+    // And the column-RLE store for its primary mode.
+    const bool want_rle = (g_state.primary_mode == PRIMARY_RLE);
+    bool rle_rebuilt = false;
+    if (want_rle && !g_state.rle_valid) {
+        g_state.rle_valid = rle_build();
+        rle_rebuilt = true;
+    } else if (!want_rle) {
+        g_state.rle_valid = false;
+    }
+
+    // Same for the baked face AO table.
+    const bool want_face_ao = (g_state.ao_mode == AO_BAKED);
+    bool face_ao_rebuilt = false;
+    if (want_face_ao && !g_state.face_ao_valid) {
+        const VoxelBox all = { { 0, 0, 0 }, { GRID_X - 1, GRID_Y - 1, GRID_Z - 1 } };
+        face_ao_update_region(&all);
+        g_state.face_ao_valid = true;
+        face_ao_rebuilt = true;
+    } else if (!want_face_ao) {
+        g_state.face_ao_valid = false;
+    }
+
+    for (int i = 0; i < g_state.dirty_count; i++) {
+        const VoxelBox* box = &g_state.dirty_regions[i];
+        bricks_update_region(box);
+        lod_update_region(box);
+        replicas_update_region(box);
+        // Loaded chunks copy the dense grid, whichever mode made the edit.
+        chunk_refresh_region(box);
+        if (g_state.face_ao_valid && !face_ao_rebuilt) {
+            face_ao_update_region(box);
+        }
+        if (g_state.mesh_valid && !mesh_rebuilt && !mesh_update_region(box)) {
+            g_state.mesh_valid = mesh_failed();
+        }
+        if (g_state.rle_valid && !rle_rebuilt && !rle_update_region(box)) {
+            g_state.rle_valid = rle_build();
+            rle_rebuilt = true;
+        }
+        if (!full_frame) {
+            const VoxelBox reach = edit_shading_reach(box);
+            invalidate_box_tiles(cam, &reach);
+        }
+    }
+
+    stats->dirty_regions = g_state.dirty_count;
+    stats->edited_voxels = g_state.edited_voxels;
+    g_state.dirty_count = 0;
+    g_state.edited_voxels = 0;
+}
+
+// -----------------------------------------------------------------------------
+// Worker pool
+// -----------------------------------------------------------------------------
+// Persistent threads started once at launch (--threads N, default one per
+// CPU). pool_parallel_for(count, grain, fn, ctx) runs fn over the items
+// [0, count) on the calling thread, which is worker 0, and the pool. Ranges
+// are split in halves: a worker holding more than `grain` items pushes the
+// upper half onto the bottom of its own Chase-Lev deque and carries on with
+// the lower half, and idle workers steal the oldest, largest halves from the
+// top of the other deques. A job starts when `epoch` is bumped and ends
+// when `pending`, the count of unfinished items, reaches zero; neither
+// barrier takes a lock. Between jobs workers spin for POOL_SPIN polls and
+// then sleep on a futex on `epoch`. With --pin-threads each pool thread is
+// pinned to its own physical core. Jobs must not nest.
+
+enum {
+    POOL_MAX_WORKERS = 64,
+    POOL_DEQUE_SIZE = 64,       // halving nests at most 32 deep
+    POOL_SPIN = 4000,           // idle polls before sleeping
+    POOL_STEAL_SPIN = 64,       // empty steal rounds before yielding the CPU
+};
+
+typedef void (*PoolFn)(void* ctx, int begin, int end, int worker);
+
+typedef struct {
+    int64_t top;                // next range to steal
+    int64_t bottom;             // next free slot; written by the owner only
+    uint64_t ranges[POOL_DEQUE_SIZE];   // begin << 32 | end
+    int cpu;                    // pinned CPU, or -1
+    // This frame's work, reset by pool_frame_begin.
+    double busy_s;
+    int tasks;
+    int steals;
+#if defined(VOXEL_HAVE_PTHREADS)
+    pthread_t thread;
+#endif
+    uint8_t pad[64];            // keep neighbours off this worker's lines
+} PoolWorker;
+
+typedef struct {
+    int workers;                // pool threads plus the calling thread
+    int pinned;
+    uint32_t epoch;             // futex word, bumped per job
+    uint32_t sleepers;
+    bool stop;
+    PoolFn fn;
+    void* ctx;
+    int grain;
+    int pending;
+    double wall_s;              // time spent in jobs this frame
+    PoolWorker worker[POOL_MAX_WORKERS];
+} WorkerPool;
+
+static WorkerPool g_pool = { .workers = 1 };
+
+static inline uint64_t pool_range(int begin, int end) {
+    return (uint64_t) (uint32_t) begin << 32 | (uint32_t) end;
+}
+
+static inline void pool_pause(void) {
+#if defined(VOXEL_HAVE_SSE2)
+    _mm_pause();
+#endif
+}
+
+static void pool_futex_wait(uint32_t* word, uint32_t seen) {
+#if defined(__linux__)
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+#elif defined(VOXEL_HAVE_PTHREADS)
+    if (__atomic_load_n(word, __ATOMIC_ACQUIRE) == seen) {
+        const struct timespec ts = { 0, 200000L };
+        nanosleep(&ts, NULL);
+    }
+#else
+    (void) word;
+    (void) seen;
+#endif
+}
+
+static void pool_futex_wake(uint32_t* word) {
+#if defined(__linux__)
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#else
+    (void) word;
+#endif
+}
+
+// Owner end of the deque.
+static bool deque_push(PoolWorker* w, uint64_t range) {
+    const int64_t b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED);
+    const int64_t t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+    if (b - t >= POOL_DEQUE_SIZE) return false;
+    __atomic_store_n(&w->ranges[b & (POOL_DEQUE_SIZE - 1)], range, __ATOMIC_RELAXED);
+    __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static bool deque_pop(PoolWorker* w, uint64_t* range) {
+    const int64_t b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&w->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t t = __atomic_load_n(&w->top, __ATOMIC_RELAXED);
+    if (t > b) {
+        __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    *range = __atomic_load_n(&w->ranges[b & (POOL_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+    if (t < b) return true;
+    // Last range: whoever moves `top` first gets it.
+    const bool won = __atomic_compare_exchange_n(&w->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+    return won;
+}
+
+// Thief end; fails on an empty deque or a lost race.
+static bool deque_steal(PoolWorker* w, uint64_t* range) {
+    int64_t t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    const int64_t b = __atomic_load_n(&w->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b) return false;
+    *range = __atomic_load_n(&w->ranges[t & (POOL_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+    return __atomic_compare_exchange_n(&w->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+static bool pool_steal(int self, uint64_t* range) {
+    for (int k = 1; k < g_pool.workers; k++) {
+        if (deque_steal(&g_pool.worker[(self + k) % g_pool.workers], range)) {
+            g_pool.worker[self].steals += 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Split off upper halves down to the grain, then run what is left.
+static void pool_run(int self, uint64_t range) {
+    PoolWorker* w = &g_pool.worker[self];
+    const int begin = (int) (range >> 32);
+    int end = (int) (uint32_t) range;
+    while (end - begin > g_pool.grain) {
+        const int mid = begin + (end - begin) / 2;
+        if (!deque_push(w, pool_range(mid, end))) break;
+        end = mid;
+    }
+    const double start = now_seconds();
+    g_pool.fn(g_pool.ctx, begin, end, self);
+    w->busy_s += now_seconds() - start;
+    w->tasks += 1;
+    __atomic_fetch_sub(&g_pool.pending, end - begin, __ATOMIC_RELEASE);
+}
+
+// Pop or steal until the current job has no unfinished items.
+static void pool_work(int self) {
+    int idle = 0;
+    while (__atomic_load_n(&g_pool.pending, __ATOMIC_ACQUIRE) > 0) {
+        uint64_t range;
+        if (deque_pop(&g_pool.worker[self], &range) || pool_steal(self, &range)) {
+            pool_run(self, range);
+            idle = 0;
+        } else if (++idle < POOL_STEAL_SPIN) {
+            pool_pause();
+        } else {
+            // Another worker is finishing the last ranges.
+#if defined(VOXEL_HAVE_PTHREADS)
+            sched_yield();
+#endif
+            idle = 0;
+        }
+    }
+}
+
+static void pool_parallel_for(int count, int grain, PoolFn fn, void* ctx) {
+    if (count <= 0) return;
+    const double start = now_seconds();
+    g_pool.fn = fn;
+    g_pool.ctx = ctx;
+    g_pool.grain = (grain > 0) ? grain : 1;
+    __atomic_store_n(&g_pool.pending, count, __ATOMIC_RELAXED);
+    if (g_pool.workers > 1) {
+        __atomic_add_fetch(&g_pool.epoch, 1u, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&g_pool.sleepers, __ATOMIC_SEQ_CST) > 0) pool_futex_wake(&g_pool.epoch);
+    }
+    replica_enter();
+    pool_run(0, pool_range(0, count));
+    pool_work(0);
+    replica_leave();
+    g_pool.wall_s += now_seconds() - start;
+}
+
+#if defined(VOXEL_HAVE_PTHREADS)
+static void* pool_thread_main(void* arg) {
+    const int self = (int) (intptr_t) arg;
+#if defined(__linux__)
+    if (g_pool.worker[self].cpu >= 0) {
+        unsigned long mask[NUMA_MAX_CPUS / MASK_WORD_BITS] = { 0 };
+        mask[g_pool.worker[self].cpu / MASK_WORD_BITS] |= 1ul << (g_pool.worker[self].cpu % MASK_WORD_BITS);
+        if (syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) == 0) __atomic_fetch_add(&g_pool.pinned, 1, __ATOMIC_RELAXED);
+    }
+#endif
+    uint32_t seen = 0;
+    for (;;) {
+        uint32_t epoch;
+        int spins = 0;
+        while ((epoch = __atomic_load_n(&g_pool.epoch, __ATOMIC_ACQUIRE)) == seen) {
+            if (++spins < POOL_SPIN) {
+                pool_pause();
+                continue;
+            }
+            // A bump after this increment is seen by the futex check.
+            __atomic_add_fetch(&g_pool.sleepers, 1u, __ATOMIC_SEQ_CST);
+            pool_futex_wait(&g_pool.epoch, seen);
+            __atomic_sub_fetch(&g_pool.sleepers, 1u, __ATOMIC_SEQ_CST);
+            spins = 0;
+        }
+        seen = epoch;
+        if (__atomic_load_n(&g_pool.stop, __ATOMIC_ACQUIRE)) break;
+        replica_enter();
+        pool_work(self);
+        replica_leave();
+    }
+    return NULL;
+}
+#endif
+
+static int sysfs_read_int(const char* path) {
+    FILE* f = fopen(path, "r");
+    int v = -1;
+    if (f) {
+        if (fscanf(f, "%d", &v) != 1) v = -1;
+        fclose(f);
+    }
+    return v;
+}
+
+// First logical CPU of each physical core this process may run on, in CPU
+// order; 0 when the topology is unknown.
+static int physical_cores(int* cpus, int max) {
+    int count = 0;
+#if defined(__linux__)
+    unsigned long allowed[NUMA_MAX_CPUS / MASK_WORD_BITS] = { 0 };
+    if (syscall(SYS_sched_getaffinity, 0, sizeof(allowed), allowed) <= 0) return 0;
+    int keys[POOL_MAX_WORKERS];
+    for (int cpu = 0; cpu < NUMA_MAX_CPUS && count < max && count < POOL_MAX_WORKERS; cpu++) {
+        if (!(allowed[cpu / MASK_WORD_BITS] & (1ul << (cpu % MASK_WORD_BITS)))) continue;
+        char path[96];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+        const int core = sysfs_read_int(path);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+        const int package = sysfs_read_int(path);
+        if (core < 0 || package < 0) return 0;
+        const int key = package << 16 | core;
+        bool seen = false;
+        for (int i = 0; i < count && !seen; i++) seen = (keys[i] == key);
+        if (!seen) {
+            keys[count] = key;
+            cpus[count++] = cpu;
+        }
+    }
+#else
+    (void) cpus;
+    (void) max;
+#endif
+    return count;
+}
+
+// CPUs this process may run on (all of node N's after --numa-node N).
+static int allowed_cpus(void) {
+#if defined(__linux__)
+    unsigned long allowed[NUMA_MAX_CPUS / MASK_WORD_BITS] = { 0 };
+    if (syscall(SYS_sched_getaffinity, 0, sizeof(allowed), allowed) > 0) {
+        int count = 0;
+        for (int w = 0; w < NUMA_MAX_CPUS / MASK_WORD_BITS; w++) count += __builtin_popcountl(allowed[w]);
+        if (count > 0) return count;
+    }
+#endif
+    return (int) sysconf(_SC_NPROCESSORS_ONLN);
+}
+
+// Start the pool with `threads` workers, the caller included (<= 0: one per
+// CPU, or per physical core with `pin`). Pinned pool threads take the
+// physical cores after the first, which is left to the render thread.
+static void pool_start(int threads, bool pin) {
+    for (int t = 0; t < POOL_MAX_WORKERS; t++) g_pool.worker[t].cpu = -1;
+#if defined(VOXEL_HAVE_PTHREADS)
+    int cores[POOL_MAX_WORKERS];
+    const int core_count = pin ? physical_cores(cores, POOL_MAX_WORKERS) : 0;
+    if (pin && core_count == 0) fprintf(stderr, "--pin-threads: CPU topology unavailable, threads not pinned\n");
+    if (threads <= 0) threads = (core_count > 0) ? core_count : allowed_cpus();
+    if (threads > POOL_MAX_WORKERS) threads = POOL_MAX_WORKERS;
+    g_pool.workers = 1;
+    for (int t = 1; t < threads; t++) {
+        g_pool.worker[t].cpu = (core_count > 0) ? cores[t % core_count] : -1;
+        if (pthread_create(&g_pool.worker[t].thread, NULL, pool_thread_main, (void*) (intptr_t) t) != 0) break;
+        g_pool.workers = t + 1;
+    }
+#else
+    (void) threads;
+    (void) pin;
+#endif
+}
+
+static void pool_stop(void) {
+#if defined(VOXEL_HAVE_PTHREADS)
+    if (g_pool.workers <= 1) return;
+    __atomic_store_n(&g_pool.stop, true, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&g_pool.epoch, 1u, __ATOMIC_SEQ_CST);
+    pool_futex_wake(&g_pool.epoch);
+    for (int t = 1; t < g_pool.workers; t++) pthread_join(g_pool.worker[t].thread, NULL);
+    g_pool.workers = 1;
+    g_pool.pinned = 0;
+    g_pool.stop = false;
+#endif
+}
+
+// Map a replica on every node but the render thread's once the pool can
+// run there. Contents follow with the next full-grid flush, which every
+// world reset queues.
+VOXEL_MAYBE_UNUSED static void replicas_start(void) {
+    g_replicas.home_node = current_numa_node();
+    if (g_memory.numa_node >= 0 || g_memory.numa_nodes < 2 || g_pool.workers < 2 || g_replicas.home_node < 0) return;
+    for (int n = 0; n < g_memory.numa_nodes; n++) {
+        if (n == g_replicas.home_node) continue;
+        uint8_t* base = (uint8_t*) big_alloc_on("voxel replica", REPLICA_BYTES, n);
+        if (!base) {
+            fprintf(stderr, "voxel replica for NUMA node %d: out of memory, its workers read remotely\n", n);
+            continue;
+        }
+        g_replicas.node[n].base = base;
+        g_replicas.count += 1;
+    }
+}
+
+static void pool_frame_begin(void) {
+    g_pool.wall_s = 0.0;
+    for (int t = 0; t < g_pool.workers; t++) {
+        g_pool.worker[t].busy_s = 0.0;
+        g_pool.worker[t].tasks = 0;
+        g_pool.worker[t].steals = 0;
+    }
+}
+
+static void pool_frame_stats(FrameStats* st) {
+    double busy = 0.0;
+    st->pool_threads = g_pool.workers;
+    for (int t = 0; t < g_pool.workers; t++) {
+        busy += g_pool.worker[t].busy_s;
+        st->pool_tasks += g_pool.worker[t].tasks;
+        st->pool_steals += g_pool.worker[t].steals;
+    }
+    st->pool_utilization = (g_pool.wall_s > 0.0) ? (float) (busy / (g_pool.wall_s * (double) g_pool.workers)) : 0.0f;
+}
+
+// Per-worker counters of a parallel pass, on separate cache lines.
+typedef struct {
+    FrameStats stats;
+    uint8_t pad[64];
+} WorkerStats;
+
+enum { TILE_GRAIN = 4 };         // screen tiles per pool task
+
+// Zeroed counters for one pass, one per pool worker.
+static WorkerStats* worker_stats_alloc(void) {
+    WorkerStats* parts = (WorkerStats*) arena_alloc(&g_frame_arenas[FRAME_ARENA_RENDER], sizeof(WorkerStats) * (size_t) g_pool.workers);
+    memset(parts, 0, sizeof(WorkerStats) * (size_t) g_pool.workers);
+    return parts;
+}
+
+// -----------------------------------------------------------------------------
+// Secondary ray stream
+// -----------------------------------------------------------------------------
+// Secondary rays are incoherent, so they are not traced where they are
+// generated. All rays of a frame go into one SoA queue, get counting-sorted
+// into bins by direction octant and origin region, and are then traced in
+// RAY_BATCH-sized batches that each stay inside one bin.
+
+static inline void store_pixel(int pixel_index, Vector3 col) {
+    const int r = clamp_i32((int) (col.x * 255.0f), 0, 255);
+    const int g = clamp_i32((int) (col.y * 255.0f), 0, 255);
+    const int b = clamp_i32((int) (col.z * 255.0f), 0, 255);
+    g_state.pixels[pixel_index] = (Color){
+        (unsigned char) r,
+        (unsigned char) g,
+        (unsigned char) b,
+        255
+    };
+}
+
+// Stateless hash -> [0, 1) float; drives per-pixel sample directions.
+static inline float hash_unit(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return (float) (x >> 8) * (1.0f / 16777216.0f);
+}
+
+// Cosine-weighted direction in the hemisphere around `n`.
+static Vector3 cosine_hemisphere_dir(Vector3 n, float u1, float u2) {
+    const float r = sqrtf(u1);
+    const float phi = 6.28318530718f * u2;
+    const Vector3 helper = (fabsf(n.x) > 0.5f) ? (Vector3){ 0.0f, 1.0f, 0.0f } : (Vector3){ 1.0f, 0.0f, 0.0f };
+    const Vector3 tangent = Vector3Normalize(Vector3CrossProduct(helper, n));
+    const Vector3 bitangent = Vector3CrossProduct(n, tangent);
+    const float lx = r * cosf(phi);
+    const float ly = r * sinf(phi);
+    const float lz = sqrtf(fmaxf(0.0f, 1.0f - u1));
+    return Vector3Add(Vector3Add(Vector3Scale(tangent, lx), Vector3Scale(bitangent, ly)), Vector3Scale(n, lz));
+}
+
+// Bin = direction octant (sign bits) x origin region.
+static inline uint16_t secondary_bin(Vector3 o, Vector3 d) {
+    const int octant = (d.x < 0.0f ? 1 : 0) | (d.y < 0.0f ? 2 : 0) | (d.z < 0.0f ? 4 : 0);
+    const int rx = clamp_i32((int) floorf(o.x) / REGION_SIZE, 0, REGIONS_X - 1);
+    const int ry = clamp_i32((int) floorf(o.y) / REGION_SIZE, 0, REGIONS_Y - 1);
+    const int rz = clamp_i32((int) floorf(o.z) / REGION_SIZE, 0, REGIONS_Z - 1);
+    const int region = (rx + ry * REGIONS_X + rz * REGIONS_X * REGIONS_Y) % REGION_BINS;
+    return (uint16_t) (octant * REGION_BINS + region);
+}
+
+static void ray_stream_alloc(RayStream* rs, FrameArena* arena, int capacity) {
+    const size_t n = (size_t) capacity;
+    rs->ox = (float*) arena_alloc(arena, n * sizeof(float));
+    rs->oy = (float*) arena_alloc(arena, n * sizeof(float));
+    rs->oz = (float*) arena_alloc(arena, n * sizeof(float));
+    rs->dx = (float*) arena_alloc(arena, n * sizeof(float));
+    rs->dy = (float*) arena_alloc(arena, n * sizeof(float));
+    rs->dz = (float*) arena_alloc(arena, n * sizeof(float));
+    rs->pixel = (int32_t*) arena_alloc(arena, n * sizeof(int32_t));
+    rs->bin = (uint16_t*) arena_alloc(arena, n * sizeof(uint16_t));
+    rs->count = 0;
+    rs->capacity = capacity;
+}
+
+static inline void ray_stream_push(RayStream* rs, Vector3 o, Vector3 d, int pixel) {
+    const int i = rs->count++;
+    rs->ox[i] = o.x;
+    rs->oy[i] = o.y;
+    rs->oz[i] = o.z;
+    rs->dx[i] = d.x;
+    rs->dy[i] = d.y;
+    rs->dz[i] = d.z;
+    rs->pixel[i] = pixel;
+    rs->bin[i] = secondary_bin(o, d);
+}
+
+// Stable counting sort of `in` into `out` by bin; fills bin_start.
+static void ray_stream_sort(const RayStream* in, RayStream* out, int* bin_start, FrameArena* arena) {
+    memset(bin_start, 0, (SECONDARY_BINS + 1) * sizeof(int));
+    for (int i = 0; i < in->count; i++) {
+        bin_start[in->bin[i] + 1] += 1;
+    }
+    for (int b = 0; b < SECONDARY_BINS; b++) {
+        bin_start[b + 1] += bin_start[b];
+    }
+
+    int* cursor = (int*) arena_alloc(arena, SECONDARY_BINS * sizeof(int));
+    memcpy(cursor, bin_start, SECONDARY_BINS * sizeof(int));
+    for (int i = 0; i < in->count; i++) {
+        const int j = cursor[in->bin[i]]++;
+        out->ox[j] = in->ox[i];
+        out->oy[j] = in->oy[i];
+        out->oz[j] = in->oz[i];
+        out->dx[j] = in->dx[i];
+        out->dy[j] = in->dy[i];
+        out->dz[j] = in->dz[i];
+        out->pixel[j] = in->pixel[i];
+        out->bin[j] = in->bin[i];
+    }
+    out->count = in->count;
+}
+
+// Trace rays [begin, end) of one batch and count unoccluded rays per pixel.
+// A pixel's rays can sit in batches traced by different workers.
+static void trace_ray_batch(const RayStream* rs, int begin, int end, float t_max, FrameStats* stats) {
+    for (int i = begin; i < end; i++) {
+        const Vector3 o = { rs->ox[i], rs->oy[i], rs->oz[i] };
+        const Vector3 d = { rs->dx[i], rs->dy[i], rs->dz[i] };
+        if (!trace_any_hit(o, d, t_max, &stats->secondary_steps)) {
+            __atomic_fetch_add(&g_state.ao_visible[rs->pixel[i]], 1, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+enum { RAY_BATCH_GRAIN = 4 };    // AO ray batches per pool task
+
+typedef struct {
+    const RayStream* rays;
+    const int* batch_start;     // batch b is rays [batch_start[b], batch_start[b + 1])
+    WorkerStats* parts;
+} RayBatchJob;
+
+static void trace_ray_batches(void* ctx, int begin, int end, int worker) {
+    const RayBatchJob* job = (const RayBatchJob*) ctx;
+    FrameStats* stats = &job->parts[worker].stats;
+    for (int b = begin; b < end; b++) {
+        trace_ray_batch(job->rays, job->batch_start[b], job->batch_start[b + 1], (float) AO_RAY_RANGE, stats);
+    }
+}
+
+// Trace the batches over the pool.
+static void trace_ray_batches_parallel(const RayStream* rs, const int* batch_start, int batch_count, FrameStats* stats) {
+    RayBatchJob job = { rs, batch_start, worker_stats_alloc() };
+    pool_parallel_for(batch_count, RAY_BATCH_GRAIN, trace_ray_batches, &job);
+    for (int w = 0; w < g_pool.workers; w++) {
+        stats->secondary_steps += job.parts[w].stats.secondary_steps;
+    }
+    stats->secondary_batches += batch_count;
+}
+
+// Ambient occlusion from AO_RAYS_PER_HIT short probes per hit pixel in the
+// traced tiles. The rays are generated and sorted on the render thread, and
+// their batches are traced on the pool. With `compare_unsorted` every other
+// frame traces the queue in generation order instead, so both timings stay
+// current.
+static void secondary_ao_pass(FrameStats* stats) {
+    FrameArena* arena = &g_frame_arenas[FRAME_ARENA_RENDER];
+    int dirty_tiles = 0;
+    for (int i = 0; i < TILE_COUNT; i++) dirty_tiles += g_state.tile_dirty[i];
+    RayStream stream;
+    RayStream* queue = &stream;
+    ray_stream_alloc(queue, arena, dirty_tiles * TILE_PIXELS * AO_RAYS_PER_HIT);
+
+    for (int y = 0; y < IMG_H; y++) {
+        for (int x = 0; x < IMG_W; x++) {
+            if (!g_state.tile_dirty[(y / TILE_SIZE) * TILES_X + x / TILE_SIZE]) continue;
+            const int pixel = y * IMG_W + x;
+            const PrimaryHit* h = &g_state.primary_hits[pixel];
+            g_state.ao_visible[pixel] = 0;
+            if (h->material == 0) continue;
+
+            const IVec3 ni = face_normal(h->face);
+            const Vector3 n = { (float) ni.x, (float) ni.y, (float) ni.z };
+            const Vector3 origin = Vector3Add(h->pos, Vector3Scale(n, 1e-3f));
+            for (int k = 0; k < AO_RAYS_PER_HIT; k++) {
+                const uint32_t seed = ((uint32_t) pixel * AO_RAYS_PER_HIT + (uint32_t) k) * 2654435761u + g_state.frame_index * 0x9e3779b9u;
+                const Vector3 d = cosine_hemisphere_dir(n, hash_unit(seed), hash_unit(seed ^ 0x68bc21ebu));
+                ray_stream_push(queue, origin, d, pixel);
+            }
+        }
+    }
+    stats->secondary_rays = queue->count;
+
+    const bool sorted = !(g_state.compare_unsorted && (g_state.frame_index & 1));
+    stats->secondary_sorted = sorted;
+    if (sorted) {
+        const double sort_start = now_seconds();
+        RayStream sorted_stream;
+        ray_stream_alloc(&sorted_stream, arena, queue->count);
+        int* bin_start = (int*) arena_alloc(arena, (SECONDARY_BINS + 1) * sizeof(int));
+        ray_stream_sort(queue, &sorted_stream, bin_start, arena);
+        stats->secondary_sort_ms = (float) ((now_seconds() - sort_start) * 1000.0);
+
+        // Batches stay inside one bin.
+        int* batch_start = (int*) arena_alloc(arena, (size_t) (queue->count / RAY_BATCH + SECONDARY_BINS + 1) * sizeof(int));
+        int batches = 0;
+        for (int b = 0; b < SECONDARY_BINS; b++) {
+            for (int i = bin_start[b]; i < bin_start[b + 1]; i += RAY_BATCH) {
+                batch_start[batches++] = i;
+            }
+        }
+        batch_start[batches] = queue->count;
+        const double trace_start = now_seconds();
+        trace_ray_batches_parallel(&sorted_stream, batch_start, batches, stats);
+        stats->secondary_trace_ms = (float) ((now_seconds() - trace_start) * 1000.0);
+    } else {
+        const int batches = (queue->count + RAY_BATCH - 1) / RAY_BATCH;
+        int* batch_start = (int*) arena_alloc(arena, (size_t) (batches + 1) * sizeof(int));
+        for (int b = 0; b < batches; b++) batch_start[b] = b * RAY_BATCH;
+        batch_start[batches] = queue->count;
+        const double trace_start = now_seconds();
+        trace_ray_batches_parallel(queue, batch_start, batches, stats);
+        stats->secondary_trace_ms = (float) ((now_seconds() - trace_start) * 1000.0);
+    }
+    if (stats->secondary_batches > 0) {
+        stats->batch_fill = (float) stats->secondary_rays / (float) (stats->secondary_batches * RAY_BATCH);
+    }
+
+    // Sorting cost is part of the sorted path's bill.
+    const float total_ms = stats->secondary_sort_ms + stats->secondary_trace_ms;
+    float* avg = sorted ? &g_state.secondary_ms_sorted : &g_state.secondary_ms_unsorted;
+    *avg = (*avg <= 0.0f) ? total_ms : (*avg * 0.9f + total_ms * 0.1f);
+
+}
+
+// Hard shadows: one ray toward LIGHT_DIR per lit-facing hit, gathered and
+// traced one screen tile at a time so a batch shares direction and region.
+// Tiles [begin, end) on one pool worker; a tile writes only its own pixels.
+static void shadow_tiles(void* ctx, int begin, int end, int worker) {
+    FrameStats* stats = &((WorkerStats*) ctx)[worker].stats;
+    float ox[TILE_PIXELS];
+    float oy[TILE_PIXELS];
+    float oz[TILE_PIXELS];
+    int pix[TILE_PIXELS];
+
+    for (int tile = begin; tile < end; tile++) {
+        if (!g_state.tile_dirty[tile]) continue;
+        const int tx = tile % TILES_X;
+        const int ty = tile / TILES_X;
+
+        int n = 0;
+        const int y1 = (ty + 1) * TILE_SIZE < IMG_H ? (ty + 1) * TILE_SIZE : IMG_H;
+        for (int y = ty * TILE_SIZE; y < y1; y++) {
+            for (int x = tx * TILE_SIZE; x < (tx + 1) * TILE_SIZE; x++) {
+                const int pixel = y * IMG_W + x;
+                const PrimaryHit* h = &g_state.primary_hits[pixel];
+                g_state.shadow_visible[pixel] = 1;
+                if (h->material == 0) continue;
+
+                // Faces turned away from the light get no direct term anyway.
+                const IVec3 ni = face_normal(h->face);
+                const Vector3 nf = { (float) ni.x, (float) ni.y, (float) ni.z };
+                if (Vector3DotProduct(nf, LIGHT_DIR) <= 0.0f) continue;
+
+                const Vector3 o = Vector3Add(h->pos, Vector3Scale(nf, 1e-3f));
+                ox[n] = o.x;
+                oy[n] = o.y;
+                oz[n] = o.z;
+                pix[n] = pixel;
+                n++;
+            }
+        }
+        if (n == 0) continue;
+
+        for (int i = 0; i < n; i++) {
+            const Vector3 o = { ox[i], oy[i], oz[i] };
+            if (trace_any_hit(o, LIGHT_DIR, 1e30f, &stats->shadow_steps)) {
+                g_state.shadow_visible[pix[i]] = 0;
+                stats->shadow_occluded += 1;
+            }
+        }
+        stats->shadow_rays += n;
+        stats->shadow_batches += 1;
+    }
+}
+
+static void shadow_pass(FrameStats* stats) {
+    WorkerStats* parts = worker_stats_alloc();
+    pool_parallel_for(TILE_COUNT, TILE_GRAIN, shadow_tiles, parts);
+    for (int w = 0; w < g_pool.workers; w++) {
+        stats->shadow_steps += parts[w].stats.shadow_steps;
+        stats->shadow_occluded += parts[w].stats.shadow_occluded;
+        stats->shadow_rays += parts[w].stats.shadow_rays;
+        stats->shadow_batches += parts[w].stats.shadow_batches;
+    }
+}
+
+// Re-shade hit pixels of traced tiles with the secondary-pass results.
+static void compose_secondary(void) {
+    for (int y = 0; y < IMG_H; y++) {
+        for (int x = 0; x < IMG_W; x++) {
+            if (!g_state.tile_dirty[(y / TILE_SIZE) * TILES_X + x / TILE_SIZE]) continue;
+            const int pixel = y * IMG_W + x;
+            const PrimaryHit* h = &g_state.primary_hits[pixel];
+            if (h->material == 0) continue;
+
+            const IVec3 normal = face_normal(h->face);
+            const float ao = (g_state.ao_mode == AO_RAYS)
+                ? 0.55f + 0.45f * (float) g_state.ao_visible[pixel] / (float) AO_RAYS_PER_HIT
+                : surface_ao(h->cell, normal, h->pos);
+            const float light = g_state.shadows ? (float) g_state.shadow_visible[pixel] : 1.0f;
+            store_pixel(pixel, shade_voxel(h->material, normal, ao, light));
+        }
+    }
+}
+
+// CPU renderer: one ray per output pixel.
+// This is the direct compute-shader candidate if moving traversal to GPU.
+// Only tiles invalidated by camera motion or voxel edits are re-traced.
+static inline int color_distance(Color a, Color b) {
+    return abs((int) a.r - (int) b.r) + abs((int) a.g - (int) b.g) + abs((int) a.b - (int) b.b);
+}
+
+// History sample for the untraced pixel (x, y), assuming it sees the same
+// face plane as its traced neighbor `n`: the pixel's ray meets that plane,
+// the point is projected through last frame's rig, and the history hit
+// there is taken when it lies on the same face at the same depth and its
+// voxel is unchanged. Returns the history pixel index or -1.
+static int checkerboard_history(const CameraRig* cam, int x, int y, int n) {
+    const PrimaryHit* nh = &g_state.primary_hits[n];
+    if (nh->material == 0) return -1;
+    const int axis = nh->face >> 1;
+    const Vector3 dir = pixel_ray_dir(cam, (float) x, (float) y);
+    const float o[3] = { cam->pos.x, cam->pos.y, cam->pos.z };
+    const float d[3] = { dir.x, dir.y, dir.z };
+    const float plane[3] = { nh->pos.x, nh->pos.y, nh->pos.z };
+    if (fabsf(d[axis]) < 1e-6f) return -1;
+    const float t = (plane[axis] - o[axis]) / d[axis];
+    if (t <= 0.0f) return -1;
+    const Vector3 p = Vector3Add(cam->pos, Vector3Scale(dir, t));
+
+    const CameraRig* prev = &g_state.last_camera;
+    float px = 0.0f, py = 0.0f;
+    if (!project_to_pixel(prev, p, &px, &py) || px < 0.0f || py < 0.0f || px >= (float) IMG_W || py >= (float) IMG_H) return -1;
+    const int hp = (int) py * IMG_W + (int) px;
+    const PrimaryHit* hh = &g_state.history_hits[hp];
+    if (hh->material == 0 || hh->face != nh->face
+        || g_state.voxels[voxel_index(hh->cell.x, hh->cell.y, hh->cell.z)] != hh->material) {
+        return -1;
+    }
+    const float expected = Vector3Distance(p, prev->pos);
+    const float found = Vector3Distance(hh->pos, prev->pos);
+    return (fabsf(found - expected) <= 0.25f + 0.01f * expected) ? hp : -1;
+}
+
+// Fill the untraced half of the checkerboard in dirty tiles. In a settled
+// tile that half was traced last frame from the same camera, so its samples
+// are kept unless their voxel changed. Otherwise the pair of traced
+// neighbors (horizontal or vertical) with the closer colors is chosen
+// first. A pixel then takes last frame's sample reprojected through either
+// neighbor's face plane when it passes the depth and material checks, and
+// is otherwise interpolated between the pair.
+static void reconstruct_checkerboard(const CameraRig* cam, int parity, FrameStats* stats) {
+    for (int y = 0; y < IMG_H; y++) {
+        const uint8_t* tile_row = &g_state.tile_dirty[(y / TILE_SIZE) * TILES_X];
+        const uint8_t* settled_row = &g_state.tile_settled[(y / TILE_SIZE) * TILES_X];
+        for (int x = (y + parity + 1) & 1; x < IMG_W; x += 2) {
+            if (!tile_row[x / TILE_SIZE]) continue;
+            const int pixel = y * IMG_W + x;
+            PrimaryHit* h = &g_state.primary_hits[pixel];
+
+            if (settled_row[x / TILE_SIZE] && g_state.have_last_frame) {
+                const PrimaryHit* hh = &g_state.history_hits[pixel];
+                if (hh->material == 0 || g_state.voxels[voxel_index(hh->cell.x, hh->cell.y, hh->cell.z)] == hh->material) {
+                    g_state.pixels[pixel] = g_state.history_pixels[pixel];
+                    *h = *hh;
+                    stats->reprojected += 1;
+                    continue;
+                }
+            }
+
+            const int l = (x > 0) ? pixel - 1 : pixel + 1;
+            const int r = (x < IMG_W - 1) ? pixel + 1 : pixel - 1;
+            const int u = (y > 0) ? pixel - IMG_W : pixel + IMG_W;
+            const int d = (y < IMG_H - 1) ? pixel + IMG_W : pixel - IMG_W;
+            const Color* c = g_state.pixels;
+            const bool horizontal = color_distance(c[l], c[r]) <= color_distance(c[u], c[d]);
+            const int a = horizontal ? l : u;
+            const int b = horizontal ? r : d;
+
+            if (g_state.have_last_frame) {
+                int hp = checkerboard_history(cam, x, y, a);
+                if (hp < 0) hp = checkerboard_history(cam, x, y, b);
+                if (hp >= 0) {
+                    g_state.pixels[pixel] = g_state.history_pixels[hp];
+                    *h = g_state.history_hits[hp];
+                    stats->reprojected += 1;
+                    continue;
+                }
+            }
+
+            g_state.pixels[pixel] = (Color){
+                (unsigned char) ((c[a].r + c[b].r + 1) / 2),
+                (unsigned char) ((c[a].g + c[b].g + 1) / 2),
+                (unsigned char) ((c[a].b + c[b].b + 1) / 2),
+                255,
+            };
+            *h = g_state.primary_hits[a];
+            stats->interpolated += 1;
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Primary ray table
+// -----------------------------------------------------------------------------
+
+static void ray_table_build(const CameraRig* cam) {
+    for (int y = 0; y < IMG_H; y++) {
+        const float v = (1.0f - (2.0f * (float) y + 1.0f) / (float) IMG_H) * cam->fov_scale;
+        for (int x = 0; x < IMG_W; x++) {
+            const float u = (-1.0f + (2.0f * (float) x + 1.0f) / (float) IMG_W) * cam->aspect * cam->fov_scale;
+            const float inv_len = 1.0f / sqrtf(u * u + v * v + 1.0f);
+            const int i = y * IMG_W + x;
+            g_state.cam_dir_x[i] = u * inv_len;
+            g_state.cam_dir_y[i] = v * inv_len;
+            g_state.cam_dir_z[i] = inv_len;
+        }
+    }
+}
+
+// Rotate the camera-space table into world space for `cam`. Only a new pose
+// (or projection) does any work.
+static void ray_table_update(const CameraRig* cam) {
+    if (g_state.ray_table_valid && camera_rig_equal(cam, &g_state.ray_table_rig)) return;
+    if (!g_state.ray_table_valid || cam->aspect != g_state.ray_table_rig.aspect || cam->fov_scale != g_state.ray_table_rig.fov_scale) {
+        ray_table_build(cam);
+    }
+    g_state.ray_table_rig = *cam;
+    g_state.ray_table_valid = true;
+
+    const Vector3 r = cam->right;
+    const Vector3 u = cam->up;
+    const Vector3 f = cam->forward;
+    int i = 0;
+#if defined(VOXEL_HAVE_SSE2)
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 rx = _mm_set1_ps(r.x), ry = _mm_set1_ps(r.y), rz = _mm_set1_ps(r.z);
+    const __m128 ux = _mm_set1_ps(u.x), uy = _mm_set1_ps(u.y), uz = _mm_set1_ps(u.z);
+    const __m128 fx = _mm_set1_ps(f.x), fy = _mm_set1_ps(f.y), fz = _mm_set1_ps(f.z);
+    for (; i + 4 <= IMG_W * IMG_H; i += 4) {
+        const __m128 cx = _mm_loadu_ps(&g_state.cam_dir_x[i]);
+        const __m128 cy = _mm_loadu_ps(&g_state.cam_dir_y[i]);
+        const __m128 cz = _mm_loadu_ps(&g_state.cam_dir_z[i]);
+        const __m128 dx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, cx), _mm_mul_ps(ux, cy)), _mm_mul_ps(fx, cz));
+        const __m128 dy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ry, cx), _mm_mul_ps(uy, cy)), _mm_mul_ps(fy, cz));
+        const __m128 dz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rz, cx), _mm_mul_ps(uz, cy)), _mm_mul_ps(fz, cz));
+        _mm_storeu_ps(&g_state.ray_dx[i], dx);
+        _mm_storeu_ps(&g_state.ray_dy[i], dy);
+        _mm_storeu_ps(&g_state.ray_dz[i], dz);
+        _mm_storeu_ps(&g_state.ray_ix[i], _mm_div_ps(one, dx));
+        _mm_storeu_ps(&g_state.ray_iy[i], _mm_div_ps(one, dy));
+        _mm_storeu_ps(&g_state.ray_iz[i], _mm_div_ps(one, dz));
+        const int mx = _mm_movemask_ps(dx);
+        const int my = _mm_movemask_ps(dy);
+        const int mz = _mm_movemask_ps(dz);
+        for (int k = 0; k < 4; k++) {
+            g_state.ray_sign[i + k] = (uint8_t) (((mx >> k) & 1) | (((my >> k) & 1) << 1) | (((mz >> k) & 1) << 2));
+        }
+    }
+#endif
+    for (; i < IMG_W * IMG_H; i++) {
+        const float cx = g_state.cam_dir_x[i];
+        const float cy = g_state.cam_dir_y[i];
+        const float cz = g_state.cam_dir_z[i];
+        const float dx = r.x * cx + u.x * cy + f.x * cz;
+        const float dy = r.y * cx + u.y * cy + f.y * cz;
+        const float dz = r.z * cx + u.z * cy + f.z * cz;
+        g_state.ray_dx[i] = dx;
+        g_state.ray_dy[i] = dy;
+        g_state.ray_dz[i] = dz;
+        g_state.ray_ix[i] = 1.0f / dx;
+        g_state.ray_iy[i] = 1.0f / dy;
+        g_state.ray_iz[i] = 1.0f / dz;
+        g_state.ray_sign[i] = (uint8_t) ((signbit(dx) ? 1 : 0) | (signbit(dy) ? 2 : 0) | (signbit(dz) ? 4 : 0));
+    }
+}
+
+// The selected primary mode, or DDA while its structure (face mesh, RLE
+// columns) could not be built.
+static inline PrimaryMode primary_mode_in_use(void) {
+    const PrimaryMode mode = g_state.primary_mode;
+    if ((mode == PRIMARY_RASTER && !g_state.mesh_valid) || (mode == PRIMARY_RLE && !g_state.rle_valid)) return PRIMARY_DDA;
+    return mode;
+}
+
+// Trace (or resolve from the raster visibility buffer) the primary ray of
+// pixel (x, y), keep its hit for secondary passes and store its color.
+static void trace_primary_pixel(const CameraRig* rig, int x, int y, FrameStats* stats) {
+    const int pixel = y * IMG_W + x;
+    const Vector3 dir = { g_state.ray_dx[pixel], g_state.ray_dy[pixel], g_state.ray_dz[pixel] };
+    const PrimaryMode mode = primary_mode_in_use();
+    const float t_min = (mode != PRIMARY_RASTER && g_state.beam_prepass) ? g_state.tile_t_start[(y / TILE_SIZE) * TILES_X + x / TILE_SIZE] : 0.0f;
+    stats->rays += 1;
+    TraceResult tr;
+    if (g_state.sparse_world) {
+        const Vector3 inv = { g_state.ray_ix[pixel], g_state.ray_iy[pixel], g_state.ray_iz[pixel] };
+        ChunkLookups cost = { 0, 0, 0 };
+        tr = trace_ray_sparse(rig->pos, dir, inv, g_state.ray_sign[pixel], (float) SPARSE_MAX_DISTANCE, &cost);
+        stats->chunk_lookups += cost.lookups;
+        stats->chunk_probes += cost.probes;
+        if (cost.max_probe > stats->chunk_max_probe) stats->chunk_max_probe = cost.max_probe;
+    } else if (mode == PRIMARY_RASTER) {
+        tr = resolve_raster_pixel(rig, dir, x, y);
+    } else if (mode == PRIMARY_RLE) {
+        const Vector3 inv = { g_state.ray_ix[pixel], g_state.ray_iy[pixel], g_state.ray_iz[pixel] };
+        tr = trace_ray_rle(rig->pos, dir, inv, g_state.ray_sign[pixel], t_min);
+    } else if (g_state.lod_enabled) {
+        // Angular size of one pixel, for LOD footprint tests.
+        const float pixel_angle = 2.0f * rig->fov_scale / (float) IMG_H;
+        int level = 0;
+        tr = trace_ray_lod(rig->pos, dir, t_min, pixel_angle, &level);
+        stats->lod_rays[level] += 1;
+    } else {
+        const Vector3 inv = { g_state.ray_ix[pixel], g_state.ray_iy[pixel], g_state.ray_iz[pixel] };
+        tr = trace_ray_dda(rig->pos, dir, inv, g_state.ray_sign[pixel], t_min);
+    }
+
+    if (tr.entered_grid) stats->rays_entered_grid += 1;
+    if (tr.hit) stats->hits += 1;
+    stats->total_steps += tr.steps;
+    stats->steps_saved += tr.steps_skipped;
+    if (tr.steps > stats->max_steps) stats->max_steps = tr.steps;
+
+    // Keep the hit for secondary passes.
+    PrimaryHit* hit = &g_state.primary_hits[pixel];
+    hit->material = tr.hit ? tr.id : 0;
+    if (tr.hit) {
+        hit->pos = Vector3Add(rig->pos, Vector3Scale(dir, tr.t));
+        hit->cell = tr.cell;
+        hit->face = (uint8_t) normal_to_face(tr.normal);
+    }
+
+    // Store shaded color in CPU image buffer.
+    store_pixel(pixel, tr.col);
+}
+
+enum { PRIMARY_ROW_GRAIN = 2 };   // rows per pool task
+
+typedef struct {
+    const CameraRig* rig;
+    bool checker;
+    bool adaptive;
+    bool foveated;
+    int parity;
+    WorkerStats* parts;         // one per pool worker
+} PrimaryJob;
+
+// Rows [y0, y1) of the dense primary pass. Pixels are independent, so the
+// image does not depend on how rows are spread over workers.
+static void trace_primary_rows(void* ctx, int y0, int y1, int worker) {
+    const PrimaryJob* job = (const PrimaryJob*) ctx;
+    FrameStats* stats = &job->parts[worker].stats;
+    for (int y = y0; y < y1; y++) {
+        const uint8_t* tile_row = &g_state.tile_dirty[(y / TILE_SIZE) * TILES_X];
+        const uint8_t* tile_rate_row = &g_state.tile_rate[(y / TILE_SIZE) * TILES_X];
+
+        for (int x = 0; x < IMG_W; x++) {
+            if (!tile_row[x / TILE_SIZE]) continue;
+            stats->effective_rays += 1;
+            const int rate = tile_rate_row[x / TILE_SIZE];
+            if ((job->checker && ((x + y + job->parity) & 1)) || (job->adaptive && ((x | y) & 1)) || ((x | y) & (rate - 1))) continue;
+
+            trace_primary_pixel(job->rig, x, y, stats);
+            if (job->foveated) stats->fovea_rays[rate >> 1] += 1;
+        }
+    }
+}
+
+// Add one worker's primary-pass counters to the frame's.
+static void merge_primary_stats(FrameStats* dst, const FrameStats* src) {
+    dst->rays += src->rays;
+    dst->rays_entered_grid += src->rays_entered_grid;
+    dst->hits += src->hits;
+    dst->total_steps += src->total_steps;
+    dst->steps_saved += src->steps_saved;
+    if (src->max_steps > dst->max_steps) dst->max_steps = src->max_steps;
+    dst->effective_rays += src->effective_rays;
+    for (int i = 0; i < LOD_LEVELS; i++) dst->lod_rays[i] += src->lod_rays[i];
+    for (int i = 0; i < 3; i++) dst->fovea_rays[i] += src->fovea_rays[i];
+    dst->chunk_lookups += src->chunk_lookups;
+    dst->chunk_probes += src->chunk_probes;
+    if (src->chunk_max_probe > dst->chunk_max_probe) dst->chunk_max_probe = src->chunk_max_probe;
+}
+
+// Sparse-world rows: every pixel, no tile scheduling.
+static void trace_sparse_rows(void* ctx, int y0, int y1, int worker) {
+    const PrimaryJob* job = (const PrimaryJob*) ctx;
+    FrameStats* stats = &job->parts[worker].stats;
+    for (int y = y0; y < y1; y++) {
+        for (int x = 0; x < IMG_W; x++) {
+            trace_primary_pixel(job->rig, x, y, stats);
+        }
+    }
+}
+
+static inline bool samples_agree(int a, int b) {
+    const PrimaryHit* ha = &g_state.primary_hits[a];
+    const PrimaryHit* hb = &g_state.primary_hits[b];
+    if (ha->material != hb->material) return false;
+    if (ha->material != 0 && ha->face != hb->face) return false;
+    return color_distance(g_state.pixels[a], g_state.pixels[b]) <= g_state.refine_threshold;
+}
+
+// True when pixel (x, y) lies in a tile traced this frame.
+static inline bool sample_fresh(int x, int y) {
+    return g_state.tile_dirty[(y / TILE_SIZE) * TILES_X + x / TILE_SIZE] != 0;
+}
+
+// Second half of adaptive sampling. The coarse pass traced even (x, y); per
+// dirty tile, compare neighboring coarse samples (including the next ones
+// across the right and bottom edges when that tile was traced too, since a
+// clean tile's samples may predate an edit). Tiles with a discontinuity
+// trace their remaining pixels; smooth tiles fill them by bilinear
+// interpolation over the same fresh samples. Tiles run on the pool: a tile
+// writes only its own non-sample pixels and reads only coarse samples.
+static void refine_adaptive_tiles(void* ctx, int begin, int end, int worker) {
+    const PrimaryJob* job = (const PrimaryJob*) ctx;
+    const CameraRig* rig = job->rig;
+    FrameStats* stats = &job->parts[worker].stats;
+    const int last_x = (IMG_W - 1) & ~1;
+    const int last_y = (IMG_H - 1) & ~1;
+    for (int tile = begin; tile < end; tile++) {
+        if (!g_state.tile_dirty[tile]) continue;
+        const int tx = tile % TILES_X;
+        const int ty = tile / TILES_X;
+        const int x0 = tx * TILE_SIZE;
+        const int y0 = ty * TILE_SIZE;
+        const int x1 = (x0 + TILE_SIZE < IMG_W) ? x0 + TILE_SIZE : IMG_W;
+        const int y1 = (y0 + TILE_SIZE < IMG_H) ? y0 + TILE_SIZE : IMG_H;
+
+        bool smooth = true;
+        for (int y = y0; y < y1 && smooth; y += 2) {
+            for (int x = x0; x < x1 && smooth; x += 2) {
+                const int p = y * IMG_W + x;
+                if (x + 2 <= last_x && sample_fresh(x + 2, y) && !samples_agree(p, p + 2)) smooth = false;
+                if (y + 2 <= last_y && sample_fresh(x, y + 2) && !samples_agree(p, p + 2 * IMG_W)) smooth = false;
+            }
+        }
+
+        if (!smooth) {
+            stats->tiles_refined += 1;
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0 + ((y & 1) ? 0 : 1); x < x1; x += ((y & 1) ? 1 : 2)) {
+                    trace_primary_pixel(rig, x, y, stats);
+                }
+            }
+            continue;
+        }
+
+        for (int y = y0; y < y1; y++) {
+            for (int x = x0 + ((y & 1) ? 0 : 1); x < x1; x += ((y & 1) ? 1 : 2)) {
+                const int sx0 = x & ~1;
+                const int sy0 = y & ~1;
+                const int sx1 = (sx0 + 2 <= last_x && sample_fresh(sx0 + 2, sy0)) ? sx0 + 2 : sx0;
+                const int sy1 = (sy0 + 2 <= last_y && sample_fresh(sx0, sy0 + 2)) ? sy0 + 2 : sy0;
+                const int fx = (x & 1) && sx1 != sx0;
+                const int fy = (y & 1) && sy1 != sy0 && (!fx || sample_fresh(sx1, sy1));
+                const int taps[4] = {
+                    sy0 * IMG_W + sx0,
+                    sy0 * IMG_W + (fx ? sx1 : sx0),
+                    (fy ? sy1 : sy0) * IMG_W + sx0,
+                    (fy ? sy1 : sy0) * IMG_W + (fx ? sx1 : sx0),
+                };
+                int r = 0, g = 0, b = 0;
+                Vector3 pos = { 0.0f, 0.0f, 0.0f };
+                for (int k = 0; k < 4; k++) {
+                    const Color c = g_state.pixels[taps[k]];
+                    r += c.r;
+                    g += c.g;
+                    b += c.b;
+                    pos = Vector3Add(pos, g_state.primary_hits[taps[k]].pos);
+                }
+                const int pixel = y * IMG_W + x;
+                g_state.pixels[pixel] = (Color){ (unsigned char) ((r + 2) / 4), (unsigned char) ((g + 2) / 4), (unsigned char) ((b + 2) / 4), 255 };
+                g_state.primary_hits[pixel] = g_state.primary_hits[taps[0]];
+                g_state.primary_hits[pixel].pos = Vector3Scale(pos, 0.25f);
+                stats->interpolated += 1;
+            }
+        }
+    }
+}
+
+static void refine_adaptive(const CameraRig* rig, FrameStats* stats) {
+    PrimaryJob job = { rig, false, true, false, 0, worker_stats_alloc() };
+    pool_parallel_for(TILE_COUNT, TILE_GRAIN, refine_adaptive_tiles, &job);
+    for (int w = 0; w < g_pool.workers; w++) {
+        merge_primary_stats(stats, &job.parts[w].stats);
+        stats->tiles_refined += job.parts[w].stats.tiles_refined;
+        stats->interpolated += job.parts[w].stats.interpolated;
+    }
+}
+
+// Pick each tile's shading rate: full inside the fovea radius, 2x2 out to
+// twice the radius, 4x4 beyond (everything full rate when foveation is off).
+// Tiles whose rate changed are re-traced.
+static void update_foveation(bool foveated) {
+    const float r = g_state.fovea_radius;
+    for (int ty = 0; ty < TILES_Y; ty++) {
+        for (int tx = 0; tx < TILES_X; tx++) {
+            const float cx = ((float) tx + 0.5f) * (float) TILE_SIZE - g_state.fovea_center.x;
+            const float cy = ((float) ty + 0.5f) * (float) TILE_SIZE - g_state.fovea_center.y;
+            const float d = sqrtf(cx * cx + cy * cy);
+            const uint8_t rate = (!foveated || d <= r) ? 1 : (d <= 2.0f * r) ? 2 : 4;
+            const int tile = ty * TILES_X + tx;
+            if (g_state.tile_rate[tile] != rate) {
+                g_state.tile_rate[tile] = rate;
+                g_state.tile_dirty[tile] = 1;
+            }
+        }
+    }
+}
+
+// Replicate each traced block sample (its top-left pixel) over the block,
+// hit included, so secondary passes and the texture upload see full-size data.
+static void replicate_foveated(void) {
+    for (int ty = 0; ty < TILES_Y; ty++) {
+        for (int tx = 0; tx < TILES_X; tx++) {
+            const int tile = ty * TILES_X + tx;
+            const int rate = g_state.tile_rate[tile];
+            if (!g_state.tile_dirty[tile] || rate == 1) continue;
+            const int y1 = ((ty + 1) * TILE_SIZE < IMG_H) ? (ty + 1) * TILE_SIZE : IMG_H;
+            for (int y = ty * TILE_SIZE; y < y1; y++) {
+                for (int x = tx * TILE_SIZE; x < (tx + 1) * TILE_SIZE; x++) {
+                    if (((x | y) & (rate - 1)) == 0) continue;
+                    const int src = (y & ~(rate - 1)) * IMG_W + (x & ~(rate - 1));
+                    g_state.pixels[y * IMG_W + x] = g_state.pixels[src];
+                    g_state.primary_hits[y * IMG_W + x] = g_state.primary_hits[src];
+                }
+            }
+        }
+    }
+}
+
+// Sparse-world frame: stream chunks around the roaming camera and trace every
+// pixel through the chunk store. Sampling modes, prepasses and secondary
+// passes work on the dense grid only and are skipped.
+static FrameStats render_sparse_image(float dt) {
+    FrameStats stats;
+    memset(&stats, 0, sizeof(stats));
+    const double render_start = now_seconds();
+    const uint32_t allocs_before = __atomic_load_n(&g_memory.system_allocs, __ATOMIC_RELAXED);
+    const uint32_t growth_before = __atomic_load_n(&g_memory.growth_allocs, __ATOMIC_RELAXED);
+    arena_reset(&g_frame_arenas[FRAME_ARENA_RENDER]);
+
+    pool_frame_begin();
+
+    const CameraRig rig = camera_rig_roaming(g_state.time_s, g_state.freeze_camera);
+    flush_voxel_edits(&rig, &stats);
+
+    const double stream_start = now_seconds();
+    chunk_stream(rig.pos, &stats);
+    stats.stream_ms = (float) ((now_seconds() - stream_start) * 1000.0);
+
+    const double setup_start = now_seconds();
+    ray_table_update(&rig);
+    stats.ray_setup_ms = (float) ((now_seconds() - setup_start) * 1000.0);
+
+    // Chunk lookups only read the store, so rows spread over the pool as in
+    // the dense pass; each worker keeps its own lookup counters.
+    const double primary_start = now_seconds();
+    PrimaryJob job = { &rig, false, false, false, 0, worker_stats_alloc() };
+    pool_parallel_for(IMG_H, PRIMARY_ROW_GRAIN, trace_sparse_rows, &job);
+    for (int w = 0; w < g_pool.workers; w++) {
+        merge_primary_stats(&stats, &job.parts[w].stats);
+    }
+    stats.primary_ms = (float) ((now_seconds() - primary_start) * 1000.0);
+    stats.effective_rays = stats.rays;
+    stats.tiles_traced = TILE_COUNT;
+    pool_frame_stats(&stats);
+
+    // The dense path must redraw everything when it takes over again.
+    g_state.have_last_frame = false;
+    g_state.frame_index += 1;
+
+    stats.render_ms = (float) ((now_seconds() - render_start) * 1000.0);
+    if (stats.rays > 0) {
+        stats.avg_steps_per_ray = (float) stats.total_steps / (float) stats.rays;
+        stats.hit_ratio = (float) stats.hits / (float) stats.rays;
+    }
+    if (dt > 1e-6f) {
+        stats.rays_per_sec = (float) stats.rays / dt;
+        stats.steps_per_sec = (float) stats.total_steps / dt;
+    }
+    stats.system_allocs = (int) (__atomic_load_n(&g_memory.system_allocs, __ATOMIC_RELAXED) - allocs_before);
+    stats.growth_allocs = (int) (__atomic_load_n(&g_memory.growth_allocs, __ATOMIC_RELAXED) - growth_before);
+    return stats;
+}
+
+static FrameStats render_voxel_image(float dt) {
+    if (g_state.sparse_world) {
+        return render_sparse_image(dt);
+    }
+    FrameStats stats;
+    memset(&stats, 0, sizeof(stats));
+    const double render_start = now_seconds();
+    const uint32_t allocs_before = __atomic_load_n(&g_memory.system_allocs, __ATOMIC_RELAXED);
+    const uint32_t growth_before = __atomic_load_n(&g_memory.growth_allocs, __ATOMIC_RELAXED);
+    arena_reset(&g_frame_arenas[FRAME_ARENA_RENDER]);
+
+    pool_frame_begin();
+
+    const CameraRig rig = camera_rig_for_time(g_state.time_s, g_state.freeze_camera);
+    const Vector3 cam = rig.pos;
+    flush_voxel_edits(&rig, &stats);
+
+    const bool checker = (g_state.sample_mode == SAMPLE_CHECKERBOARD);
+    const bool adaptive = (g_state.sample_mode == SAMPLE_ADAPTIVE);
+    const bool foveated = (g_state.sample_mode == SAMPLE_FOVEATED);
+    const int parity = (int) (g_state.frame_index & 1);
+    update_foveation(foveated);
+    if (checker && g_state.have_last_frame) {
+        memcpy(g_state.history_pixels, g_state.pixels, sizeof(g_state.history_pixels));
+        memcpy(g_state.history_hits, g_state.primary_hits, sizeof(g_state.history_hits));
+    }
+    for (int i = 0; i < TILE_COUNT; i++) {
+        if (checker) {
+            const uint8_t fresh = g_state.tile_dirty[i];
+            g_state.tile_settled[i] = g_state.tile_pending[i] && !fresh;
+            g_state.tile_dirty[i] |= g_state.tile_pending[i];
+            g_state.tile_pending[i] = fresh;
+        }
+        stats.tiles_traced += g_state.tile_dirty[i];
+    }
+
+    const PrimaryMode mode = primary_mode_in_use();
+    if (mode == PRIMARY_RASTER) {
+        const double raster_start = now_seconds();
+        raster_prepass(&rig, &stats);
+        stats.raster_ms = (float) ((now_seconds() - raster_start) * 1000.0);
+    }
+    const bool use_beam = (mode != PRIMARY_RASTER) && g_state.beam_prepass;
+    if (use_beam) {
+        const double beam_start = now_seconds();
+        beam_prepass(&rig, &stats);
+        stats.beam_ms = (float) ((now_seconds() - beam_start) * 1000.0);
+    }
+
+    // Rotate the cached camera-space ray table for this pose.
+    const double setup_start = now_seconds();
+    ray_table_update(&rig);
+    stats.ray_setup_ms = (float) ((now_seconds() - setup_start) * 1000.0);
+
+    // Main render loop: trace one ray per output pixel, rows spread over
+    // the worker pool.
+    const double primary_start = now_seconds();
+    PrimaryJob job = { &rig, checker, adaptive, foveated, parity, worker_stats_alloc() };
+    pool_parallel_for(IMG_H, PRIMARY_ROW_GRAIN, trace_primary_rows, &job);
+    for (int w = 0; w < g_pool.workers; w++) {
+        merge_primary_stats(&stats, &job.parts[w].stats);
+    }
+
+    stats.primary_ms = (float) ((now_seconds() - primary_start) * 1000.0);
+
+    const double reconstruct_start = now_seconds();
+    if (checker) {
+        reconstruct_checkerboard(&rig, parity, &stats);
+    } else if (adaptive) {
+        refine_adaptive(&rig, &stats);
+    } else if (foveated) {
+        replicate_foveated();
+    }
+    stats.reconstruct_ms = (float) ((now_seconds() - reconstruct_start) * 1000.0);
+
+    const bool ao_rays = (g_state.ao_mode == AO_RAYS);
+    if (ao_rays) {
+        secondary_ao_pass(&stats);
+    }
+    if (g_state.shadows) {
+        const double shadow_start = now_seconds();
+        shadow_pass(&stats);
+        stats.shadow_ms = (float) ((now_seconds() - shadow_start) * 1000.0);
+    }
+    if (ao_rays || g_state.shadows) {
+        compose_secondary();
+    }
+
+    // Line-of-sight probes from the camera to the column tops, the same
+    // query gameplay code would issue for agents.
+    if (g_state.shadows) {
+        for (int i = 0; i < g_state.los_target_count; i++) {
+            stats.los_visible += voxel_line_of_sight(cam, g_state.los_targets[i]) ? 1 : 0;
+        }
+    }
+
+    g_state.last_camera = rig;
+    g_state.have_last_frame = true;
+    g_state.frame_index += 1;
+
+    // Smoothed per-mode render time for the DDA vs raster comparison.
+    stats.render_ms = (float) ((now_seconds() - render_start) * 1000.0);
+    float* mode_ms = &g_state.primary_ms[mode];
+    *mode_ms = (*mode_ms <= 0.0f) ? stats.render_ms : (*mode_ms * 0.9f + stats.render_ms * 0.1f);
+
+    if (stats.rays > 0) {
+        stats.avg_steps_per_ray = (float) stats.total_steps / (float) stats.rays;
+        stats.hit_ratio = (float) stats.hits / (float) stats.rays;
+        float* mode_steps = &g_state.primary_steps[mode];
+        *mode_steps = (*mode_steps <= 0.0f) ? stats.avg_steps_per_ray : (*mode_steps * 0.9f + stats.avg_steps_per_ray * 0.1f);
+    }
+    if (dt > 1e-6f) {
+        stats.rays_per_sec = (float) stats.rays / dt;
+        stats.steps_per_sec = (float) stats.total_steps / dt;
+    }
+    pool_frame_stats(&stats);
+    stats.system_allocs = (int) (__atomic_load_n(&g_memory.system_allocs, __ATOMIC_RELAXED) - allocs_before);
+    stats.growth_allocs = (int) (__atomic_load_n(&g_memory.growth_allocs, __ATOMIC_RELAXED) - growth_before);
+
+    return stats;
+}
+
+// -----------------------------------------------------------------------------
+// Frame-budget quality scheduler
+// -----------------------------------------------------------------------------
+// Presets from cheapest to richest. With auto quality on, each frame's
+// render time is compared against the share of the 1/TARGET_FPS deadline
+// left for tracing. Going over steps down at once (two frames in a row, or
+// one badly late frame) so the show never drops frames. Stepping up needs a
+// sustained run of frames well under budget, and the measured cost of the
+// next level must fit too. That gap is the hysteresis that keeps the
+// scheduler from oscillating. A level's cost is a running average of its
+// full-frame render times (partial frames after edits say little about the
+// next camera move); a level that has not run yet is estimated from the
+// current one, scaled by the ratio of their nominal pass costs.
+
+typedef struct {
+    const char* name;
+    SampleMode sampling;
+    AoMode ao;
+    bool shadows;
+    float relative_cost;    // nominal pass cost, full/baked AO = 1, rounded up
+} QualityLevel;
+
+static const QualityLevel QUALITY_LEVELS[QUALITY_LEVEL_COUNT] = {
+    { "foveated, height AO", SAMPLE_FOVEATED, AO_HEIGHT, false, 0.4f },
+    { "adaptive, baked AO", SAMPLE_ADAPTIVE, AO_BAKED, false, 0.7f },
+    { "full, baked AO", SAMPLE_FULL, AO_BAKED, false, 1.0f },
+    { "full, baked AO, shadows", SAMPLE_FULL, AO_BAKED, true, 1.7f },
+    { "full, traced AO, shadows", SAMPLE_FULL, AO_RAYS, true, 4.2f },
+};
+
+static const float QUALITY_BUDGET_SHARE = 0.75f;    // rest is upload, overlay, present
+static const float QUALITY_DOWN_LATE = 1.5f;        // this late steps down immediately
+static const float QUALITY_UP_HEADROOM = 0.6f;      // frames must stay under this share...
+static const int QUALITY_UP_FRAMES = 30;            // ...for this many frames
+static const float QUALITY_UP_FIT = 0.85f;          // and the next level must fit this share
+
+// Matches the interactive defaults (full sampling, baked AO, no shadows).
+enum { QUALITY_DEFAULT_LEVEL = 2 };
+
+static inline float quality_budget_ms(void) {
+    return 1000.0f / (float) TARGET_FPS * QUALITY_BUDGET_SHARE;
+}
+
+static void apply_quality_level(int level) {
+    const QualityLevel* q = &QUALITY_LEVELS[level];
+    g_state.quality_level = level;
+    g_state.sample_mode = q->sampling;
+    g_state.ao_mode = q->ao;
+    g_state.shadows = q->shadows;
+    // Every tile must be redrawn at the new level; a still screen catches
+    // up over a few frames.
+    g_state.quality_refresh_tile = 0;
+    g_state.quality_over_frames = 0;
+    g_state.quality_headroom_frames = 0;
+}
+
+// Account the frame just rendered and pick the level for the next one.
+static void quality_schedule(FrameStats* st) {
+    const int level = g_state.quality_level;
+    st->quality_level = level;
+    if (g_state.quality_log_file) {
+        fprintf(g_state.quality_log_file, "%u,%d,%d,%.3f,%.3f,%.3f,%.3f,%.3f\n", g_state.frame_index - 1, level, g_state.auto_quality ? 1 : 0,
+            st->render_ms, st->primary_ms, st->shadow_ms, st->secondary_sort_ms + st->secondary_trace_ms, st->reconstruct_ms);
+    }
+    if (!g_state.auto_quality) return;
+
+    g_state.quality_log[g_state.quality_log_count % QUALITY_LOG_SIZE] = (uint8_t) level;
+    g_state.quality_log_count += 1;
+    const float budget = quality_budget_ms();
+    float* cost = &g_state.quality_cost_ms[level];
+    if (st->tiles_traced == TILE_COUNT) {
+        *cost = (*cost <= 0.0f) ? st->render_ms : (*cost * 0.8f + st->render_ms * 0.2f);
+    }
+
+    g_state.quality_over_frames = (st->render_ms > budget) ? g_state.quality_over_frames + 1 : 0;
+    g_state.quality_headroom_frames = (st->render_ms < budget * QUALITY_UP_HEADROOM) ? g_state.quality_headroom_frames + 1 : 0;
+
+    if (level > 0 && (g_state.quality_over_frames >= 2 || st->render_ms > budget * QUALITY_DOWN_LATE)) {
+        apply_quality_level(level - 1);
+    } else if (level + 1 < QUALITY_LEVEL_COUNT && g_state.quality_headroom_frames >= QUALITY_UP_FRAMES) {
+        float next = g_state.quality_cost_ms[level + 1];
+        if (next <= 0.0f) {
+            next = ((*cost > 0.0f) ? *cost : st->render_ms) * QUALITY_LEVELS[level + 1].relative_cost / QUALITY_LEVELS[level].relative_cost;
+        }
+        if (next < budget * QUALITY_UP_FIT) {
+            apply_quality_level(level + 1);
+        } else {
+            g_state.quality_headroom_frames = 0;
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Frame output
+// -----------------------------------------------------------------------------
+// Finished frames can be written as a numbered PPM/PNG sequence or streamed
+// as Y4M to stdout for an encoder. The tracer only copies the frame into a
+// bounded queue; conversion and writes happen on a background I/O thread.
+// Every target is a recording, so by default when the queue is full the
+// tracer waits for a slot (and counts the wait) instead of dropping the
+// frame. --output-drop keeps the tracer from ever waiting on the disk: a
+// frame that finds the queue full is dropped and counted instead. The
+// shared-memory ring below serves live readers and overwrites old frames.
+
+enum { OUTPUT_QUEUE_DEPTH = 8, OUTPUT_PATH_LEN = 512 };
+
+typedef enum {
+    OUTPUT_NONE = 0,
+    OUTPUT_PPM,
+    OUTPUT_PNG,
+    OUTPUT_Y4M,
+} OutputFormat;
+
+typedef struct {
+    OutputFormat format;
+    char pattern[OUTPUT_PATH_LEN];  // printf pattern taking the frame number
+    Color frames[OUTPUT_QUEUE_DEPTH][IMG_W * IMG_H];
+    int frame_no[OUTPUT_QUEUE_DEPTH];
+    int head;
+    int count;
+    int written;
+    int waits;          // submissions that found the queue full
+    int dropped;        // of those, frames not queued (drop_when_full)
+    int failed;
+    bool drop_when_full;
+    bool stop;
+#if defined(VOXEL_HAVE_PTHREADS)
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t space;
+#endif
+} FrameOutput;
+
+static FrameOutput g_output;
+
+static bool write_ppm(const char* path, const Color* px) {
+    uint8_t* rgb = (uint8_t*) arena_try_alloc(&g_frame_arenas[FRAME_ARENA_IO], IMG_W * IMG_H * 3);
+    if (!rgb) return false;
+    FILE* f = fopen(path, "wb");
+    if (!f) return false;
+    for (int i = 0; i < IMG_W * IMG_H; i++) {
+        rgb[i * 3 + 0] = px[i].r;
+        rgb[i * 3 + 1] = px[i].g;
+        rgb[i * 3 + 2] = px[i].b;
+    }
+    fprintf(f, "P6\n%d %d\n255\n", IMG_W, IMG_H);
+    const bool ok = fwrite(rgb, IMG_W * IMG_H * 3, 1, f) == 1;
+    return (fclose(f) == 0) && ok;
+}
+
+// Full-range BT.601 4:2:0 frame (C420jpeg), chroma averaged over 2x2 blocks.
+static bool write_y4m_frame(FILE* f, const Color* px) {
+    enum { Y_BYTES = IMG_W * IMG_H, C_BYTES = (IMG_W / 2) * (IMG_H / 2) };
+    FrameArena* arena = &g_frame_arenas[FRAME_ARENA_IO];
+    uint8_t* y_plane = (uint8_t*) arena_try_alloc(arena, Y_BYTES);
+    uint8_t* u_plane = (uint8_t*) arena_try_alloc(arena, C_BYTES);
+    uint8_t* v_plane = (uint8_t*) arena_try_alloc(arena, C_BYTES);
+    if (!y_plane || !u_plane || !v_plane) return false;
+    for (int i = 0; i < IMG_W * IMG_H; i++) {
+        y_plane[i] = (uint8_t) clamp_i32((int) lroundf(0.299f * px[i].r + 0.587f * px[i].g + 0.114f * px[i].b), 0, 255);
+    }
+    for (int y = 0; y < IMG_H / 2; y++) {
+        for (int x = 0; x < IMG_W / 2; x++) {
+            float r = 0.0f, g = 0.0f, b = 0.0f;
+            for (int k = 0; k < 4; k++) {
+                const Color c = px[(y * 2 + (k >> 1)) * IMG_W + x * 2 + (k & 1)];
+                r += 0.25f * (float) c.r;
+                g += 0.25f * (float) c.g;
+                b += 0.25f * (float) c.b;
+            }
+            u_plane[y * (IMG_W / 2) + x] = (uint8_t) clamp_i32((int) lroundf(128.0f - 0.168736f * r - 0.331264f * g + 0.5f * b), 0, 255);
+            v_plane[y * (IMG_W / 2) + x] = (uint8_t) clamp_i32((int) lroundf(128.0f + 0.5f * r - 0.418688f * g - 0.081312f * b), 0, 255);
+        }
+    }
+    fputs("FRAME\n", f);
+    const bool ok = fwrite(y_plane, Y_BYTES, 1, f) == 1
+                 && fwrite(u_plane, C_BYTES, 1, f) == 1
+                 && fwrite(v_plane, C_BYTES, 1, f) == 1;
+    return (fflush(f) == 0) && ok;
+}
+
+static bool output_write_frame(const Color* px, int frame_no) {
+    arena_reset(&g_frame_arenas[FRAME_ARENA_IO]);
+    if (g_output.format == OUTPUT_Y4M) {
+        return write_y4m_frame(stdout, px);
+    }
+    char path[OUTPUT_PATH_LEN + 32];
+    snprintf(path, sizeof(path), g_output.pattern, frame_no);
+    if (g_output.format == OUTPUT_PNG) {
+        // Exempt from the no-allocation rule: raylib's encoder mallocs its
+        // deflate buffers on this thread. Use y4m where that matters.
+        const Image img = { (void*) px, IMG_W, IMG_H, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 };
+        return ExportImage(img, path);
+    }
+    return write_ppm(path, px);
+}
+
+#if defined(VOXEL_HAVE_PTHREADS)
+static void* output_thread_main(void* arg) {
+    (void) arg;
+    pthread_mutex_lock(&g_output.lock);
+    for (;;) {
+        while (g_output.count == 0 && !g_output.stop) {
+            pthread_cond_wait(&g_output.wake, &g_output.lock);
+        }
+        if (g_output.count == 0) break;
+
+        // The slot stays owned by the queue until written, so the producer
+        // never reuses it mid-write.
+        const int slot = g_output.head;
+        pthread_mutex_unlock(&g_output.lock);
+        const bool ok = output_write_frame(g_output.frames[slot], g_output.frame_no[slot]);
+        pthread_mutex_lock(&g_output.lock);
+
+        g_output.head = (g_output.head + 1) % OUTPUT_QUEUE_DEPTH;
+        g_output.count -= 1;
+        pthread_cond_signal(&g_output.space);
+        if (ok) {
+            g_output.written += 1;
+        } else {
+            g_output.failed += 1;
+        }
+    }
+    pthread_mutex_unlock(&g_output.lock);
+    return NULL;
+}
+#endif
+
+// A frame pattern takes exactly one integer conversion, `%d` with an
+// optional 0 flag and width; `%%` stands for a literal percent sign.
+static bool output_pattern_valid(const char* pattern) {
+    int conversions = 0;
+    for (const char* p = pattern; *p; p++) {
+        if (*p != '%') continue;
+        p++;
+        if (*p == '%') continue;
+        if (*p == '0') p++;
+        while (*p >= '0' && *p <= '9') p++;
+        if (*p != 'd') return false;
+        conversions += 1;
+    }
+    return conversions == 1;
+}
+
+// `target` is "-" for Y4M on stdout, otherwise a printf pattern such as
+// "frames/%04d.png"; the extension picks PNG, anything else writes PPM.
+// With `drop_when_full` a full queue drops frames instead of blocking.
+VOXEL_MAYBE_UNUSED static bool output_open(const char* target, bool drop_when_full) {
+    memset(&g_output, 0, sizeof(g_output));
+    if (strcmp(target, "-") != 0 && !output_pattern_valid(target)) {
+        fprintf(stderr, "--output: expected - or a pattern with one %%d frame number (e.g. frames/%%04d.png), got '%s'\n", target);
+        return false;
+    }
+    g_output.drop_when_full = drop_when_full;
+    if (strcmp(target, "-") == 0) {
+        g_output.format = OUTPUT_Y4M;
+        printf("YUV4MPEG2 W%d H%d F60:1 Ip A1:1 C420jpeg\n", IMG_W, IMG_H);
+    } else {
+        const char* ext = strrchr(target, '.');
+        g_output.format = (ext && strcmp(ext, ".png") == 0) ? OUTPUT_PNG : OUTPUT_PPM;
+        snprintf(g_output.pattern, sizeof(g_output.pattern), "%s", target);
+    }
+#if defined(VOXEL_HAVE_PTHREADS)
+    pthread_mutex_init(&g_output.lock, NULL);
+    pthread_cond_init(&g_output.wake, NULL);
+    pthread_cond_init(&g_output.space, NULL);
+    if (pthread_create(&g_output.thread, NULL, output_thread_main, NULL) != 0) {
+        fprintf(stderr, "output: cannot start I/O thread\n");
+        g_output.format = OUTPUT_NONE;
+        return false;
+    }
+#endif
+    return true;
+}
+
+// Queue the current frame; blocks only while the queue is full, unless
+// full-queue frames are dropped.
+static void output_submit(const Color* px, int frame_no) {
+    if (g_output.format == OUTPUT_NONE) return;
+#if defined(VOXEL_HAVE_PTHREADS)
+    pthread_mutex_lock(&g_output.lock);
+    if (g_output.count == OUTPUT_QUEUE_DEPTH) g_output.waits += 1;
+    if (g_output.count == OUTPUT_QUEUE_DEPTH && g_output.drop_when_full) {
+        g_output.dropped += 1;
+        pthread_mutex_unlock(&g_output.lock);
+        return;
+    }
+    while (g_output.count == OUTPUT_QUEUE_DEPTH) {
+        pthread_cond_wait(&g_output.space, &g_output.lock);
+    }
+    const int slot = (g_output.head + g_output.count) % OUTPUT_QUEUE_DEPTH;
+    memcpy(g_output.frames[slot], px, sizeof(g_output.frames[slot]));
+    g_output.frame_no[slot] = frame_no;
+    g_output.count += 1;
+    pthread_cond_signal(&g_output.wake);
+    pthread_mutex_unlock(&g_output.lock);
+#else
+    // No threads available: write synchronously.
+    if (output_write_frame(px, frame_no)) {
+        g_output.written += 1;
+    } else {
+        g_output.failed += 1;
+    }
+#endif
+}
+
+// Drain the queue, stop the I/O thread and report.
+static void output_close(void) {
+    if (g_output.format == OUTPUT_NONE) return;
+#if defined(VOXEL_HAVE_PTHREADS)
+    pthread_mutex_lock(&g_output.lock);
+    g_output.stop = true;
+    pthread_cond_signal(&g_output.wake);
+    pthread_mutex_unlock(&g_output.lock);
+    pthread_join(g_output.thread, NULL);
+    pthread_cond_destroy(&g_output.wake);
+    pthread_cond_destroy(&g_output.space);
+    pthread_mutex_destroy(&g_output.lock);
+#endif
+    fprintf(stderr, "output: %d frames written, %d failed, queue full %d times, %d frames dropped\n", g_output.written, g_output.failed, g_output.waits, g_output.dropped);
+    g_output.format = OUTPUT_NONE;
+}
+
+// -----------------------------------------------------------------------------
+// Parallel jobs
+// -----------------------------------------------------------------------------
+// Bulk work outside the frame (world generation, snapshots): `threads` copies
+// of the same worker run on the worker pool, each claiming work items from
+// an atomic cursor in its job until none are left.
+
+// Pool workers, capped by the number of work items.
+static int parallel_threads(int items) {
+    return (g_pool.workers < items) ? g_pool.workers : (items > 0 ? items : 1);
+}
+
+typedef struct {
+    void* (*worker)(void*);
+    void* job;
+} ParallelRun;
+
+static void parallel_run_range(void* ctx, int begin, int end, int worker) {
+    const ParallelRun* run = (const ParallelRun*) ctx;
+    (void) worker;
+    for (int i = begin; i < end; i++) run->worker(run->job);
+}
+
+// Run `worker(job)` `threads` times on the calling thread and the pool.
+static void parallel_run(void* (*worker)(void*), void* job, int threads) {
+    ParallelRun run = { worker, job };
+    pool_parallel_for(threads, 1, parallel_run_range, &run);
+}
+
+// -----------------------------------------------------------------------------
+// Procedural world
+// -----------------------------------------------------------------------------
+// `--world procedural [--seed N]` (N in the window: next seed) fills the
+// voxel store from a seed instead of build_scene. Terrain is four octaves of
+// value noise, stone under a grass layer, with lakes up to a water level.
+// Caves are tubes where two 3D noise fields are both near their midpoint,
+// and a tower may stand in each CHUNK_SIZE^2 cell. Every voxel is a pure
+// function of the seed and its coordinates, so the result does not depend
+// on the thread count. Workers claim CHUNK_SIZE-wide, full-height column
+// chunks; the cave fields are sampled every WORLD_CAVE_STEP voxels per chunk
+// and interpolated. Grid size is the VOXEL_GRID_X/Y/Z build setting: every
+// derived table (bricks, LOD, mesh slices) is sized from it at compile time,
+// so there is no run-time --world-size.
+
+enum {
+    WORLD_DEFAULT_SEED = 1,
+    WORLD_STONE = 1,
+    WORLD_BRICK = 2,
+    WORLD_GRASS = 3,
+    WORLD_WATER = 4,
+    WORLD_TERRAIN_OCTAVES = 4,
+    WORLD_TERRAIN_SHIFT = 6,    // coarsest octave: 64 voxels
+    WORLD_CAVE_SHIFT = 4,       // 16-voxel cave noise
+    WORLD_CAVE_STEP = 4,
+    WORLD_CAVE_XZ = CHUNK_SIZE / WORLD_CAVE_STEP + 1,
+    WORLD_CAVE_Y = (GRID_Y + WORLD_CAVE_STEP - 1) / WORLD_CAVE_STEP + 1,
+};
+
+static const float WORLD_CAVE_BAND = 0.07f;     // tube where both |field - 0.5| < this
+
+static char g_world_status[160];
+
+static inline uint32_t world_hash(uint32_t seed, int x, int y, int z) {
+    uint32_t h = seed * 0x9e3779b1u + (uint32_t) x * 0x85ebca6bu + (uint32_t) y * 0xc2b2ae35u + (uint32_t) z * 0x27d4eb2fu;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return h;
+}
+
+static inline float world_unit(uint32_t h) {
+    return (float) (h >> 8) * (1.0f / 16777216.0f);
+}
+
+// Smoothstep weight of the position `v` inside its 2^shift lattice cell.
+static inline float world_fade(int v, int shift) {
+    const float t = (float) (v & ((1 << shift) - 1)) / (float) (1 << shift);
+    return t * t * (3.0f - 2.0f * t);
+}
+
+// Value noise in [0, 1) on a 2^shift lattice in x and z.
+static float world_noise2(uint32_t seed, int x, int z, int shift) {
+    const int cx = floor_shift(x, shift), cz = floor_shift(z, shift);
+    const float fx = world_fade(x, shift), fz = world_fade(z, shift);
+    const float a = Lerp(world_unit(world_hash(seed, cx, 0, cz)), world_unit(world_hash(seed, cx + 1, 0, cz)), fx);
+    const float b = Lerp(world_unit(world_hash(seed, cx, 0, cz + 1)), world_unit(world_hash(seed, cx + 1, 0, cz + 1)), fx);
+    return Lerp(a, b, fz);
+}
+
+// Value noise in [0, 1) on a 2^shift lattice in all three axes.
+static float world_noise3(uint32_t seed, int x, int y, int z, int shift) {
+    const int cx = floor_shift(x, shift), cy = floor_shift(y, shift), cz = floor_shift(z, shift);
+    const float fx = world_fade(x, shift), fy = world_fade(y, shift), fz = world_fade(z, shift);
+    float plane[2];
+    for (int k = 0; k < 2; k++) {
+        const float a = Lerp(world_unit(world_hash(seed, cx, cy, cz + k)), world_unit(world_hash(seed, cx + 1, cy, cz + k)), fx);
+        const float b = Lerp(world_unit(world_hash(seed, cx, cy + 1, cz + k)), world_unit(world_hash(seed, cx + 1, cy + 1, cz + k)), fx);
+        plane[k] = Lerp(a, b, fy);
+    }
+    return Lerp(plane[0], plane[1], fz);
+}
+
+// Solid cells of column (x, z): y in [0, height).
+static int world_height(uint32_t seed, int x, int z) {
+    float n = 0.0f, amp = 0.5f, total = 0.0f;
+    for (int o = 0; o < WORLD_TERRAIN_OCTAVES; o++) {
+        n += amp * world_noise2(seed + (uint32_t) o, x, z, WORLD_TERRAIN_SHIFT - o);
+        total += amp;
+        amp *= 0.5f;
+    }
+    // Octave sums bunch up around 0.5; stretch them back out.
+    const float t = Clamp((n / total - 0.5f) * 1.8f + 0.5f, 0.0f, 1.0f);
+    return clamp_i32((int) ((float) GRID_Y * (0.1f + 0.45f * t)), 1, GRID_Y);
+}
+
+static inline int world_water_level(void) {
+    return (int) ((float) GRID_Y * 0.2f);
+}
+
+// Tower of cell (cx, cz), if it has one: a brick box standing on the
+// terrain under its corner, kept clear of the cell's edges.
+static bool world_tower(uint32_t seed, int cx, int cz, VoxelBox* tower) {
+    const uint32_t h = world_hash(seed ^ 0x5bd1e995u, cx, 1, cz);
+    if (h % 4u != 0u) return false;
+    const int w = 2 + (int) ((h >> 4) % 3u);
+    tower->lo.x = cx * CHUNK_SIZE + 2 + (int) ((h >> 8) % (unsigned) (CHUNK_SIZE - w - 3));
+    tower->lo.z = cz * CHUNK_SIZE + 2 + (int) ((h >> 14) % (unsigned) (CHUNK_SIZE - w - 3));
+    tower->lo.y = world_height(seed, tower->lo.x, tower->lo.z);
+    if (tower->lo.y <= world_water_level()) return false;
+    tower->hi.x = tower->lo.x + w - 1;
+    tower->hi.z = tower->lo.z + w - 1;
+    tower->hi.y = tower->lo.y + 2 + (int) ((h >> 20) % (unsigned) (GRID_Y / 4 + 1));
+    return true;
+}
+
+// Shared by the generator threads; chunks are claimed through `next`.
+typedef struct {
+    uint32_t seed;
+    int chunks_x;
+    int chunk_count;
+    int next;
+    uint64_t solid;
+} WorldGenJob;
+
+// Fill the full-height column chunk (cx, cz); returns its solid voxels.
+static uint64_t world_generate_chunk(uint32_t seed, int cx, int cz) {
+    const int x0 = cx * CHUNK_SIZE, z0 = cz * CHUNK_SIZE;
+    const int nx = (x0 + CHUNK_SIZE <= GRID_X) ? CHUNK_SIZE : GRID_X - x0;
+    const int nz = (z0 + CHUNK_SIZE <= GRID_Z) ? CHUNK_SIZE : GRID_Z - z0;
+    const int water = world_water_level();
+    int height[CHUNK_SIZE][CHUNK_SIZE];
+    for (int z = 0; z < nz; z++) {
+        for (int x = 0; x < nx; x++) height[z][x] = world_height(seed, x0 + x, z0 + z);
+    }
+    float cave[2][WORLD_CAVE_XZ][WORLD_CAVE_Y][WORLD_CAVE_XZ];
+    for (int f = 0; f < 2; f++) {
+        for (int k = 0; k < WORLD_CAVE_XZ; k++) {
+            for (int j = 0; j < WORLD_CAVE_Y; j++) {
+                for (int i = 0; i < WORLD_CAVE_XZ; i++) {
+                    cave[f][k][j][i] = world_noise3(seed + 0x68e31da4u * (uint32_t) (f + 1), x0 + i * WORLD_CAVE_STEP, j * WORLD_CAVE_STEP, z0 + k * WORLD_CAVE_STEP, WORLD_CAVE_SHIFT);
+                }
+            }
+        }
+    }
+    VoxelBox tower = { 0 };
+    const bool has_tower = world_tower(seed, cx, cz, &tower);
+
+    uint64_t solid = 0;
+    const float inv_step = 1.0f / (float) WORLD_CAVE_STEP;
+    for (int z = 0; z < nz; z++) {
+        const int k = z / WORLD_CAVE_STEP;
+        const float fz = (float) (z % WORLD_CAVE_STEP) * inv_step;
+        for (int y = 0; y < GRID_Y; y++) {
+            const int j = y / WORLD_CAVE_STEP;
+            const float fy = (float) (y % WORLD_CAVE_STEP) * inv_step;
+            uint8_t* row = &g_state.voxels[voxel_index(x0, y, z0 + z)];
+            for (int x = 0; x < nx; x++) {
+                const int h = height[z][x];
+                uint8_t v = 0;
+                if (y < h) {
+                    v = (y == h - 1 && h > water) ? WORLD_GRASS : WORLD_STONE;
+                    if (y >= 1 && y < h - 1) {
+                        const int i = x / WORLD_CAVE_STEP;
+                        const float fx = (float) (x % WORLD_CAVE_STEP) * inv_step;
+                        bool tube = true;
+                        for (int f = 0; f < 2 && tube; f++) {
+                            const float c00 = Lerp(cave[f][k][j][i], cave[f][k][j][i + 1], fx);
+                            const float c01 = Lerp(cave[f][k][j + 1][i], cave[f][k][j + 1][i + 1], fx);
+                            const float c10 = Lerp(cave[f][k + 1][j][i], cave[f][k + 1][j][i + 1], fx);
+                            const float c11 = Lerp(cave[f][k + 1][j + 1][i], cave[f][k + 1][j + 1][i + 1], fx);
+                            tube = fabsf(Lerp(Lerp(c00, c01, fy), Lerp(c10, c11, fy), fz) - 0.5f) < WORLD_CAVE_BAND;
+                        }
+                        if (tube) v = 0;
+                    }
+                } else if (y < water) {
+                    v = WORLD_WATER;
+                }
+                if (has_tower && y >= tower.lo.y && y <= tower.hi.y && x0 + x >= tower.lo.x && x0 + x <= tower.hi.x
+                    && z0 + z >= tower.lo.z && z0 + z <= tower.hi.z) {
+                    v = WORLD_BRICK;
+                }
+                row[x] = v;
+                solid += (v != 0);
+            }
+        }
+    }
+    return solid;
+}
+
+static void* world_gen_worker(void* arg) {
+    WorldGenJob* job = (WorldGenJob*) arg;
+    uint64_t solid = 0;
+    for (;;) {
+        const int c = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (c >= job->chunk_count) break;
+        solid += world_generate_chunk(job->seed, c % job->chunks_x, c / job->chunks_x);
+    }
+    __atomic_fetch_add(&job->solid, solid, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+// Regenerate the whole grid from `seed` on the worker pool.
+static void world_generate(uint32_t seed) {
+    const double start = now_seconds();
+    const int chunks_x = (GRID_X + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    const int chunks_z = (GRID_Z + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    WorldGenJob job = { seed, chunks_x, chunks_x * chunks_z, 0, 0 };
+    const int threads = parallel_threads(job.chunk_count);
+    parallel_run(world_gen_worker, &job, threads);
+    const double s = now_seconds() - start;
+    snprintf(g_world_status, sizeof(g_world_status), "procedural, seed %u, %.1f%% solid | generated in %.1f ms on %d threads (%.0f Mvoxels/s)",
+        seed, 100.0 * (double) job.solid / (double) GRID_SIZE, s * 1000.0, threads, (s > 0.0) ? (double) GRID_SIZE / s * 1e-6 : 0.0);
+
+    // The first towers in chunk order are the line-of-sight targets.
+    g_state.los_target_count = 0;
+    for (int c = 0; c < job.chunk_count && g_state.los_target_count < LOS_TARGET_MAX; c++) {
+        VoxelBox tower = { 0 };
+        if (world_tower(seed, c % chunks_x, c / chunks_x, &tower)) los_target_add(&tower);
+    }
+
+    // Whole grid changed: derived data and the screen rebuild on next flush,
+    // the chunk store on the next sparse frame.
+    chunk_store_clear();
+    g_state.dirty_count = 0;
+    mark_dirty((VoxelBox){ { 0, 0, 0 }, { GRID_X - 1, GRID_Y - 1, GRID_Z - 1 } });
+}
+
+// -----------------------------------------------------------------------------
+// World snapshots
+// -----------------------------------------------------------------------------
+// `--save-snapshot FILE` / `--load-snapshot FILE` (F5 / F9 in the window)
+// write and restore the voxel store, edits included. The store is cut into
+// SNAPSHOT_BLOCK-byte blocks that are compressed independently, on every
+// CPU, with a small LZ77 codec in the style of LZ4:
+// byte-aligned sequences of literals plus one match from a 64 KB window.
+// Every block carries a hash of its raw bytes that is checked on load, so a
+// snapshot either restores the grid bit for bit or is rejected. Fields are
+// in native byte order.
+
+#define SNAPSHOT_MAGIC 0x4e535856u  // "VXSN"
+#define SNAPSHOT_VERSION 1u
+
+enum {
+    SNAPSHOT_BLOCK = 64 * 1024,
+    SNAPSHOT_STORED = 1,    // block flag: raw copy, compression did not pay
+    LZ_HASH_BITS = 12,
+    LZ_MIN_MATCH = 4,
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t grid[3];       // GRID_X, GRID_Y, GRID_Z of the saved store
+    uint32_t block_bytes;
+    uint32_t block_count;
+    uint32_t reserved;
+    uint64_t raw_bytes;
+} SnapshotHeader;
+
+typedef struct {
+    uint32_t size;          // payload bytes
+    uint32_t flags;
+    uint64_t hash;          // snapshot_hash of the raw block
+} SnapshotBlock;
+
+// Timing of the last pack or unpack.
+typedef struct {
+    size_t raw_bytes;
+    size_t packed_bytes;
+    int threads;
+    double codec_s;         // parallel (de)compression and hashing
+} SnapshotStats;
+
+static char g_snapshot_status[OUTPUT_PATH_LEN + 96];
+
+// Multiply-xorshift over 8-byte words: catches damage, not tampering.
+static uint64_t snapshot_hash(const uint8_t* p, size_t n) {
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ (uint64_t) n;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+    }
+    for (; i < n; i++) h = (h ^ p[i]) * 0x100000001b3ull;
+    return h ^ (h >> 29);
+}
+
+static inline uint32_t lz_read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+// Largest output of lz_compress for `n` input bytes.
+static inline size_t lz_bound(size_t n) {
+    return n + n / 255 + 16;
+}
+
+static inline uint8_t* lz_put_length(uint8_t* op, size_t len) {
+    for (; len >= 255; len -= 255) *op++ = 255;
+    *op++ = (uint8_t) len;
+    return op;
+}
+
+// Bytes shared by `a` and `b`, up to `end` (the end of `a`'s buffer).
+static inline size_t lz_match_length(const uint8_t* a, const uint8_t* b, const uint8_t* end) {
+    const uint8_t* start = a;
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (a + 8 <= end) {
+        uint64_t x, y;
+        memcpy(&x, a, 8);
+        memcpy(&y, b, 8);
+        if (x != y) return (size_t) (a - start) + (size_t) (__builtin_ctzll(x ^ y) >> 3);
+        a += 8;
+        b += 8;
+    }
+#endif
+    while (a < end && *a == *b) {
+        a++;
+        b++;
+    }
+    return (size_t) (a - start);
+}
+
+// Compress `n` <= SNAPSHOT_BLOCK bytes into `dst` (lz_bound(n) bytes);
+// returns the compressed size. Each sequence is a token (literal count in
+// the high nibble, match length - 4 in the low one, 15 = more length bytes
+// follow), the literals, a 2-byte match offset and the extra length bytes.
+// The last sequence stops after its literals.
+static size_t lz_compress(const uint8_t* src, size_t n, uint8_t* dst) {
+    uint16_t table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+    const uint8_t* ip = src;
+    const uint8_t* anchor = src;
+    const uint8_t* end = src + n;
+    uint8_t* op = dst;
+
+    while (n >= LZ_MIN_MATCH && ip <= end - LZ_MIN_MATCH) {
+        const uint32_t seq = lz_read32(ip);
+        const uint32_t h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+        const uint8_t* ref = src + table[h];
+        table[h] = (uint16_t) (ip - src);
+        if (ref >= ip || lz_read32(ref) != seq) {
+            // Step faster through data that keeps missing.
+            ip += 1 + ((size_t) (ip - anchor) >> 6);
+            continue;
+        }
+
+        const size_t lit = (size_t) (ip - anchor);
+        const size_t len = LZ_MIN_MATCH + lz_match_length(ip + LZ_MIN_MATCH, ref + LZ_MIN_MATCH, end);
+        const size_t offset = (size_t) (ip - ref);
+        uint8_t* token = op++;
+        *token = (uint8_t) (((lit >= 15) ? 15 : lit) << 4 | ((len - LZ_MIN_MATCH >= 15) ? 15 : len - LZ_MIN_MATCH));
+        if (lit >= 15) op = lz_put_length(op, lit - 15);
+        memcpy(op, anchor, lit);
+        op += lit;
+        *op++ = (uint8_t) (offset & 0xff);
+        *op++ = (uint8_t) (offset >> 8);
+        if (len - LZ_MIN_MATCH >= 15) op = lz_put_length(op, len - LZ_MIN_MATCH - 15);
+        ip += len;
+        anchor = ip;
+    }
+
+    const size_t lit = (size_t) (end - anchor);
+    if (lit > 0) {
+        *op++ = (uint8_t) (((lit >= 15) ? 15 : lit) << 4);
+        if (lit >= 15) op = lz_put_length(op, lit - 15);
+        memcpy(op, anchor, lit);
+        op += lit;
+    }
+    return (size_t) (op - dst);
+}
+
+static inline bool lz_get_length(const uint8_t** ip, const uint8_t* iend, size_t* len) {
+    unsigned b;
+    do {
+        if (*ip >= iend) return false;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+// Inverse of lz_compress; false unless `src` decodes to exactly `out_n`
+// bytes. Every length and offset is bounds-checked.
+static bool lz_decompress(const uint8_t* src, size_t n, uint8_t* dst, size_t out_n) {
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + n;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + out_n;
+    while (op < oend) {
+        if (ip >= iend) return false;
+        const unsigned token = *ip++;
+        size_t lit = token >> 4;
+        if (lit == 15 && !lz_get_length(&ip, iend, &lit)) return false;
+        if (lit > (size_t) (iend - ip) || lit > (size_t) (oend - op)) return false;
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+        if (op == oend) break;
+
+        if (iend - ip < 2) return false;
+        const size_t offset = (size_t) ip[0] | ((size_t) ip[1] << 8);
+        ip += 2;
+        size_t len = token & 15;
+        if (len == 15 && !lz_get_length(&ip, iend, &len)) return false;
+        len += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t) (op - dst) || len > (size_t) (oend - op)) return false;
+
+        // Overlapping matches repeat the last `offset` bytes.
+        const uint8_t* ref = op - offset;
+        if (offset == 1) {
+            memset(op, *ref, len);
+            op += len;
+        } else {
+            while (len > 0) {
+                const size_t k = (len < offset) ? len : offset;
+                memcpy(op, ref, k);
+                op += k;
+                ref += k;
+                len -= k;
+            }
+        }
+    }
+    return ip == iend;
+}
+
+// Shared by the worker threads; blocks are claimed through `next`.
+typedef struct {
+    uint8_t* raw;
+    size_t raw_bytes;
+    uint8_t* packed;
+    const size_t* offset;   // payload of block b at packed + offset[b]
+    SnapshotBlock* blocks;
+    int block_count;
+    bool decode;
+    int next;
+    int failed;
+} SnapshotJob;
+
+static void* snapshot_worker(void* arg) {
+    SnapshotJob* job = (SnapshotJob*) arg;
+    for (;;) {
+        const int b = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (b >= job->block_count) break;
+        uint8_t* raw = job->raw + (size_t) b * SNAPSHOT_BLOCK;
+        const size_t raw_n = (b == job->block_count - 1) ? job->raw_bytes - (size_t) b * SNAPSHOT_BLOCK : SNAPSHOT_BLOCK;
+        uint8_t* payload = job->packed + job->offset[b];
+        SnapshotBlock* blk = &job->blocks[b];
+        if (!job->decode) {
+            blk->hash = snapshot_hash(raw, raw_n);
+            blk->size = (uint32_t) lz_compress(raw, raw_n, payload);
+            blk->flags = 0;
+            if (blk->size >= raw_n) {
+                memcpy(payload, raw, raw_n);
+                blk->size = (uint32_t) raw_n;
+                blk->flags = SNAPSHOT_STORED;
+            }
+            continue;
+        }
+        bool ok;
+        if (blk->flags & SNAPSHOT_STORED) {
+            ok = (blk->size == raw_n);
+            if (ok) memcpy(raw, payload, raw_n);
+        } else {
+            ok = lz_decompress(payload, blk->size, raw, raw_n);
+        }
+        if (!ok || snapshot_hash(raw, raw_n) != blk->hash) {
+            __atomic_fetch_add(&job->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+// Compress `raw` into a complete snapshot image (header, block table,
+// payloads) in a new malloc'd buffer. `threads` <= 0 picks one per CPU.
+static uint8_t* snapshot_pack(const uint8_t* raw, size_t raw_bytes, int threads, SnapshotStats* stats) {
+    const int block_count = (int) ((raw_bytes + SNAPSHOT_BLOCK - 1) / SNAPSHOT_BLOCK);
+    const size_t table_bytes = sizeof(SnapshotHeader) + sizeof(SnapshotBlock) * (size_t) block_count;
+    const size_t slot = lz_bound(SNAPSHOT_BLOCK);
+    uint8_t* image = (uint8_t*) malloc(table_bytes + slot * (size_t) block_count);
+    size_t* offset = (size_t*) malloc(sizeof(size_t) * (size_t) (block_count + 1));
+    count_system_alloc();
+    count_system_alloc();
+    if (!image || !offset) {
+        free(image);
+        free(offset);
+        return NULL;
+    }
+
+    SnapshotHeader* header = (SnapshotHeader*) image;
+    memset(header, 0, sizeof(*header));
+    header->magic = SNAPSHOT_MAGIC;
+    header->version = SNAPSHOT_VERSION;
+    header->grid[0] = GRID_X;
+    header->grid[1] = GRID_Y;
+    header->grid[2] = GRID_Z;
+    header->block_bytes = SNAPSHOT_BLOCK;
+    header->block_count = (uint32_t) block_count;
+    header->raw_bytes = raw_bytes;
+    SnapshotBlock* blocks = (SnapshotBlock*) (image + sizeof(SnapshotHeader));
+
+    // Blocks compress into fixed slots in parallel, then close the gaps.
+    const double start = now_seconds();
+    for (int b = 0; b < block_count; b++) offset[b] = table_bytes + (size_t) b * slot;
+    SnapshotJob job = { (uint8_t*) raw, raw_bytes, image, offset, blocks, block_count, false, 0, 0 };
+    stats->threads = (threads > 0) ? threads : parallel_threads(block_count);
+    parallel_run(snapshot_worker, &job, stats->threads);
+    size_t end = table_bytes;
+    for (int b = 0; b < block_count; b++) {
+        memmove(image + end, image + offset[b], blocks[b].size);
+        end += blocks[b].size;
+    }
+    stats->codec_s = now_seconds() - start;
+    stats->raw_bytes = raw_bytes;
+    stats->packed_bytes = end;
+    free(offset);
+    return image;
+}
+
+// Restore `raw_bytes` of voxels from a snapshot image made for the same
+// grid size. False on any mismatch, truncation or hash failure.
+static bool snapshot_unpack(const uint8_t* image, size_t image_bytes, uint8_t* raw, size_t raw_bytes, int threads, SnapshotStats* stats) {
+    if (image_bytes < sizeof(SnapshotHeader)) return false;
+    const SnapshotHeader* header = (const SnapshotHeader*) image;
+    const int block_count = (int) ((raw_bytes + SNAPSHOT_BLOCK - 1) / SNAPSHOT_BLOCK);
+    if (header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION || header->grid[0] != GRID_X
+        || header->grid[1] != GRID_Y || header->grid[2] != GRID_Z || header->block_bytes != SNAPSHOT_BLOCK
+        || header->raw_bytes != raw_bytes || header->block_count != (uint32_t) block_count) {
+        return false;
+    }
+    const size_t table_bytes = sizeof(SnapshotHeader) + sizeof(SnapshotBlock) * (size_t) block_count;
+    if (image_bytes < table_bytes) return false;
+    SnapshotBlock* blocks = (SnapshotBlock*) (image + sizeof(SnapshotHeader));
+    size_t* offset = (size_t*) malloc(sizeof(size_t) * (size_t) (block_count + 1));
+    count_system_alloc();
+    if (!offset) return false;
+    size_t end = table_bytes;
+    for (int b = 0; b < block_count; b++) {
+        offset[b] = end;
+        end += blocks[b].size;
+    }
+    if (end != image_bytes) {
+        free(offset);
+        return false;
+    }
+
+    const double start = now_seconds();
+    SnapshotJob job = { raw, raw_bytes, (uint8_t*) image, offset, blocks, block_count, true, 0, 0 };
+    stats->threads = (threads > 0) ? threads : parallel_threads(block_count);
+    parallel_run(snapshot_worker, &job, stats->threads);
+    stats->codec_s = now_seconds() - start;
+    stats->raw_bytes = raw_bytes;
+    stats->packed_bytes = image_bytes;
+    free(offset);
+    return job.failed == 0;
+}
+
+static void snapshot_report(const char* verb, const char* codec, const char* path, const SnapshotStats* st, double total_s) {
+    snprintf(g_snapshot_status, sizeof(g_snapshot_status), "%s %s: %zu -> %zu bytes (%.1fx) | %s %.2f GB/s on %d threads | %.2f ms with file I/O",
+        verb, path, st->raw_bytes, st->packed_bytes, (st->packed_bytes > 0) ? (double) st->raw_bytes / (double) st->packed_bytes : 0.0,
+        codec, (st->codec_s > 0.0) ? (double) st->raw_bytes / st->codec_s * 1e-9 : 0.0,
+        st->threads, total_s * 1000.0);
+    fprintf(stderr, "snapshot: %s\n", g_snapshot_status);
+}
+
+VOXEL_MAYBE_UNUSED static bool snapshot_save(const char* path) {
+    const double start = now_seconds();
+    SnapshotStats st;
+    uint8_t* image = snapshot_pack(g_state.voxels, GRID_SIZE, 0, &st);
+    if (!image) {
+        fprintf(stderr, "snapshot: out of memory\n");
+        return false;
+    }
+    FILE* f = fopen(path, "wb");
+    const bool ok = f && fwrite(image, st.packed_bytes, 1, f) == 1;
+    if (f && fclose(f) != 0) perror(path);
+    free(image);
+    if (!ok) {
+        perror(path);
+        return false;
+    }
+    snapshot_report("saved", "compress", path, &st, now_seconds() - start);
+    return true;
+}
+
+// Decode into a fresh voxel buffer and swap it in only when every block
+// verified, so a bad file leaves the world untouched.
+VOXEL_MAYBE_UNUSED static bool snapshot_load(const char* path) {
+    const double start = now_seconds();
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    uint8_t* image = NULL;
+    long size = -1;
+    if (fseek(f, 0, SEEK_END) == 0) size = ftell(f);
+    if (size > 0 && fseek(f, 0, SEEK_SET) == 0) {
+        image = (uint8_t*) malloc((size_t) size);
+        count_system_alloc();
+        if (image && fread(image, (size_t) size, 1, f) != 1) {
+            free(image);
+            image = NULL;
+        }
+    }
+    fclose(f);
+    uint8_t* voxels = image ? (uint8_t*) big_alloc("voxels", GRID_SIZE) : NULL;
+    SnapshotStats st;
+    const bool ok = voxels && snapshot_unpack(image, (size_t) size, voxels, GRID_SIZE, 0, &st);
+    free(image);
+    if (!ok) {
+        big_free(voxels);
+        fprintf(stderr, "snapshot: %s is not a valid snapshot for a %dx%dx%d grid\n", path, GRID_X, GRID_Y, GRID_Z);
+        return false;
+    }
+    big_free(g_state.voxels);
+    g_state.voxels = voxels;
+    g_state.edit_demo_has_blob = false;
+    chunk_store_clear();
+    g_state.dirty_count = 0;
+    mark_dirty((VoxelBox){ { 0, 0, 0 }, { GRID_X - 1, GRID_Y - 1, GRID_Z - 1 } });
+    snapshot_report("loaded", "decompress+verify", path, &st, now_seconds() - start);
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+// Shared-memory frame server
+// -----------------------------------------------------------------------------
+// With --shm NAME every finished frame is also published into a POSIX
+// shared-memory ring (layout and protocol in frame_ring.h) so local
+// processes can read it in place. See tools/frame_consumer.c.
+
+#if defined(VOXEL_HAVE_SHM)
+static FrameRingHeader* g_frame_ring;
+static char g_frame_ring_name[128];
+
+VOXEL_MAYBE_UNUSED static bool frame_ring_open(const char* name) {
+    snprintf(g_frame_ring_name, sizeof(g_frame_ring_name), "%s", name);
+    const size_t bytes = (size_t) frame_ring_bytes(IMG_W, IMG_H);
+    const int fd = shm_open(name, O_CREAT | O_RDWR, 0600);
+    if (fd < 0) {
+        perror("shm_open");
+        return false;
+    }
+    if (ftruncate(fd, (off_t) bytes) != 0) {
+        perror("ftruncate");
+        close(fd);
+        shm_unlink(name);
+        return false;
+    }
+    void* mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        perror("mmap");
+        shm_unlink(name);
+        return false;
+    }
+    memset(mem, 0, bytes);
+
+    FrameRingHeader* h = (FrameRingHeader*) mem;
+    h->width = IMG_W;
+    h->height = IMG_H;
+    h->slots = FRAME_RING_SLOTS;
+    h->pixel_offset = (sizeof(FrameRingHeader) + 63u) & ~(uint64_t) 63u;
+    h->slot_bytes = (uint64_t) IMG_W * IMG_H * 4u;
+    h->version = FRAME_RING_VERSION;
+    __atomic_store_n(&h->magic, FRAME_RING_MAGIC, __ATOMIC_RELEASE);
+    g_frame_ring = h;
+    return true;
+}
+
+static void frame_ring_publish(const Color* px, uint64_t render_ns) {
+    FrameRingHeader* h = g_frame_ring;
+    if (!h) return;
+    const uint64_t n = h->published;
+    FrameRingSlot* slot = &h->slot[n % FRAME_RING_SLOTS];
+    uint8_t* dst = (uint8_t*) h + h->pixel_offset + (n % FRAME_RING_SLOTS) * h->slot_bytes;
+
+    __atomic_store_n(&slot->state, 2u * n + 1u, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(dst, px, (size_t) h->slot_bytes);
+    slot->frame = n;
+    slot->render_ns = render_ns;
+    slot->publish_ns = frame_ring_now_ns();
+    __atomic_store_n(&slot->state, 2u * n + 2u, __ATOMIC_RELEASE);
+    __atomic_store_n(&h->published, n + 1u, __ATOMIC_RELEASE);
+    frame_ring_wake(h);
+}
+
+static void frame_ring_close(void) {
+    if (!g_frame_ring) return;
+    __atomic_store_n(&g_frame_ring->closed, 1u, __ATOMIC_RELEASE);
+    frame_ring_wake(g_frame_ring);
+    fprintf(stderr, "shm: %llu frames published to %s\n", (unsigned long long) g_frame_ring->published, g_frame_ring_name);
+    munmap(g_frame_ring, (size_t) frame_ring_bytes(IMG_W, IMG_H));
+    shm_unlink(g_frame_ring_name);
+    g_frame_ring = NULL;
+}
+#endif
+
+static inline int ui_font_size(void) {
+    const int fs = (int) lroundf(18.0f * UI_FONT_SCALE);
+    return (fs > 8) ? fs : 8;
+}
+
+static inline int ui_line_height(void) {
+    return ui_font_size() + (int) lroundf(6.0f * UI_FONT_SCALE);
+}
+
+static bool ui_button(Rectangle rect, const char* label) {
+    const Vector2 m = GetMousePosition();
+    const bool hover = CheckCollisionPointRec(m, rect);
+    const bool pressed = hover && IsMouseButtonPressed(MOUSE_BUTTON_LEFT);
+
+    const Color bg = hover ? (Color){ 100, 106, 118, 235 } : (Color){ 76, 80, 90, 235 };
+    DrawRectangleRec(rect, bg);
+    DrawRectangleLinesEx(rect, 1.0f, (Color){ 32, 34, 40, 255 });
+
+    const int fs = ui_font_size();
+    const int tw = MeasureText(label, fs);
+    DrawText(
+        label,
+        (int) (rect.x + (rect.width - (float) tw) * 0.5f),
+        (int) (rect.y + (rect.height - (float) fs) * 0.5f),
+        fs,
+        (Color){ 245, 245, 245, 255 }
+    );
+
+    return pressed;
+}
+
+enum { OVERLAY_MAX_LINES = 40, OVERLAY_LINE_LEN = 160 };
+
+// Overlay text is collected first so the panel can be sized to fit; rows
+// for features that are switched off are simply not added.
+static char g_overlay_lines[OVERLAY_MAX_LINES][OVERLAY_LINE_LEN];
+static int g_overlay_count;
+
+static void overlay_line(const char* text) {
+    if (g_overlay_count < OVERLAY_MAX_LINES) {
+        snprintf(g_overlay_lines[g_overlay_count++], OVERLAY_LINE_LEN, "%s", text);
+    }
+}
+
+static void build_overlay_lines(void) {
+    const FrameStats* st = &g_state.frame_stats;
+    g_overlay_count = 0;
+
+    overlay_line(TextFormat("Technique: Fast Voxel Traversal (3D DDA)"));
+    overlay_line(TextFormat("Grid: %dx%dx%d voxels, %s", GRID_X, GRID_Y, GRID_Z, g_state.procedural_world ? g_world_status : "tutorial scene"));
+    overlay_line(TextFormat("Ray buffer: %dx%d (%d rays/frame)", IMG_W, IMG_H, st->rays));
+    overlay_line(TextFormat("Camera: %s", g_state.freeze_camera ? "frozen" : g_state.sparse_world ? "roaming" : "orbiting"));
+    overlay_line(TextFormat("DDA: AABB entry -> tMax/tDelta stepping per axis"));
+    overlay_line(TextFormat("Exit: first solid voxel, grid boundary, or %d steps", MAX_DDA_STEPS));
+    overlay_line(TextFormat("Frame: %.2f ms | FPS(avg): %.1f", g_state.frame_ms, g_state.fps_smooth));
+    overlay_line(TextFormat("Rays/s: %.2f M | Steps/s: %.2f M", st->rays_per_sec / 1000000.0f, st->steps_per_sec / 1000000.0f));
+    overlay_line(TextFormat("AABB entered: %d / %d", st->rays_entered_grid, st->rays));
+    overlay_line(TextFormat("Hits: %d (%.1f%%)", st->hits, st->hit_ratio * 100.0f));
+    overlay_line(TextFormat("Traversal steps: avg %.2f | max %d", st->avg_steps_per_ray, st->max_steps));
+    overlay_line(TextFormat("Pool: %d threads, %d pinned | %d tasks, %d steals | %.0f%% busy in parallel passes", st->pool_threads, g_pool.pinned, st->pool_tasks, st->pool_steals, st->pool_utilization * 100.0f));
+    if (g_state.edit_demo || st->tiles_traced < TILE_COUNT) {
+        overlay_line(TextFormat("Edits: %d voxels in %d regions | tiles traced %d / %d", st->edited_voxels, st->dirty_regions, st->tiles_traced, TILE_COUNT));
+    }
+    if (g_state.sparse_world) {
+        const CameraRig* cam = &g_state.ray_table_rig;
+        int classes[CHUNK_CLASS_COUNT];
+        const float mb = (float) chunk_store_bytes(classes) / (1024.0f * 1024.0f);
+        const float raw_mb = (float) ((size_t) g_chunks.count * CHUNK_VOXELS) / (1024.0f * 1024.0f);
+        const int walked = st->total_steps + st->steps_saved;
+        overlay_line(TextFormat("Sparse world: %d chunks, %.2f MB | hash %d slots, load %.2f | probes avg %.2f, max %d over %d lookups", g_chunks.count, mb, g_chunks.capacity, (g_chunks.capacity > 0) ? (float) g_chunks.count / (float) g_chunks.capacity : 0.0f, (st->chunk_lookups > 0) ? (float) st->chunk_probes / (float) st->chunk_lookups : 0.0f, st->chunk_max_probe, st->chunk_lookups));
+        overlay_line(TextFormat("  %s chunks: 1-bit %d, 2-bit %d, 4-bit %d, 8-bit %d, raw %d | voxels %.2f MB as bytes (%.1fx)", g_chunks.palette ? "palette" : "raw", classes[CHUNK_PAL1], classes[CHUNK_PAL2], classes[CHUNK_PAL4], classes[CHUNK_PAL8], classes[CHUNK_RAW], raw_mb, (mb > 0.0f) ? raw_mb / mb : 0.0f));
+        overlay_line(TextFormat("  camera (%.0f, %.0f, %.0f) | streamed +%d -%d in %.2f ms | empty-chunk skips saved %d steps (%.1f%%)", cam->pos.x, cam->pos.y, cam->pos.z, st->chunks_streamed, st->chunks_evicted, st->stream_ms, st->steps_saved, (walked > 0) ? 100.0f * (float) st->steps_saved / (float) walked : 0.0f));
+    }
+    static const char* primary_names[PRIMARY_MODE_COUNT] = { "DDA", "raster prepass", "column RLE" };
+    overlay_line(TextFormat("Primary: %s | render DDA %.2f ms, raster %.2f ms, RLE %.2f ms", primary_names[g_state.primary_mode], g_state.primary_ms[PRIMARY_DDA], g_state.primary_ms[PRIMARY_RASTER], g_state.primary_ms[PRIMARY_RLE]));
+    if (g_state.sample_mode == SAMPLE_CHECKERBOARD) {
+        const float traced = (st->effective_rays > 0) ? 100.0f * (float) st->rays / (float) st->effective_rays : 0.0f;
+        overlay_line(TextFormat("Checkerboard: traced %d of %d (%.0f%%) | reprojected %d, interpolated %d", st->rays, st->effective_rays, traced, st->reprojected, st->interpolated));
+    } else if (g_state.sample_mode == SAMPLE_ADAPTIVE) {
+        const float traced = (st->effective_rays > 0) ? 100.0f * (float) st->rays / (float) st->effective_rays : 0.0f;
+        overlay_line(TextFormat("Adaptive: traced %.0f%% of %d px | %d tiles refined | threshold %d", traced, st->effective_rays, st->tiles_refined, g_state.refine_threshold));
+    } else if (g_state.sample_mode == SAMPLE_FOVEATED) {
+        overlay_line(TextFormat("Foveated (%s, r=%.0f px): rays 1x1 %d | 2x2 %d | 4x4 %d of %d px", g_state.fovea_follow_mouse ? "mouse" : "fixed", g_state.fovea_radius, st->fovea_rays[0], st->fovea_rays[1], st->fovea_rays[2], st->effective_rays));
+    }
+    if (g_state.primary_mode == PRIMARY_RLE && g_state.rle_valid) {
+        const float dense_kb = (float) GRID_SIZE / 1024.0f;
+        const float rle_kb = (float) rle_bytes() / 1024.0f;
+        overlay_line(TextFormat("RLE: %d runs (%.2f per column) | %.1f KB vs dense %.1f KB (%.1fx) | %d builds | steps/ray %.2f vs DDA %.2f", rle_run_count(), (float) rle_run_count() / (float) (GRID_X * GRID_Z), rle_kb, dense_kb, dense_kb / rle_kb, g_state.rle_rebuilds, g_state.primary_steps[PRIMARY_RLE], g_state.primary_steps[PRIMARY_DDA]));
+    }
+    if (g_state.ao_mode == AO_BAKED && g_state.face_ao_valid) {
+        const float dense_kb = (float) GRID_SIZE * 6.0f / 1024.0f;
+        const float ao_kb = (float) face_ao_bytes() / 1024.0f;
+        overlay_line(TextFormat("Baked AO: %d of %d bricks exposed | %.1f KB vs dense %.1f KB (%.1fx)", g_state.face_ao_blocks, BRICK_COUNT, ao_kb, dense_kb, dense_kb / ao_kb));
+    }
+    if (g_state.primary_mode == PRIMARY_RASTER && g_state.mesh_valid) {
+        overlay_line(TextFormat("Raster: %d quads meshed, %d drawn, %d tris, %.2f ms", g_state.mesh_quads, st->raster_quads, st->raster_triangles, st->raster_ms));
+    } else if (g_state.primary_mode == PRIMARY_RASTER) {
+        overlay_line(TextFormat("Raster: face mesh out of memory (%d failed builds), primary rays use DDA", g_state.mesh_failures));
+    }
+    if (g_state.beam_prepass && g_state.primary_mode == PRIMARY_DDA) {
+        const int walked = st->total_steps + st->steps_saved;
+        overlay_line(TextFormat("Beam prepass: steps saved %d (%.1f%%) | %d cone samples, %.2f ms", st->steps_saved, (walked > 0) ? 100.0f * (float) st->steps_saved / (float) walked : 0.0f, st->beam_samples, st->beam_ms));
+    }
+    if (g_state.lod_enabled && g_state.primary_mode == PRIMARY_DDA) {
+        const float inv = (st->rays > 0) ? 100.0f / (float) st->rays : 0.0f;
+        overlay_line(TextFormat("LOD (bias %.0fx): L0 %.0f%% L1 %.0f%% L2 %.0f%% L3 %.0f%% L4 %.0f%%", g_state.lod_bias, (float) st->lod_rays[0] * inv, (float) st->lod_rays[1] * inv, (float) st->lod_rays[2] * inv, (float) st->lod_rays[3] * inv, (float) st->lod_rays[4] * inv));
+    }
+    static const char* ao_names[AO_MODE_COUNT] = { "height gradient", "baked face corners", "traced probes" };
+    overlay_line(TextFormat("AO: %s", ao_names[g_state.ao_mode]));
+    if (g_state.ao_mode == AO_RAYS) {
+        overlay_line(TextFormat("AO rays: %d rays, %d batches, fill %.0f%%, %d steps", st->secondary_rays, st->secondary_batches, st->batch_fill * 100.0f, st->secondary_steps));
+        overlay_line(TextFormat("Secondary: sorted %.2f ms (sort %.2f) | unsorted %.2f ms | speedup %.2fx", g_state.secondary_ms_sorted, st->secondary_sort_ms, g_state.secondary_ms_unsorted, (g_state.secondary_ms_sorted > 0.0f && g_state.secondary_ms_unsorted > 0.0f) ? g_state.secondary_ms_unsorted / g_state.secondary_ms_sorted : 0.0f));
+    }
+    if (g_state.shadows) {
+        overlay_line(TextFormat("Shadows: %d rays in %d tile batches, %.1f%% occluded | LOS to columns %d/%d", st->shadow_rays, st->shadow_batches, (st->shadow_rays > 0) ? 100.0f * (float) st->shadow_occluded / (float) st->shadow_rays : 0.0f, st->los_visible, g_state.los_target_count));
+    }
+    if (g_state.show_cost_breakdown) {
+        const int all_steps = st->total_steps + st->shadow_steps + st->secondary_steps;
+        overlay_line(TextFormat("Cost steps: primary %d (%.0f%%) | shadow %d | AO %d", st->total_steps, (all_steps > 0) ? 100.0f * (float) st->total_steps / (float) all_steps : 0.0f, st->shadow_steps, st->secondary_steps));
+        overlay_line(TextFormat("Cost ms: ray setup %.2f | primary %.2f | shadow %.2f | AO %.2f", st->ray_setup_ms, st->primary_ms, st->shadow_ms, st->secondary_sort_ms + st->secondary_trace_ms));
+        size_t mapped[PAGE_KIND_COUNT];
+        big_alloc_totals(mapped);
+        const float mb = 1.0f / (1024.0f * 1024.0f);
+        const FrameArena* ra = &g_frame_arenas[FRAME_ARENA_RENDER];
+        const FrameArena* io = &g_frame_arenas[FRAME_ARENA_IO];
+        overlay_line(TextFormat("Arenas: render %.2f / %.2f MB | I/O %.2f / %.2f MB (high water / size) | regrows %d (%d failed) | system allocs this frame %d (mesh growth %d)", (float) ra->high_water * mb, (float) ra->capacity * mb, (float) io->high_water * mb, (float) io->capacity * mb, ra->regrows + io->regrows, ra->regrow_failures + io->regrow_failures, st->system_allocs, st->growth_allocs));
+        overlay_line(TextFormat("Memory: 1G %.1f MB | 2M %.1f MB | THP %.1f MB | 4K %.1f MB | NUMA node %d of %d", (float) mapped[PAGES_1G] * mb, (float) mapped[PAGES_2M] * mb, (float) mapped[PAGES_THP] * mb, (float) (mapped[PAGES_4K] + mapped[PAGES_HEAP]) * mb, g_memory.numa_node, g_memory.numa_nodes));
+    }
+    if (g_snapshot_status[0] != '\0') {
+        overlay_line(TextFormat("Snapshot: %s", g_snapshot_status));
+    }
+    if (g_state.auto_quality) {
+        const int logged = (g_state.quality_log_count < QUALITY_LOG_SIZE) ? g_state.quality_log_count : QUALITY_LOG_SIZE;
+        int n[QUALITY_LEVEL_COUNT] = { 0 };
+        for (int i = 0; i < logged; i++) n[g_state.quality_log[i]] += 1;
+        const float inv = (logged > 0) ? 100.0f / (float) logged : 0.0f;
+        overlay_line(TextFormat("Quality: L%d %s | budget %.1f ms of %.1f (%d fps) | last %.2f ms", g_state.quality_level, QUALITY_LEVELS[g_state.quality_level].name, quality_budget_ms(), 1000.0f / (float) TARGET_FPS, TARGET_FPS, st->render_ms));
+        overlay_line(TextFormat("  pass ms: primary %.2f shadow %.2f AO %.2f reconstruct %.2f | last %d frames at L0-L4: %.0f/%.0f/%.0f/%.0f/%.0f%%", st->primary_ms, st->shadow_ms, st->secondary_sort_ms + st->secondary_trace_ms, st->reconstruct_ms, logged, n[0] * inv, n[1] * inv, n[2] * inv, n[3] * inv, n[4] * inv));
+    }
+    if (g_output.format != OUTPUT_NONE) {
+        overlay_line(TextFormat("Output: %d written, %d failed | queue full %d times", g_output.written, g_output.failed, g_output.waits));
+    }
+    overlay_line(TextFormat("Keys: [E] edit demo (%s) | [R] primary | [B] beam | [O] AO mode", g_state.edit_demo ? "on" : "off"));
+    overlay_line(TextFormat("      [U] unsorted A/B | [H] shadows | [C] cost breakdown | [L] LOD, [ ] bias | [K] sampling, -/= threshold, [M] fovea mouse, ,/. radius | [Q] auto quality"));
+}
+
+// Runtime diagnostics and controls drawn over final image.
+VOXEL_MAYBE_UNUSED static void draw_overlay(void) {
+    const int line_h = ui_line_height();
+    const int pad = (int) lroundf(10.0f * UI_FONT_SCALE);
+    const int x = 12;
+    const int y = 12;
+
+    const int fs = ui_font_size();
+    const int button_h = fs + (int) lroundf(12.0f * UI_FONT_SCALE);
+
+    build_overlay_lines();
+    int w = (int) lroundf(560.0f * UI_FONT_SCALE);
+    for (int i = 0; i < g_overlay_count; i++) {
+        const int lw = MeasureText(g_overlay_lines[i], fs) + pad * 2;
+        if (lw > w) w = lw;
+    }
+
+    int row = 0;
+    row += g_overlay_count; // text rows
+    row += 1;  // button row
+    const int h = pad * 2 + row * line_h + button_h;
+
+    DrawRectangle(x, y, w, h, (Color){ 28, 30, 36, 225 });
+    DrawRectangleLines(x, y, w, h, (Color){ 16, 18, 22, 255 });
+
+    int ty = y + pad;
+    const int tx = x + pad;
+
+    for (int i = 0; i < g_overlay_count; i++) {
+        DrawText(g_overlay_lines[i], tx, ty, fs, RAYWHITE);
+        ty += line_h;
+    }
+
+    const float btn_y = (float) (ty + (int) lroundf(2.0f * UI_FONT_SCALE));
+    const float btn_w = (float) ((w - pad * 3) / 2);
+    const Rectangle btn_freeze = { (float) tx, btn_y, btn_w, (float) button_h };
+    const Rectangle btn_quit = { (float) tx + btn_w + (float) pad, btn_y, btn_w, (float) button_h };
+
+    if (ui_button(btn_freeze, g_state.freeze_camera ? "Resume Camera" : "Freeze Camera")) {
+        g_state.freeze_camera = !g_state.freeze_camera;
+    }
+    if (ui_button(btn_quit, "Quit")) {
+        g_state.request_quit = true;
+    }
+}
+
+// Which regression suite to run instead of rendering, if any.
+typedef enum {
+    REGRESSION_NONE = 0,
+    REGRESSION_GOLDEN,
+    REGRESSION_PERF,
+    REGRESSION_STEPS,       // the steps/ray half of REGRESSION_PERF
+    REGRESSION_UPDATE,
+} RegressionMode;
+
+// Command-line options; with none the interactive window runs as before.
+typedef struct {
+    bool headless;          // render without a window at a fixed 60 Hz step
+    int frames;             // headless frame count
+    bool edit_demo;         // start with the live-edit demo running
+    const char* output;     // frame output target, see output_open
+    bool output_drop;       // drop frames while the output queue is full
+    const char* shm_name;   // publish frames into this shared-memory ring
+    bool no_huge_pages;     // plain pages for the voxel and frame buffers
+    int numa_node;          // pin rendering and its memory to this node (-1 = off)
+    bool auto_quality;      // start with the frame-budget scheduler on
+    const char* quality_log;// per-frame quality level CSV
+    bool sparse_world;      // start in the unbounded chunk-store world
+    bool raw_chunks;        // one byte per voxel instead of palette chunks
+    bool procedural_world;  // seeded procedural grid instead of the tutorial scene
+    uint32_t world_seed;
+    int threads;            // worker pool size, render thread included (0 = per CPU)
+    bool pin_threads;       // pin pool threads to physical cores
+    const char* load_snapshot;  // restore the voxel store at startup
+    const char* save_snapshot;  // write the voxel store on exit
+    const char* golden_dir; // run a regression suite against this directory
+    RegressionMode regression;
+} CliOptions;
+
+static void print_usage(const char* exe) {
+    fprintf(stderr,
+        "usage: %s [--headless] [--frames N] [--edit-demo] [--output PATTERN|-] [--shm NAME]\n"
+        "  --output frames/%%04d.png   write a PNG (or .ppm) sequence\n"
+        "  --output -                stream Y4M to stdout, e.g. | ffmpeg -i - out.mp4\n"
+        "  --output-drop             drop frames instead of waiting for a full output queue\n"
+        "  --shm /voxel_frames       publish frames to a shared-memory ring\n"
+        "  --auto-quality            frame-budget quality scheduler (key Q)\n"
+        "  --quality-log FILE        per-frame quality level and pass costs as CSV\n"
+        "  --sparse-world            unbounded chunked world, roaming camera (key G)\n"
+        "  --chunk-format palette|raw  chunk voxel storage (default palette, key P)\n"
+        "  --world scene|procedural  tutorial scene (default) or generated world (key N)\n"
+        "  --seed N                  procedural world seed (default 1); the world\n"
+        "                            fills the grid, whose size is fixed at build\n"
+        "                            time (-DVOXEL_GRID_X/Y/Z, %dx%dx%d here)\n"
+        "  --load-snapshot FILE      restore a saved voxel world at startup (F9)\n"
+        "  --save-snapshot FILE      save the voxel world on exit (F5)\n"
+        "  --threads N               render worker pool size (default one per CPU)\n"
+        "  --pin-threads             pin pool threads to separate physical cores\n"
+        "  --huge-pages on|off       huge pages for voxel and frame buffers (default on)\n"
+        "  --numa-node N             pin rendering and its memory to NUMA node N\n"
+        "  --golden-test DIR | --perf-test DIR | --perf-steps-test DIR | --golden-update DIR\n"
+        "                            regression suite (see tests/golden)\n",
+        exe, GRID_X, GRID_Y, GRID_Z);
+}
+
+// Value of a two-way flag: true for `second`, false for `first`; anything
+// else is an error.
+static bool cli_choice(const char* flag, const char* value, const char* first, const char* second, bool* is_second) {
+    if (strcmp(value, first) != 0 && strcmp(value, second) != 0) {
+        fprintf(stderr, "%s: expected %s or %s, got '%s'\n", flag, first, second, value);
+        return false;
+    }
+    *is_second = (strcmp(value, second) == 0);
+    return true;
+}
+
+VOXEL_MAYBE_UNUSED static bool parse_cli(int argc, char** argv, CliOptions* opt) {
+    memset(opt, 0, sizeof(*opt));
+    opt->frames = 300;
+    opt->numa_node = -1;
+    opt->world_seed = WORLD_DEFAULT_SEED;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            opt->headless = true;
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            opt->frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--edit-demo") == 0) {
+            opt->edit_demo = true;
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            opt->output = argv[++i];
+        } else if (strcmp(argv[i], "--output-drop") == 0) {
+            opt->output_drop = true;
+        } else if (strcmp(argv[i], "--huge-pages") == 0 && i + 1 < argc) {
+            if (!cli_choice(argv[i], argv[i + 1], "on", "off", &opt->no_huge_pages)) return false;
+            i += 1;
+        } else if (strcmp(argv[i], "--numa-node") == 0 && i + 1 < argc) {
+            opt->numa_node = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--auto-quality") == 0) {
+            opt->auto_quality = true;
+        } else if (strcmp(argv[i], "--quality-log") == 0 && i + 1 < argc) {
+            opt->quality_log = argv[++i];
+        } else if (strcmp(argv[i], "--sparse-world") == 0) {
+            opt->sparse_world = true;
+        } else if (strcmp(argv[i], "--load-snapshot") == 0 && i + 1 < argc) {
+            opt->load_snapshot = argv[++i];
+        } else if (strcmp(argv[i], "--save-snapshot") == 0 && i + 1 < argc) {
+            opt->save_snapshot = argv[++i];
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            opt->threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--pin-threads") == 0) {
+            opt->pin_threads = true;
+        } else if (strcmp(argv[i], "--world") == 0 && i + 1 < argc) {
+            if (!cli_choice(argv[i], argv[i + 1], "scene", "procedural", &opt->procedural_world)) return false;
+            i += 1;
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            opt->world_seed = (uint32_t) strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--chunk-format") == 0 && i + 1 < argc) {
+            if (!cli_choice(argv[i], argv[i + 1], "palette", "raw", &opt->raw_chunks)) return false;
+            i += 1;
+        } else if (strcmp(argv[i], "--shm") == 0 && i + 1 < argc) {
+            opt->shm_name = argv[++i];
+        } else if ((strcmp(argv[i], "--golden-test") == 0 || strcmp(argv[i], "--perf-test") == 0 || strcmp(argv[i], "--perf-steps-test") == 0
+                    || strcmp(argv[i], "--golden-update") == 0) && i + 1 < argc) {
+            opt->regression = (strcmp(argv[i], "--golden-test") == 0) ? REGRESSION_GOLDEN
+                            : (strcmp(argv[i], "--perf-test") == 0) ? REGRESSION_PERF
+                            : (strcmp(argv[i], "--perf-steps-test") == 0) ? REGRESSION_STEPS : REGRESSION_UPDATE;
+            opt->golden_dir = argv[++i];
+        } else {
+            print_usage(argv[0]);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void state_buffers_release(void) {
+    big_free(g_state.voxels);
+    big_free(g_state.face_ao_brick);
+    big_free(g_state.lod_cells);
+    big_free(g_state.pixels);
+    free(g_state.face_ao);
+    free(g_state.rle_col_start);
+    free(g_state.rle_col_runs);
+    free(g_state.rle_col_slots);
+    free(g_state.rle_col_top);
+    free(g_state.rle_runs);
+    for (int face = 0; face < 6; face++) {
+        for (int layer = 0; layer < GRID_MAX_DIM; layer++) {
+            FaceSlice* slice = &g_state.face_slices[face][layer];
+            free(slice->quads);
+            *slice = (FaceSlice){ NULL, 0, 0 };
+        }
+    }
+    g_state.rle_col_start = NULL;
+    g_state.rle_col_runs = NULL;
+    g_state.rle_col_slots = NULL;
+    g_state.rle_col_top = NULL;
+    g_state.rle_runs = NULL;
+    g_state.rle_run_capacity = 0;
+    g_state.rle_valid = g_state.mesh_valid = g_state.face_ao_valid = false;
+    g_state.voxels = g_state.face_ao = g_state.lod_cells = NULL;
+    g_state.face_ao_brick = NULL;
+    g_state.pixels = NULL;
+    g_state.face_ao_capacity = g_state.face_ao_blocks = g_state.face_ao_next = 0;
+    g_state.face_ao_free = 0;
+}
+
+// Voxel store first: it is what traversal reads at random.
+static bool state_buffers_alloc(void) {
+    g_state.voxels = (uint8_t*) big_alloc("voxels", GRID_SIZE);
+    g_state.face_ao_brick = (uint32_t*) big_alloc("face AO bricks", sizeof(uint32_t) * BRICK_COUNT);
+    g_state.lod_cells = (uint8_t*) big_alloc("LOD", LOD_CAPACITY);
+    g_state.pixels = (Color*) big_alloc("pixels", sizeof(Color) * IMG_W * IMG_H);
+    if (g_state.voxels && g_state.face_ao_brick && g_state.lod_cells && g_state.pixels) {
+        return true;
+    }
+    fprintf(stderr, "out of memory allocating voxel and frame buffers\n");
+    state_buffers_release();
+    return false;
+}
+
+// Expects state_buffers_alloc() to have succeeded.
+static void init_state(const CliOptions* opt) {
+    g_state.rng_state = 0x9e3779b9u;
+    g_state.beam_prepass = true;
+    g_state.ao_mode = AO_BAKED;
+    g_state.lod_bias = 1.0f;
+    g_state.refine_threshold = 24;
+    g_state.fovea_radius = 48.0f;
+    g_state.fovea_center = (Vector2){ 0.5f * (float) IMG_W, 0.5f * (float) IMG_H };
+    g_state.quality_level = QUALITY_DEFAULT_LEVEL;
+    g_state.quality_refresh_tile = TILE_COUNT;
+    g_state.edit_demo = opt->edit_demo;
+    g_state.sparse_world = opt->sparse_world;
+    memset(g_state.tile_rate, 1, sizeof(g_state.tile_rate));
+    g_state.procedural_world = opt->procedural_world;
+    g_state.world_seed = opt->world_seed;
+    lod_init_layout();
+    if (g_state.procedural_world) {
+        world_generate(g_state.world_seed);
+    } else {
+        build_scene();
+    }
+    g_chunks.palette = !opt->raw_chunks;
+    chunk_store_clear();
+    memset(g_state.pixels, 0, sizeof(Color) * IMG_W * IMG_H);
+}
+
+// -----------------------------------------------------------------------------
+// Regression suite
+// -----------------------------------------------------------------------------
+// Fixed poses and feature settings rendered headlessly from a fresh scene.
+// `--golden-test DIR` compares each image against DIR/<name>.png with a
+// per-pixel tolerance; `--perf-test DIR` checks primary steps/ray and the
+// median full-frame render time against DIR/budgets.txt, and
+// `--perf-steps-test DIR` only the machine-independent steps/ray.
+// `--golden-update DIR` rewrites both from the current build. Goldens only
+// match the default grid size; other sizes skip.
+
+typedef struct {
+    const char* name;
+    float time_s;           // orbit time of the pose
+    int edit_frames;        // run the edit demo this many 60 Hz steps first
+    PrimaryMode primary;
+    AoMode ao;
+    SampleMode sampling;
+    bool shadows;
+    float lod_bias;         // 0 = LOD off
+    bool sparse;            // chunk-store world, roaming camera
+    bool procedural;        // world_generate(WORLD_DEFAULT_SEED) instead of build_scene
+    bool dense_edits;       // stream the sparse world first, then edit in dense mode
+    int settle_frames;      // further frames of the same pose before comparing
+    const char* golden;     // another case's golden to match, NULL = own
+} RegressionCase;
+
+static const RegressionCase REGRESSION_CASES[] = {
+    { "orbit_t0", 0.0f, 0, PRIMARY_DDA, AO_BAKED, SAMPLE_FULL, false, 0.0f, false, false, false, 0, NULL },
+    { "orbit_t3", 3.0f, 0, PRIMARY_DDA, AO_BAKED, SAMPLE_FULL, false, 0.0f, false, false, false, 0, NULL },
+    { "height_ao_t9", 9.0f, 0, PRIMARY_DDA, AO_HEIGHT, SAMPLE_FULL, false, 0.0f, false, false, false, 0, NULL },
+    { "shadows_t7", 7.0f, 0, PRIMARY_DDA, AO_BAKED, SAMPLE_FULL, true, 0.0f, false, false, false, 0, NULL },
+    { "ao_rays_t1", 1.0f, 0, PRIMARY_DDA, AO_RAYS, SAMPLE_FULL, false, 0.0f, false, false, false, 0, NULL },
+    { "raster_t5", 5.0f, 0, PRIMARY_RASTER, AO_BAKED, SAMPLE_FULL, false, 0.0f, false, false, false, 0, NULL },
+    { "edited_t2", 2.0f, 120, PRIMARY_DDA, AO_BAKED, SAMPLE_FULL, true, 0.0f, false, false, false, 0, NULL },
+    { "lod_t6", 6.0f, 0, PRIMARY_DDA, AO_BAKED, SAMPLE_FULL, false, 8.0f, false, false, false, 0, NULL },
+    { "adaptive_t4", 4.0f, 0, PRIMARY_DDA, AO_BAKED, SAMPLE_ADAPTIVE, false, 0.0f, false, false, false, 0, NULL },
+    { "rle_t3", 3.0f, 0, PRIMARY_RLE, AO_BAKED, SAMPLE_FULL, false, 0.0f, false, false, false, 0, NULL },
+    { "sparse_t3", 3.0f, 0, PRIMARY_DDA, AO_BAKED, SAMPLE_FULL, false, 0.0f, true, false, false, 0, NULL },
+    { "procedural_t1", 1.0f, 0, PRIMARY_DDA, AO_BAKED, SAMPLE_FULL, true, 0.0f, false, true, false, 0, NULL },
+    // A static checkerboard view converges to the full trace.
+    { "checker_t3", 3.0f, 0, PRIMARY_DDA, AO_BAKED, SAMPLE_CHECKERBOARD, false, 0.0f, false, false, false, 4, "orbit_t3" },
+    // Edits made while the dense grid is shown reach the loaded chunks.
+    { "sparse_edited_t3", 3.0f, 120, PRIMARY_DDA, AO_BAKED, SAMPLE_FULL, false, 0.0f, true, false, false, 0, NULL },
+    { "sparse_dense_t3", 3.0f, 120, PRIMARY_DDA, AO_BAKED, SAMPLE_FULL, false, 0.0f, true, false, true, 0, "sparse_edited_t3" },
+};
+
+enum {
+    REGRESSION_CASE_COUNT = (int) (sizeof(REGRESSION_CASES) / sizeof(REGRESSION_CASES[0])),
+    GOLDEN_CHANNEL_TOLERANCE = 4,   // max per-channel difference of a matching pixel
+    GOLDEN_MAX_BAD_PIXELS = 48,     // ~0.1% of the image may differ (silhouette edges)
+    PERF_TIMING_RUNS = 5,
+    SKIP_RETURN_CODE = 77,
+};
+
+// Steps/ray is deterministic, so a small margin only absorbs compiler
+// differences; render time gets a generous one and a floor.
+static const float PERF_STEPS_MARGIN = 1.05f;
+static const float PERF_TIME_HEADROOM = 4.0f;
+static const float PERF_TIME_FLOOR_MS = 20.0f;
+
+// Fresh scene and state, then the case's settings; returns the first frame
+// and leaves the last settle frame in the pixel buffer.
+static FrameStats render_regression_case(const RegressionCase* rc) {
+    const CliOptions defaults = { .frames = 1, .procedural_world = rc->procedural, .world_seed = WORLD_DEFAULT_SEED };
+    state_buffers_release();
+    memset(&g_state, 0, sizeof(g_state));
+    if (!state_buffers_alloc()) exit(1);
+    init_state(&defaults);
+    g_state.primary_mode = rc->primary;
+    g_state.ao_mode = rc->ao;
+    g_state.sample_mode = rc->sampling;
+    g_state.shadows = rc->shadows;
+    g_state.lod_enabled = rc->lod_bias > 0.0f;
+    g_state.lod_bias = g_state.lod_enabled ? rc->lod_bias : 1.0f;
+    g_state.sparse_world = rc->sparse;
+    g_state.time_s = rc->time_s;
+    if (rc->dense_edits) {
+        render_voxel_image(1.0f / 60.0f);
+        g_state.sparse_world = false;
+    }
+    for (int i = 0; i < rc->edit_frames; i++) {
+        g_state.edit_demo_time += 1.0f / 60.0f;
+        run_edit_demo(g_state.edit_demo_time);
+    }
+    if (rc->dense_edits) {
+        render_voxel_image(1.0f / 60.0f);
+        g_state.sparse_world = rc->sparse;
+    }
+    const FrameStats first = render_voxel_image(1.0f / 60.0f);
+    for (int i = 0; i < rc->settle_frames; i++) {
+        render_voxel_image(1.0f / 60.0f);
+    }
+    return first;
+}
+
+// Median full-frame render time of the already prepared case.
+static float time_regression_case(void) {
+    float ms[PERF_TIMING_RUNS];
+    for (int i = 0; i < PERF_TIMING_RUNS; i++) {
+        g_state.have_last_frame = false;
+        ms[i] = render_voxel_image(1.0f / 60.0f).render_ms;
+    }
+    for (int i = 1; i < PERF_TIMING_RUNS; i++) {
+        for (int j = i; j > 0 && ms[j - 1] > ms[j]; j--) {
+            const float t = ms[j];
+            ms[j] = ms[j - 1];
+            ms[j - 1] = t;
+        }
+    }
+    return ms[PERF_TIMING_RUNS / 2];
+}
+
+static bool compare_golden(const char* dir, const RegressionCase* rc) {
+    const char* path = TextFormat("%s/%s.png", dir, rc->golden ? rc->golden : rc->name);
+    Image golden = LoadImage(path);
+    if (golden.data == NULL || golden.width != IMG_W || golden.height != IMG_H || golden.format != PIXELFORMAT_UNCOMPRESSED_R8G8B8A8) {
+        fprintf(stderr, "%-18s FAIL missing or unreadable golden %s\n", rc->name, path);
+        UnloadImage(golden);
+        return false;
+    }
+
+    const Color* ref = (const Color*) golden.data;
+    int bad = 0;
+    int max_diff = 0;
+    for (int i = 0; i < IMG_W * IMG_H; i++) {
+        const int dr = abs(ref[i].r - g_state.pixels[i].r);
+        const int dg = abs(ref[i].g - g_state.pixels[i].g);
+        const int db = abs(ref[i].b - g_state.pixels[i].b);
+        const int worst = (dr > dg) ? ((dr > db) ? dr : db) : ((dg > db) ? dg : db);
+        if (worst > max_diff) max_diff = worst;
+        if (worst > GOLDEN_CHANNEL_TOLERANCE) bad += 1;
+    }
+    UnloadImage(golden);
+
+    const bool pass = bad <= GOLDEN_MAX_BAD_PIXELS;
+    printf("%-18s %s %d px over tolerance (max channel diff %d)\n", rc->name, pass ? "ok  " : "FAIL", bad, max_diff);
+    if (!pass) {
+        // Keep the failing frame next to the test's working directory.
+        const Image actual = { g_state.pixels, IMG_W, IMG_H, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 };
+        ExportImage(actual, TextFormat("%s.actual.png", rc->name));
+    }
+    return pass;
+}
+
+// A steps budget of "-" (cases that walk no primary rays, such as the
+// raster prepass) loads as a negative value and is not checked.
+static bool load_budget(const char* dir, const char* name, float* steps_per_ray, float* ms) {
+    FILE* f = fopen(TextFormat("%s/budgets.txt", dir), "r");
+    if (!f) return false;
+    char line[256];
+    bool found = false;
+    while (!found && fgets(line, sizeof(line), f)) {
+        char key[64], steps[32];
+        if (line[0] != '#' && sscanf(line, "%63s %31s %f", key, steps, ms) == 3 && strcmp(key, name) == 0) {
+            *steps_per_ray = (strcmp(steps, "-") == 0) ? -1.0f : strtof(steps, NULL);
+            found = true;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+VOXEL_MAYBE_UNUSED static int run_regression(RegressionMode mode, const char* dir) {
+    if (GRID_X != 24 || GRID_Y != 16 || GRID_Z != 24) {
+        printf("goldens are for the default 24x16x24 grid; skipping\n");
+        return SKIP_RETURN_CODE;
+    }
+#if !defined(NDEBUG)
+    if (mode == REGRESSION_PERF) {
+        printf("performance budgets apply to optimized (NDEBUG) builds; skipping\n");
+        return SKIP_RETURN_CODE;
+    }
+#endif
+
+    FILE* budgets = NULL;
+    if (mode == REGRESSION_UPDATE) {
+        budgets = fopen(TextFormat("%s/budgets.txt", dir), "w");
+        if (!budgets) {
+            fprintf(stderr, "cannot write %s/budgets.txt\n", dir);
+            return 1;
+        }
+        fprintf(budgets, "# case  max primary steps/ray (- = no primary walk)  max median render ms\n");
+    }
+
+    int failures = 0;
+    for (int i = 0; i < REGRESSION_CASE_COUNT; i++) {
+        const RegressionCase* rc = &REGRESSION_CASES[i];
+        const FrameStats st = render_regression_case(rc);
+
+        if (mode == REGRESSION_GOLDEN) {
+            failures += compare_golden(dir, rc) ? 0 : 1;
+        } else if (mode == REGRESSION_UPDATE) {
+            const Image img = { g_state.pixels, IMG_W, IMG_H, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 };
+            if (!rc->golden && !ExportImage(img, TextFormat("%s/%s.png", dir, rc->name))) failures += 1;
+            const float ms = time_regression_case();
+            char steps[32] = "-";
+            if (st.total_steps > 0) snprintf(steps, sizeof(steps), "%.3f", st.avg_steps_per_ray * PERF_STEPS_MARGIN);
+            fprintf(budgets, "%-18s %-6s %.1f\n", rc->name, steps, fmaxf(ms * PERF_TIME_HEADROOM, PERF_TIME_FLOOR_MS));
+            printf("%-18s updated (%.3f steps/ray, %.2f ms)\n", rc->name, st.avg_steps_per_ray, ms);
+        } else {
+            float max_steps = 0.0f, max_ms = 0.0f;
+            if (!load_budget(dir, rc->name, &max_steps, &max_ms)) {
+                fprintf(stderr, "%-18s FAIL no budget in %s/budgets.txt\n", rc->name, dir);
+                failures += 1;
+                continue;
+            }
+            const bool steps_ok = max_steps < 0.0f || st.avg_steps_per_ray <= max_steps;
+            char steps[64] = "not budgeted";
+            if (max_steps >= 0.0f) snprintf(steps, sizeof(steps), "%.3f (max %.3f)", st.avg_steps_per_ray, max_steps);
+            if (mode == REGRESSION_STEPS) {
+                printf("%-18s %s steps/ray %s\n", rc->name, steps_ok ? "ok  " : "FAIL", steps);
+                failures += steps_ok ? 0 : 1;
+                continue;
+            }
+            const float ms = time_regression_case();
+            const bool pass = steps_ok && ms <= max_ms;
+            printf("%-18s %s steps/ray %s | render %.2f ms (max %.1f)\n", rc->name, pass ? "ok  " : "FAIL", steps, ms, max_ms);
+            failures += pass ? 0 : 1;
+        }
+    }
+
+    if (budgets) fclose(budgets);
+    printf("%d of %d cases failed\n", failures, REGRESSION_CASE_COUNT);
+    return (failures == 0) ? 0 : 1;
+}
+
+// Render one frame and hand it to the configured outputs.
+static void render_and_publish(float dt) {
+#if defined(VOXEL_HAVE_SHM)
+    const uint64_t render_ns = frame_ring_now_ns();
+#endif
+    g_state.frame_stats = render_voxel_image(dt);
+    quality_schedule(&g_state.frame_stats);
+    output_submit(g_state.pixels, (int) g_state.frame_index - 1);
+#if defined(VOXEL_HAVE_SHM)
+    frame_ring_publish(g_state.pixels, render_ns);
+#endif
+}
+
+VOXEL_MAYBE_UNUSED static void close_outputs(void) {
+    output_close();
+    if (g_state.quality_log_file) {
+        fclose(g_state.quality_log_file);
+        g_state.quality_log_file = NULL;
+    }
+#if defined(VOXEL_HAVE_SHM)
+    frame_ring_close();
+#endif
+}
+
+// Fixed-step render loop without a window, for offline previews.
+VOXEL_MAYBE_UNUSED static int run_headless(const CliOptions* opt) {
+    const float dt = 1.0f / 60.0f;
+    double render_ms = 0.0;
+    double utilization = 0.0;
+    long steals = 0;
+    for (int frame = 0; frame < opt->frames; frame++) {
+        g_state.time_s += dt;
+        if (g_state.edit_demo) {
+            g_state.edit_demo_time += dt;
+            run_edit_demo(g_state.edit_demo_time);
+        }
+        render_and_publish(dt);
+        render_ms += g_state.frame_stats.render_ms;
+        utilization += g_state.frame_stats.pool_utilization;
+        steals += g_state.frame_stats.pool_steals;
+    }
+    fprintf(stderr, "headless: %d frames, %.3f ms/frame average render\n", opt->frames, (opt->frames > 0) ? render_ms / opt->frames : 0.0);
+    if (opt->frames > 0) {
+        fprintf(stderr, "pool: %d threads, %d pinned | %.0f%% busy in parallel passes, %.1f steals/frame\n", g_pool.workers, g_pool.pinned, 100.0 * utilization / opt->frames, (double) steals / opt->frames);
+    }
+    memory_report(stderr);
+    return 0;
+}
+
+// Benchmarks and other tools include this file with VOXEL_NO_MAIN to reuse
+// the kernels directly.
+#if !defined(VOXEL_NO_MAIN)
+int main(int argc, char** argv) {
+    CliOptions opt;
+    if (!parse_cli(argc, argv, &opt)) return 2;
+    if (!memory_setup(!opt.no_huge_pages, opt.numa_node)) return 1;
+    // After memory_setup, so pool threads inherit a NUMA node's CPU mask.
+    pool_start(opt.threads, opt.pin_threads);
+    replicas_start();
+    if (opt.regression != REGRESSION_NONE) {
+        const int rc = run_regression(opt.regression, opt.golden_dir);
+        pool_stop();
+        return rc;
+    }
+    if (!state_buffers_alloc()) return 1;
+    init_state(&opt);
+    // The window shows it in the overlay.
+    if (opt.headless && opt.procedural_world) {
+        fprintf(stderr, "world: %dx%dx%d %s\n", GRID_X, GRID_Y, GRID_Z, g_world_status);
+    }
+    if (opt.load_snapshot && !snapshot_load(opt.load_snapshot)) return 1;
+    // F5 / F9 use the save path, else the load path.
+    const char* snapshot_path = opt.save_snapshot ? opt.save_snapshot : opt.load_snapshot ? opt.load_snapshot : "world.vxsnap";
+    if (opt.output && !output_open(opt.output, opt.output_drop)) return 1;
+    if (opt.quality_log) {
+        g_state.quality_log_file = fopen(opt.quality_log, "w");
+        if (!g_state.quality_log_file) {
+            perror(opt.quality_log);
+            return 1;
+        }
+        fprintf(g_state.quality_log_file, "frame,level,auto,render_ms,primary_ms,shadow_ms,ao_ms,reconstruct_ms\n");
+    }
+    if (opt.auto_quality) {
+        g_state.auto_quality = true;
+        apply_quality_level(QUALITY_DEFAULT_LEVEL);
+    }
+    if (opt.shm_name) {
+#if defined(VOXEL_HAVE_SHM)
+        if (!frame_ring_open(opt.shm_name)) return 1;
+#else
+        fprintf(stderr, "--shm needs POSIX shared memory\n");
+        return 1;
+#endif
+    }
+    if (opt.headless) {
+        int rc = run_headless(&opt);
+        if (opt.save_snapshot && !snapshot_save(opt.save_snapshot)) rc = 1;
+        close_outputs();
+        pool_stop();
+        return rc;
+    }
+
+    // 1) Initialize window and target framerate.
+    InitWindow(1280, 720, "C + raylib + Amanatides-Woo");
+    SetTargetFPS(TARGET_FPS);
+
+    // 2) Initialize GPU image resources.
+
+    Image img = GenImageColor(IMG_W, IMG_H, BLACK);
+    g_state.ray_texture = LoadTextureFromImage(img);
+    UnloadImage(img);
+    SetTextureFilter(g_state.ray_texture, TEXTURE_FILTER_POINT);
+
+    // 3) Standard raylib frame loop.
+    while (!WindowShouldClose() && !g_state.request_quit) {
+        const float dt = clamp_f32(GetFrameTime(), 1e-5f, 0.25f);
+
+        // Update camera timer (unless frozen from UI).
+        if (!g_state.freeze_camera) {
+            g_state.time_s += dt;
+        }
+
+        // Settings that change the image re-trace every tile, even with the
+        // camera frozen. Picking sampling, AO or shadows by hand turns the
+        // quality scheduler off.
+        if (IsKeyPressed(KEY_E)) {
+            g_state.edit_demo = !g_state.edit_demo;
+        }
+        if (IsKeyPressed(KEY_K)) {
+            g_state.sample_mode = (SampleMode) ((g_state.sample_mode + 1) % SAMPLE_MODE_COUNT);
+            g_state.have_last_frame = false;
+            g_state.auto_quality = false;
+        }
+        if (IsKeyPressed(KEY_MINUS)) {
+            g_state.refine_threshold = clamp_i32(g_state.refine_threshold - 8, 0, 765);
+            g_state.have_last_frame = false;
+        }
+        if (IsKeyPressed(KEY_EQUAL)) {
+            g_state.refine_threshold = clamp_i32(g_state.refine_threshold + 8, 0, 765);
+            g_state.have_last_frame = false;
+        }
+        if (IsKeyPressed(KEY_M)) {
+            g_state.fovea_follow_mouse = !g_state.fovea_follow_mouse;
+        }
+        if (IsKeyPressed(KEY_COMMA)) {
+            g_state.fovea_radius = fmaxf(g_state.fovea_radius - 8.0f, 8.0f);
+            g_state.have_last_frame = false;
+        }
+        if (IsKeyPressed(KEY_PERIOD)) {
+            g_state.fovea_radius = fminf(g_state.fovea_radius + 8.0f, (float) IMG_W);
+            g_state.have_last_frame = false;
+        }
+        if (IsKeyPressed(KEY_L)) {
+            g_state.lod_enabled = !g_state.lod_enabled;
+            g_state.have_last_frame = false;
+        }
+        if (IsKeyPressed(KEY_LEFT_BRACKET)) {
+            g_state.lod_bias = fmaxf(g_state.lod_bias * 0.5f, 1.0f);
+            g_state.have_last_frame = false;
+        }
+        if (IsKeyPressed(KEY_RIGHT_BRACKET)) {
+            g_state.lod_bias = fminf(g_state.lod_bias * 2.0f, 1024.0f);
+            g_state.have_last_frame = false;
+        }
+        if (IsKeyPressed(KEY_Q)) {
+            g_state.auto_quality = !g_state.auto_quality;
+            if (g_state.auto_quality) apply_quality_level(g_state.quality_level);
+        }
+        if (IsKeyPressed(KEY_H)) {
+            g_state.shadows = !g_state.shadows;
+            g_state.have_last_frame = false;
+            g_state.auto_quality = false;
+        }
+        if (IsKeyPressed(KEY_C)) {
+            g_state.show_cost_breakdown = !g_state.show_cost_breakdown;
+        }
+        if (IsKeyPressed(KEY_O)) {
+            g_state.ao_mode = (AoMode) ((g_state.ao_mode + 1) % AO_MODE_COUNT);
+            g_state.have_last_frame = false;
+            g_state.auto_quality = false;
+        }
+        if (IsKeyPressed(KEY_U)) {
+            g_state.compare_unsorted = !g_state.compare_unsorted;
+        }
+        if (IsKeyPressed(KEY_B)) {
+            g_state.beam_prepass = !g_state.beam_prepass;
+            g_state.have_last_frame = false;
+        }
+        if (IsKeyPressed(KEY_R)) {
+            g_state.primary_mode = (PrimaryMode) ((g_state.primary_mode + 1) % PRIMARY_MODE_COUNT);
+            g_state.have_last_frame = false;
+        }
+        if (IsKeyPressed(KEY_G)) {
+            g_state.sparse_world = !g_state.sparse_world;
+            g_state.have_last_frame = false;
+        }
+        if (IsKeyPressed(KEY_N)) {
+            // Next seed; the first press replaces the tutorial scene.
+            if (g_state.procedural_world) g_state.world_seed += 1;
+            g_state.procedural_world = true;
+            world_generate(g_state.world_seed);
+        }
+        if (IsKeyPressed(KEY_F5)) {
+            snapshot_save(snapshot_path);
+        }
+        if (IsKeyPressed(KEY_F9)) {
+            snapshot_load(snapshot_path);
+        }
+        if (IsKeyPressed(KEY_P)) {
+            // Re-streamed in the new format on the next sparse frame.
+            g_chunks.palette = !g_chunks.palette;
+            chunk_store_clear();
+        }
+        // The ray image is stretched over the whole window.
+        if (g_state.fovea_follow_mouse) {
+            const Vector2 m = GetMousePosition();
+            g_state.fovea_center = (Vector2){ m.x * (float) IMG_W / (float) GetScreenWidth(), m.y * (float) IMG_H / (float) GetScreenHeight() };
+        } else {
+            g_state.fovea_center = (Vector2){ 0.5f * (float) IMG_W, 0.5f * (float) IMG_H };
+        }
+        if (g_state.edit_demo) {
+            g_state.edit_demo_time += dt;
+            run_edit_demo(g_state.edit_demo_time);
         }
 
         // Smooth fps readout for overlay stability.
@@ -499,7 +6734,7 @@ int main(void) {
         }
 
         // Raytrace on CPU, then upload texture for presentation.
-        g_state.frame_stats = render_voxel_image(dt);
+        render_and_publish(dt);
         UpdateTexture(g_state.ray_texture, g_state.pixels);
 
         // Draw full-screen image and overlay UI.
@@ -520,7 +6755,11 @@ int main(void) {
     }
 
     // 4) Release resources.
+    if (opt.save_snapshot) snapshot_save(opt.save_snapshot);
+    close_outputs();
+    pool_stop();
     UnloadTexture(g_state.ray_texture);
     CloseWindow();
     return 0;
 }
+#endif
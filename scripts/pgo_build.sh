@@ -0,0 +1,79 @@
+#!/usr/bin/env bash
+# Build an LTO + PGO optimized voxel_dda_raylib and report the gain over a
+# plain LTO Release build.
+#
+#   scripts/pgo_build.sh [extra cmake configure args...]
+#
+# 1. LTO Release baseline in $BASE_DIR.
+# 2. Instrumented build (VOXEL_PGO=GENERATE) in $BUILD_DIR.
+# 3. Training: the headless standard camera path, with and without the
+#    live-edit demo.
+# 4. Rebuild the same tree with VOXEL_PGO=USE (profiles are keyed by object
+#    path, so the tree must not move between phases).
+# 5. Check the optimized binary against the golden images and compare
+#    headless ms/frame of both builds (best of $RUNS runs).
+set -euo pipefail
+
+SCRIPT_DIR="$(cd -- "$(dirname -- "${BASH_SOURCE[0]}")" && pwd)"
+ROOT_DIR="$(cd -- "$SCRIPT_DIR/.." && pwd)"
+BUILD_DIR="${BUILD_DIR:-$ROOT_DIR/build-pgo}"
+BASE_DIR="${BASE_DIR:-$ROOT_DIR/build-lto}"
+PROFILE_DIR="$BUILD_DIR/pgo-profile"
+TRAIN_FRAMES="${TRAIN_FRAMES:-600}"
+BENCH_FRAMES="${BENCH_FRAMES:-600}"
+RUNS="${RUNS:-3}"
+LLVM_PROFDATA="${LLVM_PROFDATA:-llvm-profdata}"
+CMAKE_POLICY_VERSION_MINIMUM="${CMAKE_POLICY_VERSION_MINIMUM:-3.5}"
+
+configure() {
+  local dir="$1"
+  shift
+  cmake -S "$ROOT_DIR" -B "$dir" -DCMAKE_BUILD_TYPE=Release \
+    -DCMAKE_POLICY_VERSION_MINIMUM="$CMAKE_POLICY_VERSION_MINIMUM" \
+    -DVOXEL_ENABLE_LTO=ON "$@" >/dev/null
+}
+
+# Average headless render time in ms/frame, best of $RUNS.
+measure() {
+  local exe="$1"
+  local best=""
+  for _ in $(seq "$RUNS"); do
+    local ms
+    ms="$("$exe" --headless --frames "$BENCH_FRAMES" 2>&1 >/dev/null | sed -n 's/.*frames, \([0-9.]*\) ms\/frame.*/\1/p')"
+    if [[ -z "$best" ]] || awk -v a="$ms" -v b="$best" 'BEGIN { exit !(a < b) }'; then
+      best="$ms"
+    fi
+  done
+  echo "$best"
+}
+
+echo "== baseline (LTO) in $BASE_DIR"
+configure "$BASE_DIR" -DVOXEL_PGO=OFF "$@"
+cmake --build "$BASE_DIR" --target voxel_dda_raylib >/dev/null
+
+echo "== instrumented build in $BUILD_DIR"
+rm -rf "$PROFILE_DIR"
+configure "$BUILD_DIR" -DVOXEL_PGO=GENERATE -DVOXEL_PGO_DIR="$PROFILE_DIR" "$@"
+cmake --build "$BUILD_DIR" --target voxel_dda_raylib --clean-first >/dev/null
+
+echo "== training ($TRAIN_FRAMES frames per run)"
+"$BUILD_DIR/voxel_dda_raylib" --headless --frames "$TRAIN_FRAMES" >/dev/null 2>&1
+"$BUILD_DIR/voxel_dda_raylib" --headless --frames "$TRAIN_FRAMES" --edit-demo >/dev/null 2>&1
+if compgen -G "$PROFILE_DIR/*.profraw" >/dev/null; then
+  "$LLVM_PROFDATA" merge -output="$PROFILE_DIR/default.profdata" "$PROFILE_DIR"/*.profraw
+fi
+
+echo "== optimized build (VOXEL_PGO=USE)"
+configure "$BUILD_DIR" -DVOXEL_PGO=USE -DVOXEL_PGO_DIR="$PROFILE_DIR" "$@"
+cmake --build "$BUILD_DIR" --target voxel_dda_raylib --clean-first >/dev/null
+
+echo "== golden images"
+"$BUILD_DIR/voxel_dda_raylib" --golden-test "$ROOT_DIR/tests/golden" | tail -n 1
+
+echo "== headless benchmark ($BENCH_FRAMES frames, best of $RUNS)"
+base_ms="$(measure "$BASE_DIR/voxel_dda_raylib")"
+pgo_ms="$(measure "$BUILD_DIR/voxel_dda_raylib")"
+awk -v b="$base_ms" -v p="$pgo_ms" 'BEGIN {
+  printf "LTO:       %.3f ms/frame\nLTO + PGO: %.3f ms/frame\ngain:      %.1f%%\n", b, p, (b > 0) ? 100 * (b - p) / b : 0
+}'
+echo "optimized binary: $BUILD_DIR/voxel_dda_raylib"
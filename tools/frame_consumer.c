@@ -0,0 +1,148 @@
+// Reference consumer for the renderer's shared-memory frame ring.
+//
+//   voxel_dda_raylib --headless --frames 600 --shm /voxel_frames &
+//   frame_consumer /voxel_frames
+//
+// Always reads the newest published frame in place (no copy), checks the
+// slot's seqlock to reject frames overwritten mid-read, and reports frames
+// received, frames dropped (skipped or torn) and end-to-end latency from the
+// start of rendering to the moment the consumer has read the frame.
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../frame_ring.h"
+
+static void usage(const char* exe) {
+    fprintf(stderr, "usage: %s NAME [--frames N] [--timeout-ms T]\n", exe);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        usage(argv[0]);
+        return 2;
+    }
+    const char* name = argv[1];
+    long max_frames = 0;
+    long timeout_ms = 5000;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            max_frames = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--timeout-ms") == 0 && i + 1 < argc) {
+            timeout_ms = atol(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    // The renderer may not have created the ring yet.
+    int fd = -1;
+    for (long waited = 0; fd < 0 && waited <= timeout_ms; waited += 10) {
+        fd = shm_open(name, O_RDWR, 0);
+        if (fd < 0) usleep(10000);
+    }
+    if (fd < 0) {
+        perror("shm_open");
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(FrameRingHeader)) {
+        fprintf(stderr, "%s: not a frame ring\n", name);
+        close(fd);
+        return 1;
+    }
+    const size_t bytes = (size_t) st.st_size;
+    // Writable only for the header's waiter count; pixels are read in place.
+    uint8_t* base = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    FrameRingHeader* h = (FrameRingHeader*) base;
+    for (long waited = 0; __atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != FRAME_RING_MAGIC && waited < timeout_ms; waited += 10) {
+        usleep(10000);
+    }
+    if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != FRAME_RING_MAGIC || h->version != FRAME_RING_VERSION
+        || bytes < frame_ring_bytes(h->width, h->height)) {
+        fprintf(stderr, "%s: unexpected ring layout\n", name);
+        return 1;
+    }
+    printf("ring %s: %ux%u, %u slots\n", name, h->width, h->height, h->slots);
+
+    uint64_t next = __atomic_load_n(&h->published, __ATOMIC_ACQUIRE);
+    long received = 0;
+    long dropped = 0;
+    long torn = 0;
+    double latency_sum_ms = 0.0;
+    double latency_max_ms = 0.0;
+    double delivery_sum_ms = 0.0;
+    double last_luma = 0.0;
+    uint64_t idle_since = frame_ring_now_ns();
+
+    while (max_frames <= 0 || received < max_frames) {
+        const uint32_t seen = __atomic_load_n(&h->notify, __ATOMIC_ACQUIRE);
+        const uint64_t published = __atomic_load_n(&h->published, __ATOMIC_ACQUIRE);
+        if (published == next) {
+            if (__atomic_load_n(&h->closed, __ATOMIC_ACQUIRE)) break;
+            if ((frame_ring_now_ns() - idle_since) / 1000000u > (uint64_t) timeout_ms) {
+                fprintf(stderr, "no frame for %ld ms, giving up\n", timeout_ms);
+                break;
+            }
+            frame_ring_wait(h, seen, 100000000L);
+            continue;
+        }
+
+        // Take the newest frame; anything between is dropped.
+        const uint64_t n = published - 1u;
+        dropped += (long) (n - next);
+        next = published;
+
+        const FrameRingSlot* slot = &h->slot[n % FRAME_RING_SLOTS];
+        const uint64_t state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+        if (state != 2u * n + 2u) {
+            torn += 1;
+            continue;
+        }
+        const uint64_t render_ns = slot->render_ns;
+        const uint64_t publish_ns = slot->publish_ns;
+
+        // Use the pixels in place: mean luma as a stand-in for real work.
+        const uint8_t* px = base + h->pixel_offset + (n % FRAME_RING_SLOTS) * h->slot_bytes;
+        uint64_t luma = 0;
+        for (uint64_t i = 0; i < h->slot_bytes; i += 4) {
+            luma += (uint64_t) (77u * px[i] + 150u * px[i + 1] + 29u * px[i + 2]) >> 8;
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->state, __ATOMIC_RELAXED) != state) {
+            torn += 1;
+            continue;
+        }
+
+        const uint64_t now = frame_ring_now_ns();
+        const double latency_ms = (double) (now - render_ns) * 1e-6;
+        latency_sum_ms += latency_ms;
+        delivery_sum_ms += (double) (now - publish_ns) * 1e-6;
+        if (latency_ms > latency_max_ms) latency_max_ms = latency_ms;
+        last_luma = (double) luma / (double) (h->slot_bytes / 4u);
+        received += 1;
+        idle_since = now;
+    }
+
+    printf("received %ld frames, dropped %ld (%ld skipped, %ld torn)\n", received, dropped + torn, dropped, torn);
+    if (received > 0) {
+        printf("latency render->consumer: avg %.3f ms, max %.3f ms | publish->consumer avg %.3f ms\n",
+            latency_sum_ms / (double) received, latency_max_ms, delivery_sum_ms / (double) received);
+        printf("last frame mean luma %.1f\n", last_luma);
+    }
+    munmap(base, bytes);
+    return 0;
+}